@@ -0,0 +1,608 @@
+// addon.c
+/* A Node.js addon that keeps the positions of many games in native memory, keyed by game id,
+so the server can check every move its players make instead of trusting their browsers. Moves
+arrive in batches that are split by game across the libuv thread pool, so the event loop stays
+free while they are checked. Build it with `make addon` and load build/chess.node. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <node_api.h>
+#include "chess.h"
+
+// Longest game id accepted, in bytes
+#define MAX_ID 127
+
+// The result of each move of a batch, exported to JavaScript as results
+enum Move_Result {
+    MOVE_OK = 0,
+    MOVE_ILLEGAL = 1,
+    MOVE_MALFORMED = 2,
+    MOVE_NO_GAME = 3,
+    // The move was sent for the side not to move
+    MOVE_WRONG_SIDE = 4,
+};
+
+/* What a game needs to carry between moves. A full Position holds an undo stack that moves
+checked here never use, so games keep only this and are copied into a scratch Position while
+their moves are checked, which lets tens of thousands of games fit in a few megabytes. */
+typedef struct {
+    U64 bitboards[12];
+    Fen fen;
+    U64 zobrist_key;
+    Eval_Terms eval;
+} Game_State;
+
+typedef struct {
+    Game_State state;
+    // Stops two batches in flight at once from changing the same game together
+    pthread_mutex_t lock;
+    // Held by the game table and by every batch that refers to the game
+    int references;
+    char id[MAX_ID + 1];
+} Game;
+
+/* Games by id in an open addressing hash table. It is only read and changed on the main
+thread; worker threads are handed Game pointers that the batch holds references to. */
+typedef struct {
+    Game **slots;
+    unsigned capacity;
+    // Live games plus deleted slots, which still lengthen probes until the table is rebuilt
+    unsigned used;
+    unsigned live;
+} Game_Table;
+
+// Marks a slot whose game was deleted
+static Game deleted_slot;
+#define DELETED (&deleted_slot)
+
+// A move of a batch, parsed on the main thread
+typedef struct {
+    Game *game;
+    int from;
+    int to;
+    // Index of the promotion piece in "nbrq", or -1 if the move names none
+    int promotion;
+    // The side making the move, 'w' or 'b', or 0 if the batch doesn't say
+    char side;
+} Batch_Move;
+
+typedef struct Batch Batch;
+
+// The share of a batch checked by one worker thread
+typedef struct {
+    Batch *batch;
+    napi_async_work work;
+    int *indexes;
+    int count;
+} Chunk;
+
+struct Batch {
+    Batch_Move *moves;
+    unsigned char *results;
+    int count;
+    // Apply legal moves to their games, rather than only checking them
+    bool apply;
+    Chunk *chunks;
+    int chunk_count;
+    int chunks_pending;
+    napi_deferred deferred;
+};
+
+// FNV-1a hash of a game id
+static unsigned hash_id(const char *id)
+{
+    unsigned hash = 2166136261u;
+    for ( ; *id; id++) {
+        hash = (hash ^ (unsigned char)*id) * 16777619u;
+    }
+    return hash;
+}
+
+// Return the slot holding a game id, or the empty slot where it would go
+static Game **table_slot(Game_Table *table, const char *id)
+{
+    unsigned mask = table->capacity - 1;
+    Game **reuse = NULL;
+    for (unsigned i = hash_id(id) & mask; ; i = (i + 1) & mask) {
+        Game *game = table->slots[i];
+        if (!game) {
+            return reuse ? reuse : &table->slots[i];
+        }
+        if (game == DELETED) {
+            if (!reuse) {
+                reuse = &table->slots[i];
+            }
+        } else if (strcmp(game->id, id) == 0) {
+            return &table->slots[i];
+        }
+    }
+}
+
+static Game *table_find(Game_Table *table, const char *id)
+{
+    Game *game = *table_slot(table, id);
+    return game == DELETED ? NULL : game;
+}
+
+// Rebuild the table with at least four slots per live game, dropping deleted slots
+static void table_grow(Game_Table *table)
+{
+    Game **old_slots = table->slots;
+    unsigned old_capacity = table->capacity;
+
+    while (table->capacity < 4 * (table->live + 1)) {
+        table->capacity *= 2;
+    }
+    table->slots = calloc(table->capacity, sizeof(Game *));
+    table->used = table->live;
+    for (unsigned i = 0; i < old_capacity; i++) {
+        if (old_slots[i] && old_slots[i] != DELETED) {
+            *table_slot(table, old_slots[i]->id) = old_slots[i];
+        }
+    }
+    free(old_slots);
+}
+
+static void release_game(Game *game)
+{
+    if (--game->references == 0) {
+        pthread_mutex_destroy(&game->lock);
+        free(game);
+    }
+}
+
+static void save_state(Game_State *state, Position *pos)
+{
+    memcpy(state->bitboards, pos->bitboards, sizeof(state->bitboards));
+    state->fen = pos->fen;
+    state->zobrist_key = pos->zobrist_key;
+    state->eval = pos->eval;
+}
+
+static void load_state(Position *pos, Game_State *state)
+{
+    memcpy(pos->bitboards, state->bitboards, sizeof(pos->bitboards));
+    // Rebuilt rather than stored, which would make every game a third bigger
+    update_mailbox(pos);
+    pos->fen = state->fen;
+    pos->zobrist_key = state->zobrist_key;
+    pos->eval = state->eval;
+    pos->undo_count = 0;
+}
+
+// Parse a move in UCI notation into a Batch_Move, returning false if it is not one
+static bool parse_uci(const char *uci, size_t length, Batch_Move *move)
+{
+    const char *promotion;
+    if (length != 4 && length != 5) {
+        return false;
+    }
+    for (int i = 0; i < 4; i += 2) {
+        if (uci[i] < 'a' || uci[i] > 'h' || uci[i + 1] < '1' || uci[i + 1] > '8') {
+            return false;
+        }
+    }
+    move->from = (uci[1] - '1') * 8 + ('h' - uci[0]);
+    move->to = (uci[3] - '1') * 8 + ('h' - uci[2]);
+    move->promotion = -1;
+    if (length == 5) {
+        promotion = strchr("nbrq", uci[4]);
+        if (!uci[4] || !promotion) {
+            return false;
+        }
+        move->promotion = promotion - "nbrq";
+    }
+    return true;
+}
+
+// Return the legal move of a position that a parsed move names, or 0 if there is none
+static Move find_legal_move(Position *pos, Batch_Move *move)
+{
+    Move move_list[MAX_MOVES];
+    int count = generate_moves(pos, move_list);
+    for (int i = 0; i < count; i++) {
+        Move legal = move_list[i];
+        if (MOVE_FROM(legal) != move->from || MOVE_TO(legal) != move->to) {
+            continue;
+        }
+        if (IS_PROMOTION(legal) ? (int)(MOVE_FLAGS(legal) & 3) == move->promotion : move->promotion < 0) {
+            return legal;
+        }
+    }
+    return 0;
+}
+
+// Check, and if asked apply, one chunk of a batch. Runs on a libuv worker thread.
+static void execute_chunk(napi_env env, void *data)
+{
+    Chunk *chunk = data;
+    Batch *batch = chunk->batch;
+    Position *scratch = calloc(1, sizeof(Position));
+
+    for (int i = 0; i < chunk->count; i++) {
+        int index = chunk->indexes[i];
+        Batch_Move *move = &batch->moves[index];
+        Game *game = move->game;
+        Move legal;
+
+        pthread_mutex_lock(&game->lock);
+        load_state(scratch, &game->state);
+        // A player may not move for the other side, even a move that side could make
+        if (move->side && move->side != scratch->fen.active_color) {
+            pthread_mutex_unlock(&game->lock);
+            batch->results[index] = MOVE_WRONG_SIDE;
+            continue;
+        }
+        legal = find_legal_move(scratch, move);
+        if (legal && batch->apply) {
+            do_move(scratch, legal);
+            save_state(&game->state, scratch);
+        }
+        pthread_mutex_unlock(&game->lock);
+        batch->results[index] = legal ? MOVE_OK : MOVE_ILLEGAL;
+    }
+    free(scratch);
+}
+
+// Resolve the batch's promise once its last chunk is done. Runs on the main thread.
+static void complete_chunk(napi_env env, napi_status status, void *data)
+{
+    Chunk *chunk = data;
+    Batch *batch = chunk->batch;
+    napi_value buffer, results;
+    void *bytes;
+
+    napi_delete_async_work(env, chunk->work);
+    if (--batch->chunks_pending > 0) {
+        return;
+    }
+
+    napi_create_arraybuffer(env, batch->count, &bytes, &buffer);
+    memcpy(bytes, batch->results, batch->count);
+    napi_create_typedarray(env, napi_uint8_array, batch->count, buffer, 0, &results);
+    napi_resolve_deferred(env, batch->deferred, results);
+
+    for (int i = 0; i < batch->count; i++) {
+        if (batch->moves[i].game) {
+            release_game(batch->moves[i].game);
+        }
+    }
+    for (int i = 0; i < batch->chunk_count; i++) {
+        free(batch->chunks[i].indexes);
+    }
+    free(batch->chunks);
+    free(batch->moves);
+    free(batch->results);
+    free(batch);
+}
+
+// Threads in the libuv pool, which is how many chunks a batch is split into
+static int pool_size()
+{
+    char *size = getenv("UV_THREADPOOL_SIZE");
+    int threads = size ? atoi(size) : 4;
+    return threads > 0 ? threads : 4;
+}
+
+// Read a string argument into a buffer, returning its length or -1 if it is not a string that fits
+static long read_string(napi_env env, napi_value value, char *buffer, size_t size)
+{
+    napi_valuetype type;
+    size_t length;
+    napi_typeof(env, value, &type);
+    if (type != napi_string || napi_get_value_string_utf8(env, value, buffer, size, &length) != napi_ok
+        || length >= size - 1) {
+        return -1;
+    }
+    return (long)length;
+}
+
+static Game_Table *get_table(napi_env env)
+{
+    Game_Table *table;
+    napi_get_instance_data(env, (void **)&table);
+    return table;
+}
+
+// Read a game id argument and find its game, or throw and return NULL if the id is not a string
+static Game *game_argument(napi_env env, napi_callback_info info, char id[MAX_ID + 2], size_t *argc, napi_value *argv)
+{
+    napi_get_cb_info(env, info, argc, argv, NULL, NULL);
+    if (*argc < 1 || read_string(env, argv[0], id, MAX_ID + 2) < 0) {
+        napi_throw_type_error(env, NULL, "game id must be a string of at most 127 bytes");
+        return NULL;
+    }
+    return table_find(get_table(env), id);
+}
+
+/* createGame(id, fen?) starts a game from a FEN string, or from the start position. Returns
+false if the id is taken or the FEN is not a valid position. */
+static napi_value create_game(napi_env env, napi_callback_info info)
+{
+    static const char *start_fen = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+    Game_Table *table = get_table(env);
+    napi_value argv[2], result;
+    size_t argc = 2;
+    char id[MAX_ID + 2];
+    char fen[128];
+    Position *scratch;
+    Game *game, **slot;
+    bool created = false;
+    bool thrown;
+
+    game = game_argument(env, info, id, &argc, argv);
+    if (napi_is_exception_pending(env, &thrown) != napi_ok || thrown) {
+        return NULL;
+    }
+    if (argc > 1 && read_string(env, argv[1], fen, sizeof(fen)) < 0) {
+        napi_throw_type_error(env, NULL, "fen must be a string");
+        return NULL;
+    }
+
+    scratch = calloc(1, sizeof(Position));
+    if (!game && load_fen(scratch, argc > 1 ? fen : (char *)start_fen)) {
+        game = calloc(1, sizeof(Game));
+        save_state(&game->state, scratch);
+        pthread_mutex_init(&game->lock, NULL);
+        game->references = 1;
+        strcpy(game->id, id);
+        if (4 * (table->used + 1) > 3 * table->capacity) {
+            table_grow(table);
+        }
+        slot = table_slot(table, id);
+        if (!*slot) {
+            table->used++;
+        }
+        *slot = game;
+        table->live++;
+        created = true;
+    }
+    free(scratch);
+    napi_get_boolean(env, created, &result);
+    return result;
+}
+
+// deleteGame(id) forgets a game, returning false if there was none
+static napi_value delete_game(napi_env env, napi_callback_info info)
+{
+    Game_Table *table = get_table(env);
+    napi_value argv[1], result;
+    size_t argc = 1;
+    char id[MAX_ID + 2];
+    Game *game = game_argument(env, info, id, &argc, argv);
+
+    if (game) {
+        *table_slot(table, id) = DELETED;
+        table->live--;
+        release_game(game);
+    }
+    napi_get_boolean(env, game != NULL, &result);
+    return result;
+}
+
+// fen(id) returns a game's FEN string, or null if there is no such game
+static napi_value game_fen(napi_env env, napi_callback_info info)
+{
+    napi_value argv[1], result;
+    size_t argc = 1;
+    char id[MAX_ID + 2];
+    Game *game = game_argument(env, info, id, &argc, argv);
+    Position *scratch;
+
+    if (!game) {
+        napi_get_null(env, &result);
+        return result;
+    }
+    scratch = calloc(1, sizeof(Position));
+    pthread_mutex_lock(&game->lock);
+    load_state(scratch, &game->state);
+    pthread_mutex_unlock(&game->lock);
+    napi_create_string_utf8(env, stringify_fen(scratch), NAPI_AUTO_LENGTH, &result);
+    free(scratch);
+    return result;
+}
+
+// legalMoves(id) returns the legal moves of a game in UCI notation, or null if there is no such game
+static napi_value legal_moves(napi_env env, napi_callback_info info)
+{
+    napi_value argv[1], result, element;
+    size_t argc = 1;
+    char id[MAX_ID + 2];
+    Game *game = game_argument(env, info, id, &argc, argv);
+    Move move_list[MAX_MOVES];
+    Position *scratch;
+    int count;
+
+    if (!game) {
+        napi_get_null(env, &result);
+        return result;
+    }
+    scratch = calloc(1, sizeof(Position));
+    pthread_mutex_lock(&game->lock);
+    load_state(scratch, &game->state);
+    pthread_mutex_unlock(&game->lock);
+    count = generate_moves(scratch, move_list);
+    free(scratch);
+
+    napi_create_array_with_length(env, count, &result);
+    for (int i = 0; i < count; i++) {
+        char uci[6];
+        napi_create_string_utf8(env, move_to_uci(move_list[i], uci), NAPI_AUTO_LENGTH, &element);
+        napi_set_element(env, result, i, element);
+    }
+    return result;
+}
+
+/* Parse a batch of game ids, UCI moves and optionally the side making each move, and queue it
+on the thread pool, split into one chunk per pool thread. All moves of a game go to the same
+chunk, so they are checked in the order given. Batches run at once may check a game's moves
+out of order, so a caller waits for each before sending the next. Returns a promise of a
+Uint8Array holding a Move_Result for each move. */
+static napi_value queue_batch(napi_env env, napi_callback_info info, bool apply)
+{
+    Game_Table *table = get_table(env);
+    napi_value argv[3], promise, name;
+    size_t argc = 3;
+    uint32_t count, moves_length, sides_length;
+    napi_valuetype sides_type = napi_undefined;
+    bool is_array;
+    Batch *batch;
+
+    napi_get_cb_info(env, info, &argc, argv, NULL, NULL);
+    if (argc < 2 || napi_is_array(env, argv[0], &is_array) != napi_ok || !is_array
+        || napi_is_array(env, argv[1], &is_array) != napi_ok || !is_array) {
+        napi_throw_type_error(env, NULL, "expected an array of game ids and an array of moves");
+        return NULL;
+    }
+    if (argc > 2) {
+        napi_typeof(env, argv[2], &sides_type);
+        if (sides_type != napi_undefined && (napi_is_array(env, argv[2], &is_array) != napi_ok || !is_array)) {
+            napi_throw_type_error(env, NULL, "sides must be an array");
+            return NULL;
+        }
+    }
+    napi_get_array_length(env, argv[0], &count);
+    napi_get_array_length(env, argv[1], &moves_length);
+    if (count != moves_length) {
+        napi_throw_range_error(env, NULL, "there must be one game id for every move");
+        return NULL;
+    }
+    if (sides_type != napi_undefined) {
+        napi_get_array_length(env, argv[2], &sides_length);
+        if (sides_length != count) {
+            napi_throw_range_error(env, NULL, "there must be one side for every move");
+            return NULL;
+        }
+    }
+
+    batch = calloc(1, sizeof(Batch));
+    batch->count = count;
+    batch->apply = apply;
+    batch->moves = calloc(count ? count : 1, sizeof(Batch_Move));
+    batch->results = calloc(count ? count : 1, 1);
+    batch->chunk_count = pool_size();
+    batch->chunks = calloc(batch->chunk_count, sizeof(Chunk));
+    for (int c = 0; c < batch->chunk_count; c++) {
+        batch->chunks[c].batch = batch;
+        batch->chunks[c].indexes = malloc((count ? count : 1) * sizeof(int));
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        napi_value id_value, move_value;
+        char id[MAX_ID + 2];
+        char uci[8];
+        long length;
+        Batch_Move *move = &batch->moves[i];
+
+        napi_get_element(env, argv[0], i, &id_value);
+        napi_get_element(env, argv[1], i, &move_value);
+        if (read_string(env, id_value, id, sizeof(id)) < 0 || !(move->game = table_find(table, id))) {
+            batch->results[i] = MOVE_NO_GAME;
+            continue;
+        }
+        length = read_string(env, move_value, uci, sizeof(uci));
+        if (length < 0 || !parse_uci(uci, length, move)) {
+            move->game = NULL;
+            batch->results[i] = MOVE_MALFORMED;
+            continue;
+        }
+        if (sides_type != napi_undefined) {
+            napi_value side_value;
+            char side[4];
+            napi_get_element(env, argv[2], i, &side_value);
+            if (read_string(env, side_value, side, sizeof(side)) != 1 || (side[0] != 'w' && side[0] != 'b')) {
+                move->game = NULL;
+                batch->results[i] = MOVE_MALFORMED;
+                continue;
+            }
+            move->side = side[0];
+        }
+        move->game->references++;
+        Chunk *chunk = &batch->chunks[hash_id(id) % batch->chunk_count];
+        chunk->indexes[chunk->count++] = i;
+    }
+
+    napi_create_promise(env, &batch->deferred, &promise);
+    napi_create_string_utf8(env, "chess.checkMoves", NAPI_AUTO_LENGTH, &name);
+    // Empty chunks are still queued so that every batch resolves the same way
+    batch->chunks_pending = batch->chunk_count;
+    for (int c = 0; c < batch->chunk_count; c++) {
+        napi_create_async_work(env, NULL, name, execute_chunk, complete_chunk, &batch->chunks[c], &batch->chunks[c].work);
+        napi_queue_async_work(env, batch->chunks[c].work);
+    }
+    return promise;
+}
+
+// applyMoves(ids, moves, sides?) makes each legal move on its game
+static napi_value apply_moves(napi_env env, napi_callback_info info)
+{
+    return queue_batch(env, info, true);
+}
+
+// validateMoves(ids, moves, sides?) checks each move without changing any game
+static napi_value validate_moves(napi_env env, napi_callback_info info)
+{
+    return queue_batch(env, info, false);
+}
+
+// gameCount() returns the number of games held
+static napi_value game_count(napi_env env, napi_callback_info info)
+{
+    napi_value result;
+    napi_create_uint32(env, get_table(env)->live, &result);
+    return result;
+}
+
+static void free_table(napi_env env, void *data, void *hint)
+{
+    Game_Table *table = data;
+    for (unsigned i = 0; i < table->capacity; i++) {
+        if (table->slots[i] && table->slots[i] != DELETED) {
+            release_game(table->slots[i]);
+        }
+    }
+    free(table->slots);
+    free(table);
+}
+
+static void export_function(napi_env env, napi_value exports, const char *name, napi_callback function)
+{
+    napi_value value;
+    napi_create_function(env, name, NAPI_AUTO_LENGTH, function, NULL, &value);
+    napi_set_named_property(env, exports, name, value);
+}
+
+static void export_result(napi_env env, napi_value results, const char *name, int result)
+{
+    napi_value value;
+    napi_create_uint32(env, result, &value);
+    napi_set_named_property(env, results, name, value);
+}
+
+NAPI_MODULE_INIT()
+{
+    Game_Table *table = calloc(1, sizeof(Game_Table));
+    napi_value results;
+
+    table->capacity = 1024;
+    table->slots = calloc(table->capacity, sizeof(Game *));
+    napi_set_instance_data(env, table, free_table, NULL);
+
+    export_function(env, exports, "createGame", create_game);
+    export_function(env, exports, "deleteGame", delete_game);
+    export_function(env, exports, "fen", game_fen);
+    export_function(env, exports, "legalMoves", legal_moves);
+    export_function(env, exports, "applyMoves", apply_moves);
+    export_function(env, exports, "validateMoves", validate_moves);
+    export_function(env, exports, "gameCount", game_count);
+
+    napi_create_object(env, &results);
+    export_result(env, results, "OK", MOVE_OK);
+    export_result(env, results, "ILLEGAL", MOVE_ILLEGAL);
+    export_result(env, results, "MALFORMED", MOVE_MALFORMED);
+    export_result(env, results, "NO_GAME", MOVE_NO_GAME);
+    export_result(env, results, "WRONG_SIDE", MOVE_WRONG_SIDE);
+    napi_set_named_property(env, exports, "results", results);
+    return exports;
+}
@@ -0,0 +1,299 @@
+// bookbench.c
+/* Time opening book lookups, and write test books to time them on.
+
+`bookbench write <file> [games]` plays random games from the start position, with the first
+moves generated chosen more often so that some lines repeat the way opening theory does, and
+writes every position and move on the way as a Polyglot book weighted by how often each was
+played. It then opens the book and checks that every move written comes back for its
+position.
+
+`bookbench <file>` times finding a key in the book by binary search, for keys it holds and keys
+it doesn't, and probing positions of random games, which also computes their keys and checks
+their moves are legal.
+
+Both first check polyglot_key against the keys given with the Polyglot format for a few
+positions, and fail if any differs, as books from other tools would then not probe. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "chess.h"
+
+#define BOOK_PLIES 16
+#define LOOKUPS 1000000
+
+char *start_fen = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+
+Position position;
+
+// Positions given with the Polyglot format and their keys
+struct {
+    char *fen;
+    U64 key;
+} published_keys[] = {
+    {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 0x463b96181691fc9cULL},
+    {"rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1", 0x823c9b50fd114196ULL},
+    {"rnbqkbnr/ppp1pppp/8/3p4/4P3/8/PPPP1PPP/RNBQKBNR w KQkq d6 0 2", 0x0756b94461c50fb0ULL},
+    {"rnbqkbnr/ppp1pppp/8/3pP3/8/8/PPPP1PPP/RNBQKBNR b KQkq - 0 2", 0x662fafb965db29d4ULL},
+    {"rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPP1PPP/RNBQKBNR w KQkq f6 0 3", 0x22a48b5a8e47ff78ULL},
+    {"rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPPKPPP/RNBQ1BNR b kq - 0 3", 0x652a607ca3f242c1ULL},
+    {"rnbq1bnr/ppp1pkpp/8/3pPp2/8/8/PPPPKPPP/RNBQ1BNR w - - 0 4", 0x00fdd303c946bdd9ULL},
+    {"rnbqkbnr/p1pppppp/8/8/PpP4P/8/1P1PPPP1/RNBQKBNR b KQkq c3 0 3", 0x3c8123ea7b067637ULL},
+    {"rnbqkbnr/p1pppppp/8/8/P6P/R1p5/1P1PPPP1/1NBQKBNR b Kkq - 0 4", 0x5c3f9b829b279560ULL},
+};
+
+typedef struct {
+    U64 key;
+    unsigned move;
+    unsigned weight;
+} Written_Entry;
+
+double seconds_now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Pick a move of a random game, one of the first three generated half the time
+Move random_move(Move *move_list, int count)
+{
+    return move_list[rand() % 2 ? rand() % (count < 3 ? count : 3) : rand() % count];
+}
+
+// Convert a move to Polyglot's encoding, in which castling is the king taking its own rook
+unsigned move_to_book(Move move)
+{
+    int from = MOVE_FROM(move);
+    int to = MOVE_TO(move);
+
+    if (MOVE_FLAGS(move) == KING_CASTLE) {
+        to = from - 3;
+    } else if (MOVE_FLAGS(move) == QUEEN_CASTLE) {
+        to = from + 4;
+    }
+    return (to ^ 7) | (from ^ 7) << 6 | (IS_PROMOTION(move) ? 5 - PROMOTION_PIECE(move) : 0) << 12;
+}
+
+int compare_entries(const void *a, const void *b)
+{
+    const Written_Entry *x = a, *y = b;
+    if (x->key != y->key) {
+        return x->key < y->key ? -1 : 1;
+    }
+    if (x->move != y->move) {
+        return x->move < y->move ? -1 : 1;
+    }
+    return 0;
+}
+
+// Heaviest first within a position, as Polyglot books are usually written
+int compare_by_weight(const void *a, const void *b)
+{
+    const Written_Entry *x = a, *y = b;
+    if (x->key != y->key) {
+        return x->key < y->key ? -1 : 1;
+    }
+    return (int)y->weight - (int)x->weight;
+}
+
+void write_big_endian(FILE *file, U64 value, int bytes)
+{
+    for (int i = bytes - 1; i >= 0; i--) {
+        fputc((value >> (8 * i)) & 255, file);
+    }
+}
+
+int write_book(char *path, int games)
+{
+    Move move_list[MAX_MOVES];
+    Book_Move book_moves[MAX_BOOK_MOVES];
+    Written_Entry *entries = malloc((size_t)games * BOOK_PLIES * sizeof(Written_Entry));
+    size_t count = 0, unique = 0;
+    long long missing = 0;
+
+    if (!entries) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    srand(1);
+    for (int game = 0; game < games; game++) {
+        load_fen(&position, start_fen);
+        for (int ply = 0; ply < BOOK_PLIES; ply++) {
+            int moves = generate_moves(&position, move_list);
+            if (moves == 0) {
+                break;
+            }
+            Move move = random_move(move_list, moves);
+            entries[count++] = (Written_Entry){polyglot_key(&position), move_to_book(move), 1};
+            do_move(&position, move);
+        }
+    }
+
+    // Count each position and move once, weighted by how often it was played
+    qsort(entries, count, sizeof(Written_Entry), compare_entries);
+    for (size_t i = 0; i < count; i++) {
+        if (unique && entries[unique - 1].key == entries[i].key && entries[unique - 1].move == entries[i].move) {
+            if (entries[unique - 1].weight < 65535) {
+                entries[unique - 1].weight++;
+            }
+        } else {
+            entries[unique++] = entries[i];
+        }
+    }
+    qsort(entries, unique, sizeof(Written_Entry), compare_by_weight);
+
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        perror(path);
+        return 1;
+    }
+    for (size_t i = 0; i < unique; i++) {
+        write_big_endian(file, entries[i].key, 8);
+        write_big_endian(file, entries[i].move, 2);
+        write_big_endian(file, entries[i].weight, 2);
+        write_big_endian(file, 0, 4);
+    }
+    if (fclose(file) != 0) {
+        perror(path);
+        return 1;
+    }
+    printf("%zu entries for %d games written to %s\n", unique, games, path);
+
+    // Every move played must come back for its position
+    if (!book_open(path)) {
+        fprintf(stderr, "%s can't be opened as a book\n", path);
+        return 1;
+    }
+    srand(1);
+    for (int game = 0; game < games; game++) {
+        load_fen(&position, start_fen);
+        for (int ply = 0; ply < BOOK_PLIES; ply++) {
+            int moves = generate_moves(&position, move_list);
+            if (moves == 0) {
+                break;
+            }
+            Move move = random_move(move_list, moves);
+            int found = book_probe(&position, book_moves);
+            bool present = false;
+            for (int i = 0; i < found; i++) {
+                present |= book_moves[i].move == move;
+            }
+            missing += !present;
+            do_move(&position, move);
+        }
+    }
+    book_close();
+    free(entries);
+    printf("%lld moves played are missing from the book\n", missing);
+    return missing ? 1 : 0;
+}
+
+int time_book(char *path)
+{
+    Move move_list[MAX_MOVES];
+    Book_Move book_moves[MAX_BOOK_MOVES];
+    U64 *keys = malloc(LOOKUPS * sizeof(U64));
+    Position *positions = calloc(LOOKUPS / 100, sizeof(Position));
+    long long found = 0, probed = 0;
+    size_t first, entries = 0;
+
+    if (!keys || !positions) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    if (!book_open(path)) {
+        fprintf(stderr, "%s can't be opened as a book\n", path);
+        return 1;
+    }
+    // Count the entries from the file size, which book_find can't tell
+    FILE *file = fopen(path, "rb");
+    if (file) {
+        fseek(file, 0, SEEK_END);
+        entries = ftell(file) / 16;
+        fclose(file);
+    }
+    printf("%zu entries\n", entries);
+
+    // Keys of the book's own entries, read back through positions, and random keys it won't hold
+    srand(2);
+    for (int i = 0; i < LOOKUPS / 100; i++) {
+        load_fen(&positions[i], start_fen);
+        int plies = rand() % BOOK_PLIES;
+        for (int ply = 0; ply < plies; ply++) {
+            int moves = generate_moves(&positions[i], move_list);
+            if (moves == 0) {
+                break;
+            }
+            do_move(&positions[i], random_move(move_list, moves));
+        }
+        positions[i].undo_count = 0;
+    }
+    for (int i = 0; i < LOOKUPS; i++) {
+        keys[i] = i % 2 ? polyglot_key(&positions[i / 2 % (LOOKUPS / 100)]) : (U64)rand() << 32 ^ rand();
+    }
+
+    double start = seconds_now();
+    for (int i = 0; i < LOOKUPS; i++) {
+        found += book_find(keys[i], &first) > 0;
+    }
+    double find_seconds = seconds_now() - start;
+
+    start = seconds_now();
+    for (int pass = 0; pass < 100; pass++) {
+        for (int i = 0; i < LOOKUPS / 100; i++) {
+            probed += book_probe(&positions[i], book_moves) > 0;
+        }
+    }
+    double probe_seconds = seconds_now() - start;
+
+    printf("book_find   %7.1f ns per key, %lld of %d found\n", 1e9 * find_seconds / LOOKUPS, found, LOOKUPS);
+    printf("book_probe  %7.1f ns per position, %lld of %d in the book\n", 1e9 * probe_seconds / LOOKUPS, probed, LOOKUPS);
+    book_close();
+    free(keys);
+    free(positions);
+    return 0;
+}
+
+void usage()
+{
+    fprintf(stderr, "usage: bookbench <book file>\n       bookbench write <book file> [games]\n");
+    exit(2);
+}
+
+// Return false, after saying which, if any published key differs from polyglot_key's
+bool check_published_keys()
+{
+    bool matched = polyglot_random_is_published();
+    if (!matched) {
+        fprintf(stderr, "polyglot_random is not the published table\n");
+    }
+    for (size_t i = 0; i < sizeof(published_keys) / sizeof(published_keys[0]); i++) {
+        load_fen(&position, published_keys[i].fen);
+        U64 key = polyglot_key(&position);
+        if (key != published_keys[i].key) {
+            fprintf(stderr, "%s: key %016llx, published %016llx\n", published_keys[i].fen,
+                    key, published_keys[i].key);
+            matched = false;
+        }
+    }
+    return matched;
+}
+
+int main(int argc, char *argv[])
+{
+    if (!check_published_keys()) {
+        return 1;
+    }
+    if (argc >= 3 && argc <= 4 && strcmp(argv[1], "write") == 0) {
+        int games = argc == 4 ? atoi(argv[3]) : 100000;
+        if (games < 1) {
+            usage();
+        }
+        return write_book(argv[2], games);
+    }
+    if (argc != 2) {
+        usage();
+    }
+    return time_book(argv[1]);
+}
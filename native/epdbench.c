@@ -0,0 +1,256 @@
+// epdbench.c
+/* Stream positions from an EPD or FEN file into the engine one line at a time and report how
+many positions per second are parsed. Also generates position files from random games, and
+checks how FEN strings that need fixing up are loaded and which promotions promote_pawn takes. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "chess.h"
+
+// Longest line read from a position file, EPD operations included
+#define MAX_LINE 4096
+
+Position position;
+
+/* FEN strings with castling rights that the board can't have, the FEN they load as, and the
+castling moves the side to move then has */
+struct {
+    char *fen;
+    char *loaded;
+    int castles;
+} castling_cases[] = {
+    {"4k3/8/8/8/8/8/8/4K3 w K - 0 1", "4k3/8/8/8/8/8/8/4K3 w - - 0 1", 0},
+    {"r3k2r/8/8/8/8/8/8/R3K2R w KQkq - 0 1", "r3k2r/8/8/8/8/8/8/R3K2R w KQkq - 0 1", 2},
+    {"r3k2r/8/8/8/8/8/8/R3K1R1 w KQkq - 0 1", "r3k2r/8/8/8/8/8/8/R3K1R1 w Qkq - 0 1", 1},
+    {"r3k2r/8/8/8/8/8/8/R4K1R w KQkq - 0 1", "r3k2r/8/8/8/8/8/8/R4K1R w kq - 0 1", 0},
+    {"1r2k2r/8/8/8/8/8/8/R3K2R b KQkq - 0 1", "1r2k2r/8/8/8/8/8/8/R3K2R b KQk - 0 1", 1},
+    {"r3k2r/8/8/8/8/8/8/R3K1Nr b KQkq - 0 1", "r3k2r/8/8/8/8/8/8/R3K1Nr b Qkq - 0 1", 2},
+};
+
+/* FEN strings with en passant targets, the FEN they load as, and the en passant captures the
+side to move then has */
+struct {
+    char *fen;
+    char *loaded;
+    int captures;
+} en_passant_cases[] = {
+    {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq e3 0 1", "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 0},
+    {"4k3/8/8/8/8/8/8/4K3 w - e6 0 1", "4k3/8/8/8/8/8/8/4K3 w - - 0 1", 0},
+    {"4k3/8/8/3pP3/8/8/8/4K3 w - d6 0 1", "4k3/8/8/3pP3/8/8/8/4K3 w - d6 0 1", 1},
+    {"4k3/8/8/3pP3/8/8/8/4K3 b - d6 0 1", "4k3/8/8/3pP3/8/8/8/4K3 b - - 0 1", 0},
+    {"4k3/3r4/8/3pP3/8/8/8/4K3 w - d6 0 1", "4k3/3r4/8/3pP3/8/8/8/4K3 w - - 0 1", 0},
+    {"4k3/8/3n4/3pP3/8/8/8/4K3 w - d6 0 1", "4k3/8/3n4/3pP3/8/8/8/4K3 w - - 0 1", 0},
+    {"rnbqkbnr/ppp1pppp/8/8/3pP3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 3", "rnbqkbnr/ppp1pppp/8/8/3pP3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 3", 1},
+    {"4k3/8/8/8/3pP3/8/8/4K3 b - d3 0 1", "4k3/8/8/8/3pP3/8/8/4K3 b - - 0 1", 0},
+};
+
+double seconds_now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Load every position of a file in turn into the same engine state. Return the number of
+positions loaded and count lines that are not positions in *errors. */
+long long load_positions(FILE *file, long long *errors)
+{
+    static char line[MAX_LINE];
+    long long positions = 0;
+    long long line_number = 0;
+
+    while (fgets(line, sizeof(line), file)) {
+        line_number++;
+        // Skip blank lines and comments
+        if (line[0] == '\n' || line[0] == '\r' || line[0] == '#' || line[0] == '\0') {
+            continue;
+        }
+        if (load_fen(&position, line)) {
+            positions++;
+        } else {
+            if (*errors < 10) {
+                fprintf(stderr, "line %lld is not a valid position: %s", line_number, line);
+            }
+            (*errors)++;
+        }
+    }
+    return positions;
+}
+
+// Print positions reached by playing random legal moves from the start position
+void generate_positions(long long count, unsigned seed)
+{
+    Move move_list[MAX_MOVES];
+    srand(seed);
+
+    while (count > 0) {
+        load_fen(&position, "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+        for (int ply = 0; ply < 200 && count > 0; ply++) {
+            int moves = generate_moves(&position, move_list);
+            if (moves == 0 || position.fen.halfmove_clock >= 100) {
+                break;
+            }
+            do_move(&position, move_list[rand() % moves]);
+            position.undo_count = 0;
+            printf("%s\n", stringify_fen(&position));
+            count--;
+        }
+    }
+}
+
+// Return the number of castling cases that load as anything other than expected
+int check_castling()
+{
+    Move move_list[MAX_MOVES];
+    int failures = 0;
+
+    for (size_t i = 0; i < sizeof(castling_cases) / sizeof(castling_cases[0]); i++) {
+        if (!load_fen(&position, castling_cases[i].fen)) {
+            printf("%s doesn't load\n", castling_cases[i].fen);
+            failures++;
+            continue;
+        }
+        int count = generate_moves(&position, move_list);
+        int castles = 0;
+        for (int j = 0; j < count; j++) {
+            castles += MOVE_FLAGS(move_list[j]) == KING_CASTLE || MOVE_FLAGS(move_list[j]) == QUEEN_CASTLE;
+        }
+        char *loaded = stringify_fen(&position);
+        if (strcmp(loaded, castling_cases[i].loaded) != 0 || castles != castling_cases[i].castles) {
+            printf("%s loads as %s with %d castling moves, expected %s with %d\n", castling_cases[i].fen,
+                   loaded, castles, castling_cases[i].loaded, castling_cases[i].castles);
+            failures++;
+        }
+    }
+    printf("%d of %d castling cases load as expected\n", (int)(sizeof(castling_cases) / sizeof(castling_cases[0])) - failures,
+           (int)(sizeof(castling_cases) / sizeof(castling_cases[0])));
+    return failures;
+}
+
+// Return the number of en passant cases that load as anything other than expected
+int check_en_passant()
+{
+    Move move_list[MAX_MOVES];
+    int total = sizeof(en_passant_cases) / sizeof(en_passant_cases[0]);
+    int failures = 0;
+
+    for (int i = 0; i < total; i++) {
+        if (!load_fen(&position, en_passant_cases[i].fen)) {
+            printf("%s doesn't load\n", en_passant_cases[i].fen);
+            failures++;
+            continue;
+        }
+        int count = generate_moves(&position, move_list);
+        int captures = 0;
+        for (int j = 0; j < count; j++) {
+            captures += MOVE_FLAGS(move_list[j]) == EN_PASSANT;
+        }
+        char *loaded = stringify_fen(&position);
+        if (strcmp(loaded, en_passant_cases[i].loaded) != 0 || captures != en_passant_cases[i].captures) {
+            printf("%s loads as %s with %d en passant captures, expected %s with %d\n", en_passant_cases[i].fen,
+                   loaded, captures, en_passant_cases[i].loaded, en_passant_cases[i].captures);
+            failures++;
+        }
+    }
+    printf("%d of %d en passant cases load as expected\n", total - failures, total);
+    return failures;
+}
+
+/* A pawn move made through make_move, then a promotion asked of promote_pawn, and whether it
+takes it */
+struct {
+    char *fen;
+    char from[3];
+    char to[3];
+    char *square;
+    int piece;
+    bool promoted;
+} promotion_cases[] = {
+    {"8/P6k/8/8/8/8/8/K7 w - - 0 1", "a7", "a8", "a8", WHITE_QUEEN, true},
+    {"8/P6k/8/8/8/8/8/K7 w - - 0 1", "a7", "a8", "a8", WHITE_KNIGHT, true},
+    {"8/P6k/8/8/8/8/8/K7 w - - 0 1", "a7", "a8", "a8", WHITE_KING, false},
+    {"8/P6k/8/8/8/8/8/K7 w - - 0 1", "a7", "a8", "a8", WHITE_PAWN, false},
+    {"8/P6k/8/8/8/8/8/K7 w - - 0 1", "a7", "a8", "a8", BLACK_QUEEN, false},
+    {"8/P6k/8/8/8/8/8/K7 w - - 0 1", "a7", "a8", "a8", -1, false},
+    {"8/P6k/8/8/8/8/8/K7 w - - 0 1", "a7", "a8", "a8", NO_PIECE, false},
+    {"8/P6k/8/8/8/8/8/K7 w - - 0 1", "a7", "a8", "b8", WHITE_QUEEN, false},
+    {"8/P6k/8/8/8/8/8/K7 w - - 0 1", "a7", "a8", "h7", WHITE_QUEEN, false},
+    {"k7/8/8/8/8/8/p6K/8 b - - 0 1", "a2", "a1", "a1", BLACK_ROOK, true},
+    {"k7/8/8/8/8/8/p6K/8 b - - 0 1", "a2", "a1", "a1", WHITE_ROOK, false},
+    {"k7/8/8/8/8/8/p6K/8 b - - 0 1", "a2", "a1", "z9", BLACK_ROOK, false},
+};
+
+/* Return the number of promotion cases promote_pawn answers wrongly, or that change the
+position when it refuses them */
+int check_promotions()
+{
+    int count = sizeof(promotion_cases) / sizeof(promotion_cases[0]);
+    int failures = 0;
+    char before[128];
+
+    for (int i = 0; i < count; i++) {
+        if (!load_fen(&position, promotion_cases[i].fen)
+            || !make_move(&position, promotion_cases[i].from, promotion_cases[i].to)) {
+            printf("%s %s%s can't be played\n", promotion_cases[i].fen, promotion_cases[i].from, promotion_cases[i].to);
+            failures++;
+            continue;
+        }
+        snprintf(before, sizeof(before), "%s", stringify_fen(&position));
+        bool promoted = promote_pawn(&position, promotion_cases[i].square, promotion_cases[i].piece);
+        if (promoted != promotion_cases[i].promoted || (!promoted && strcmp(before, stringify_fen(&position)) != 0)) {
+            printf("promoting on %s to piece %d after %s%s in %s %s\n", promotion_cases[i].square,
+                   promotion_cases[i].piece, promotion_cases[i].from, promotion_cases[i].to, promotion_cases[i].fen,
+                   promoted ? "was taken" : "was refused but changed the position");
+            failures++;
+        }
+    }
+    printf("%d of %d promotion cases answered as expected\n", count - failures, count);
+    return failures;
+}
+
+void usage()
+{
+    fprintf(stderr, "usage: epdbench <file> [passes]\n       epdbench generate <count> [seed] > file\n       epdbench check\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc >= 3 && strcmp(argv[1], "generate") == 0) {
+        generate_positions(atoll(argv[2]), argc > 3 ? (unsigned)atoi(argv[3]) : 1);
+        return 0;
+    }
+    if (argc == 2 && strcmp(argv[1], "check") == 0) {
+        int failures = check_castling();
+        failures += check_en_passant();
+        failures += check_promotions();
+        return failures ? 1 : 0;
+    }
+    if (argc < 2 || argc > 3) {
+        usage();
+    }
+
+    FILE *file = fopen(argv[1], "r");
+    if (!file) {
+        perror(argv[1]);
+        return 1;
+    }
+    int passes = argc > 2 ? atoi(argv[2]) : 1;
+    long long positions = 0;
+    long long errors = 0;
+    double start = seconds_now();
+    for (int pass = 0; pass < passes; pass++) {
+        rewind(file);
+        positions += load_positions(file, &errors);
+    }
+    double seconds = seconds_now() - start;
+    fclose(file);
+
+    printf("%lld positions in %.3fs, %.0f positions/sec", positions, seconds, positions / seconds);
+    if (errors) {
+        printf(", %lld invalid lines", errors);
+    }
+    printf("\n");
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,109 @@
+// gentables.c
+/* Write public/attack_tables.h, the attack tables compiled into the engine: the squares a
+knight, a king and a pawn of each color attack from every square, the ray from every square to
+the edge of the board in each direction, and the squares between and the line through every
+two squares that share a rank, file or diagonal.
+
+Every table is found by stepping over ranks and files one square at a time, not with the
+shifts and masks the engine used to fill them with, so `build/tablecheck` comparing the two is
+a real check. Run `make tables` after changing this file; the header is kept in the tree so
+the wasm and addon builds need nothing but a compiler. */
+#include <stdio.h>
+#include "chess.h"
+
+U64 knight_table[64];
+U64 king_table[64];
+U64 pawn_table[2][64];
+U64 ray_table[8][64];
+U64 between_table[64][64];
+U64 line_table[64][64];
+
+// Steps of a rank and a file, in the order of the Direction enum
+int ray_steps[8][2] = {{1, 0}, {0, 1}, {-1, 0}, {0, -1}, {1, 1}, {1, -1}, {-1, 1}, {-1, -1}};
+int knight_steps[8][2] = {{2, 1}, {1, 2}, {-1, 2}, {-2, 1}, {-2, -1}, {-1, -2}, {1, -2}, {2, -1}};
+
+// Return the bitboard of the square a step away, or 0 if the step leaves the board
+U64 step(int square, int rank_step, int file_step)
+{
+    int rank = SQUARE_RANK(square) + rank_step;
+    int file = SQUARE_FILE(square) + file_step;
+    return rank >= 0 && rank < 8 && file >= 0 && file < 8 ? SQUARE_BB(rank * 8 + file) : 0;
+}
+
+void fill_tables()
+{
+    for (int square = 0; square < 64; square++) {
+        for (int i = 0; i < 8; i++) {
+            knight_table[square] |= step(square, knight_steps[i][0], knight_steps[i][1]);
+            king_table[square] |= step(square, ray_steps[i][0], ray_steps[i][1]);
+        }
+        // Files count from h, so a step of +1 is towards the a file
+        pawn_table[0][square] = step(square, 1, 1) | step(square, 1, -1);
+        pawn_table[1][square] = step(square, -1, 1) | step(square, -1, -1);
+
+        for (int direction = 0; direction < 8; direction++) {
+            int rank = SQUARE_RANK(square), file = SQUARE_FILE(square);
+            for (;;) {
+                rank += ray_steps[direction][0];
+                file += ray_steps[direction][1];
+                if (rank < 0 || rank > 7 || file < 0 || file > 7) {
+                    break;
+                }
+                ray_table[direction][square] |= SQUARE_BB(rank * 8 + file);
+            }
+        }
+    }
+    // Directions come in opposite pairs, 0 with 2, 1 with 3, 4 with 7 and 5 with 6
+    for (int a = 0; a < 64; a++) {
+        for (int direction = 0; direction < 8; direction++) {
+            int opposite = direction < 4 ? direction ^ 2 : 11 - direction;
+            U64 ray = ray_table[direction][a];
+            while (ray) {
+                int b = pop_lsb(&ray);
+                between_table[a][b] = ray_table[direction][a] & ray_table[opposite][b];
+                line_table[a][b] = ray_table[direction][a] | ray_table[opposite][a] | SQUARE_BB(a);
+            }
+        }
+    }
+}
+
+// Write 64 bitboards four to a line, indented to the depth of the array they are in
+void print_row(U64 *bitboards, int indent)
+{
+    for (int i = 0; i < 64; i++) {
+        printf("%s%*s0x%016llxULL,", i % 4 ? " " : "", i % 4 ? 0 : indent, "", bitboards[i]);
+        if (i % 4 == 3) {
+            printf("\n");
+        }
+    }
+}
+
+void print_table(char *declaration, U64 *rows, int row_count)
+{
+    printf("\nconst U64 %s = {\n", declaration);
+    if (row_count == 1) {
+        print_row(rows, 4);
+    } else {
+        for (int row = 0; row < row_count; row++) {
+            printf("    {\n");
+            print_row(rows + 64 * row, 8);
+            printf("    },\n");
+        }
+    }
+    printf("};\n");
+}
+
+int main()
+{
+    fill_tables();
+    printf("// attack_tables.h\n");
+    printf("/* Written by native/gentables.c with `make tables`, do not edit. Included by chess.c alone;\n");
+    printf("chess.h declares the tables for the rest of the engine. */\n");
+    print_table("knight_attacks[64]", knight_table, 1);
+    print_table("king_attacks[64]", king_table, 1);
+    print_table("pawn_attacks[2][64]", pawn_table[0], 2);
+    print_table("ray_bb[8][64]", ray_table[0], 8);
+    print_table("between_bb[64][64]", between_table[0], 64);
+    print_table("line_bb[64][64]", line_table[0], 64);
+    return 0;
+}
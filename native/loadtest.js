@@ -0,0 +1,137 @@
+// loadtest.js
+// Play tens of thousands of simulated games at once through the native addon, the way
+// server.js would, and report move throughput, batch latency and event loop delay.
+// Usage: node native/loadtest.js [games] [rounds] [batch size]
+const { monitorEventLoopDelay, performance } = require('perf_hooks');
+const engine = require('../build/chess.node');
+
+const gameCount = parseInt(process.argv[2]) || 20000;
+const rounds = parseInt(process.argv[3]) || 40;
+const batchSize = parseInt(process.argv[4]) || 1000;
+// One game in this many also sends an illegal move every round, and another one in this many the
+// move the side to move is about to play but as the other side, both of which must be rejected
+const cheaterRate = 50;
+const scriptCount = 64;
+
+// A small xorshift generator, so every run plays the same games
+let seed = 2463534242;
+function random(n) {
+    seed ^= seed << 13;
+    seed ^= seed >>> 17;
+    seed ^= seed << 5;
+    return (seed >>> 0) % n;
+}
+
+// Play random games before timing starts. The simulated players replay them.
+async function makeScripts() {
+    const scripts = [];
+    for (let i = 0; i < scriptCount; i++) {
+        const moves = [];
+        const length = 20 + random(100);
+        engine.createGame('script');
+        for (let ply = 0; ply < length; ply++) {
+            const legal = engine.legalMoves('script');
+            if (legal.length == 0) {
+                break;
+            }
+            const move = legal[random(legal.length)];
+            await engine.applyMoves(['script'], [move]);
+            moves.push(move);
+        }
+        engine.deleteGame('script');
+        scripts.push(moves);
+    }
+    return scripts;
+}
+
+function percentile(sorted, p) {
+    return sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * p))];
+}
+
+async function main() {
+    const scripts = await makeScripts();
+    const games = [];
+    for (let i = 0; i < gameCount; i++) {
+        games.push({ id: 'game' + i, script: scripts[i % scriptCount], ply: 0 });
+        engine.createGame(games[i].id);
+    }
+
+    const loopDelay = monitorEventLoopDelay({ resolution: 1 });
+    const latencies = [];
+    let moves = 0;
+    let mismatches = 0;
+    let restarts = 0;
+    loopDelay.enable();
+    const start = performance.now();
+
+    for (let round = 0; round < rounds; round++) {
+        // Every game sends its next move. Batches are cut between games so that the moves
+        // of one game are checked in the order they were sent.
+        const batches = [];
+        let batch = { ids: [], moves: [], sides: [], expected: [] };
+        games.forEach((game, i) => {
+            if (game.ply == game.script.length) {
+                // The game is over, so a new one takes its place
+                engine.deleteGame(game.id);
+                engine.createGame(game.id);
+                game.ply = 0;
+                restarts++;
+            }
+            // Games start with white to move
+            const side = game.ply % 2 ? 'b' : 'w';
+            const otherSide = game.ply % 2 ? 'w' : 'b';
+            // The next move belongs to the other player, so it is never legal now
+            if (i % cheaterRate == 0 && game.ply + 1 < game.script.length) {
+                batch.ids.push(game.id);
+                batch.moves.push(game.script[game.ply + 1]);
+                batch.sides.push(side);
+                batch.expected.push(engine.results.ILLEGAL);
+            }
+            if (i % cheaterRate == 1) {
+                batch.ids.push(game.id);
+                batch.moves.push(game.script[game.ply]);
+                batch.sides.push(otherSide);
+                batch.expected.push(engine.results.WRONG_SIDE);
+            }
+            batch.ids.push(game.id);
+            batch.moves.push(game.script[game.ply++]);
+            batch.sides.push(side);
+            batch.expected.push(engine.results.OK);
+            if (batch.ids.length >= batchSize) {
+                batches.push(batch);
+                batch = { ids: [], moves: [], sides: [], expected: [] };
+            }
+        });
+        if (batch.ids.length) {
+            batches.push(batch);
+        }
+
+        await Promise.all(batches.map(async (batch) => {
+            const sent = performance.now();
+            const results = await engine.applyMoves(batch.ids, batch.moves, batch.sides);
+            latencies.push(performance.now() - sent);
+            moves += results.length;
+            results.forEach((result, i) => {
+                if (result != batch.expected[i]) {
+                    if (mismatches++ < 10) {
+                        console.error(`${batch.ids[i]} ${batch.moves[i]}: result ${result}, expected ${batch.expected[i]}`);
+                    }
+                }
+            });
+        }));
+    }
+
+    const seconds = (performance.now() - start) / 1000;
+    loopDelay.disable();
+    latencies.sort((a, b) => a - b);
+    console.log(`${gameCount} games, ${rounds} rounds, ${restarts} games restarted, ${engine.gameCount()} games held`);
+    console.log(`${moves} moves in ${seconds.toFixed(3)}s, ${Math.round(moves / seconds)} moves/sec`);
+    console.log(`batch latency p50 ${percentile(latencies, 0.5).toFixed(2)}ms  p99 ${percentile(latencies, 0.99).toFixed(2)}ms  (${latencies.length} batches of up to ${batchSize})`);
+    console.log(`event loop delay p99 ${(loopDelay.percentile(99) / 1e6).toFixed(2)}ms  max ${(loopDelay.max / 1e6).toFixed(2)}ms`);
+    if (mismatches) {
+        console.log(`${mismatches} moves got the wrong result`);
+        process.exit(1);
+    }
+}
+
+main();
@@ -0,0 +1,276 @@
+// module.c
+/* A native build of the functions the wasm engine exports, taking and returning what their
+cwrapped versions do, so that native/workerbench.js can run public/engine-worker.js under Node
+without Emscripten. Build it with `make workertest`, which loads build/module.node.
+
+Pointers are offsets into heap, an ArrayBuffer that stands in for wasm memory, and 0 is the
+default position. Node loads the library once for all its worker threads, so every thread that
+loads it gets a heap and a default position of its own, as every worker gets its own wasm
+instance in a browser. */
+#include <stdlib.h>
+#include <string.h>
+#include <node_api.h>
+#include "chess.h"
+
+#define HEAP_SIZE (1 << 20)
+
+// What each thread that loads the module has to itself
+typedef struct {
+    uint8_t *heap;
+    // The heap is allocated from the bottom up and never freed, and offset 0 is never handed out
+    size_t heap_used;
+    napi_ref heap_ref;
+    Position *position;
+    // Where get_board copies the board to
+    size_t board_offset;
+} Instance;
+
+static Instance *get_instance(napi_env env)
+{
+    Instance *instance;
+    napi_get_instance_data(env, (void **)&instance);
+    return instance;
+}
+
+static size_t heap_alloc(Instance *instance, size_t size)
+{
+    size_t offset = (instance->heap_used + 7) & ~(size_t)7;
+    if (offset + size > HEAP_SIZE) {
+        return 0;
+    }
+    instance->heap_used = offset + size;
+    return offset;
+}
+
+// Read the arguments of a call, which are numbers but for those in string_arguments
+static bool read_arguments(napi_env env, napi_callback_info info, size_t count, const char *string_arguments,
+                           int64_t *numbers, char strings[][8])
+{
+    napi_value argv[4];
+    size_t argc = 4;
+    napi_get_cb_info(env, info, &argc, argv, NULL, NULL);
+    if (argc < count) {
+        napi_throw_type_error(env, NULL, "too few arguments");
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        size_t length;
+        if (string_arguments[i] == 's') {
+            if (napi_get_value_string_utf8(env, argv[i], strings[i], 8, &length) != napi_ok) {
+                napi_throw_type_error(env, NULL, "expected a string");
+                return false;
+            }
+        } else if (napi_get_value_int64(env, argv[i], &numbers[i]) != napi_ok) {
+            napi_throw_type_error(env, NULL, "expected a number");
+            return false;
+        }
+    }
+    return true;
+}
+
+// Return what a pointer argument points to in the heap, or throw and return NULL if it runs off the end
+static void *heap_pointer(napi_env env, Instance *instance, int64_t offset, size_t size)
+{
+    if (offset <= 0 || offset + size > HEAP_SIZE) {
+        napi_throw_range_error(env, NULL, "pointer out of bounds");
+        return NULL;
+    }
+    return instance->heap + offset;
+}
+
+// A position argument is the default position for 0, as it is in the wasm engine
+static Position *position_argument(napi_env env, Instance *instance, int64_t offset)
+{
+    return offset ? heap_pointer(env, instance, offset, sizeof(Position)) : instance->position;
+}
+
+static napi_value number_result(napi_env env, int64_t number)
+{
+    napi_value result;
+    napi_create_int64(env, number, &result);
+    return result;
+}
+
+// cwrap turns a null string pointer into an empty string
+static napi_value string_result(napi_env env, const char *string)
+{
+    napi_value result;
+    napi_create_string_utf8(env, string ? string : "", NAPI_AUTO_LENGTH, &result);
+    return result;
+}
+
+static napi_value module_malloc(napi_env env, napi_callback_info info)
+{
+    int64_t numbers[1];
+    if (!read_arguments(env, info, 1, "n", numbers, NULL)) {
+        return NULL;
+    }
+    return number_result(env, numbers[0] >= 0 ? heap_alloc(get_instance(env), numbers[0]) : 0);
+}
+
+static napi_value module_set_start_bitboards(napi_env env, napi_callback_info info)
+{
+    int64_t numbers[1];
+    Position *pos;
+    if (!read_arguments(env, info, 1, "n", numbers, NULL) || !(pos = position_argument(env, get_instance(env), numbers[0]))) {
+        return NULL;
+    }
+    set_start_bitboards(pos);
+    return NULL;
+}
+
+static napi_value module_generate_moves(napi_env env, napi_callback_info info)
+{
+    Instance *instance = get_instance(env);
+    int64_t numbers[2];
+    Position *pos;
+    Move *move_list;
+    if (!read_arguments(env, info, 2, "nn", numbers, NULL) || !(pos = position_argument(env, instance, numbers[0]))
+        || !(move_list = heap_pointer(env, instance, numbers[1], MAX_MOVES * sizeof(Move)))) {
+        return NULL;
+    }
+    return number_result(env, generate_moves(pos, move_list));
+}
+
+static napi_value module_make_move(napi_env env, napi_callback_info info)
+{
+    int64_t numbers[3];
+    char strings[3][8];
+    Position *pos;
+    if (!read_arguments(env, info, 3, "nss", numbers, strings) || !(pos = position_argument(env, get_instance(env), numbers[0]))) {
+        return NULL;
+    }
+    return number_result(env, make_move(pos, strings[1], strings[2]));
+}
+
+static napi_value module_detect_pawn_promotion(napi_env env, napi_callback_info info)
+{
+    int64_t numbers[1];
+    Position *pos;
+    if (!read_arguments(env, info, 1, "n", numbers, NULL) || !(pos = position_argument(env, get_instance(env), numbers[0]))) {
+        return NULL;
+    }
+    return string_result(env, detect_pawn_promotion(pos));
+}
+
+static napi_value module_promote_pawn(napi_env env, napi_callback_info info)
+{
+    int64_t numbers[3];
+    char strings[3][8];
+    Position *pos;
+    if (!read_arguments(env, info, 3, "nsn", numbers, strings) || !(pos = position_argument(env, get_instance(env), numbers[0]))) {
+        return NULL;
+    }
+    return number_result(env, promote_pawn(pos, strings[1], numbers[2]));
+}
+
+static napi_value module_get_fen(napi_env env, napi_callback_info info)
+{
+    int64_t numbers[1];
+    Position *pos;
+    if (!read_arguments(env, info, 1, "n", numbers, NULL) || !(pos = position_argument(env, get_instance(env), numbers[0]))) {
+        return NULL;
+    }
+    return string_result(env, get_fen(pos));
+}
+
+// The board is copied into the heap, where JavaScript can read it
+static napi_value module_get_board(napi_env env, napi_callback_info info)
+{
+    Instance *instance = get_instance(env);
+    int64_t numbers[1];
+    Position *pos;
+    if (!read_arguments(env, info, 1, "n", numbers, NULL) || !(pos = position_argument(env, instance, numbers[0]))) {
+        return NULL;
+    }
+    memcpy(instance->heap + instance->board_offset, get_board(pos), 64);
+    return number_result(env, instance->board_offset);
+}
+
+static napi_value module_game_status(napi_env env, napi_callback_info info)
+{
+    int64_t numbers[1];
+    Position *pos;
+    if (!read_arguments(env, info, 1, "n", numbers, NULL) || !(pos = position_argument(env, get_instance(env), numbers[0]))) {
+        return NULL;
+    }
+    return number_result(env, game_status(pos));
+}
+
+static napi_value module_search_best_move(napi_env env, napi_callback_info info)
+{
+    Instance *instance = get_instance(env);
+    int64_t numbers[4];
+    Position *pos;
+    int *score = NULL;
+    if (!read_arguments(env, info, 4, "nnnn", numbers, NULL) || !(pos = position_argument(env, instance, numbers[0]))
+        || (numbers[3] && !(score = heap_pointer(env, instance, numbers[3], sizeof(int))))) {
+        return NULL;
+    }
+    // Clear a stop left by abortSearch, as a new worker in a browser starts with a new instance
+    __atomic_store_n(search_abort_flag(), 0, __ATOMIC_RELAXED);
+    return number_result(env, search_best_move(pos, numbers[1], numbers[2], score));
+}
+
+static napi_value module_set_search_threads(napi_env env, napi_callback_info info)
+{
+    int64_t numbers[1];
+    if (!read_arguments(env, info, 1, "n", numbers, NULL)) {
+        return NULL;
+    }
+    set_search_threads(numbers[0]);
+    return NULL;
+}
+
+/* abortSearch() stops whatever search any thread is running. Node can't stop a thread in the
+middle of native code, as a browser stops a worker running wasm, so workerbench calls this
+before it terminates a worker. */
+static napi_value module_abort_search(napi_env env, napi_callback_info info)
+{
+    __atomic_store_n(search_abort_flag(), 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+static void free_instance(napi_env env, void *data, void *hint)
+{
+    Instance *instance = data;
+    napi_delete_reference(env, instance->heap_ref);
+    free(instance->position);
+    free(instance);
+}
+
+static void export_function(napi_env env, napi_value exports, const char *name, napi_callback function)
+{
+    napi_value value;
+    napi_create_function(env, name, NAPI_AUTO_LENGTH, function, NULL, &value);
+    napi_set_named_property(env, exports, name, value);
+}
+
+NAPI_MODULE_INIT()
+{
+    Instance *instance = calloc(1, sizeof(Instance));
+    napi_value heap;
+
+    napi_create_arraybuffer(env, HEAP_SIZE, (void **)&instance->heap, &heap);
+    napi_create_reference(env, heap, 1, &instance->heap_ref);
+    memset(instance->heap, 0, HEAP_SIZE);
+    instance->heap_used = 8;
+    instance->board_offset = heap_alloc(instance, 64);
+    instance->position = calloc(1, sizeof(Position));
+    napi_set_instance_data(env, instance, free_instance, NULL);
+
+    napi_set_named_property(env, exports, "heap", heap);
+    export_function(env, exports, "_malloc", module_malloc);
+    export_function(env, exports, "set_start_bitboards", module_set_start_bitboards);
+    export_function(env, exports, "generate_moves", module_generate_moves);
+    export_function(env, exports, "make_move", module_make_move);
+    export_function(env, exports, "detect_pawn_promotion", module_detect_pawn_promotion);
+    export_function(env, exports, "promote_pawn", module_promote_pawn);
+    export_function(env, exports, "get_fen", module_get_fen);
+    export_function(env, exports, "get_board", module_get_board);
+    export_function(env, exports, "game_status", module_game_status);
+    export_function(env, exports, "search_best_move", module_search_best_move);
+    export_function(env, exports, "set_search_threads", module_set_search_threads);
+    export_function(env, exports, "abortSearch", module_abort_search);
+    return exports;
+}
@@ -0,0 +1,132 @@
+// movebench.c
+/* Time what every move costs the engine besides finding it: making and taking back moves, and
+writing the FEN string of the position reached, which the JavaScript interface does after
+every move, leaving out the time taken to reach it. Random games are recorded first with a fixed seed, with the legal moves of every
+position on the way, so that every run and every build times the same work. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "chess.h"
+
+#define GAMES 100
+#define GAME_PLIES 120
+#define MAX_RECORDED (GAMES * GAME_PLIES)
+
+char *start_fen = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+
+Position position;
+
+// The move played and the legal moves of every position of every game, one after the other
+Move played[MAX_RECORDED];
+int game_length[GAMES];
+Move *legal_moves;
+int legal_count[MAX_RECORDED];
+long long total_legal;
+
+double seconds_now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+void record_games()
+{
+    Move move_list[MAX_MOVES];
+    int ply_index = 0;
+
+    legal_moves = malloc((size_t)MAX_RECORDED * MAX_MOVES * sizeof(Move));
+    srand(1);
+    for (int game = 0; game < GAMES; game++) {
+        load_fen(&position, start_fen);
+        for (game_length[game] = 0; game_length[game] < GAME_PLIES; game_length[game]++) {
+            int count = generate_moves(&position, move_list);
+            if (count == 0) {
+                break;
+            }
+            memcpy(&legal_moves[total_legal], move_list, count * sizeof(Move));
+            legal_count[ply_index] = count;
+            total_legal += count;
+            played[ply_index++] = move_list[rand() % count];
+            do_move(&position, played[ply_index - 1]);
+        }
+    }
+}
+
+// Replay the games, making and taking back every legal move, and return the number made
+long long make_moves()
+{
+    long long made = 0;
+    Move *moves = legal_moves;
+    int ply_index = 0;
+
+    for (int game = 0; game < GAMES; game++) {
+        load_fen(&position, start_fen);
+        for (int ply = 0; ply < game_length[game]; ply++, ply_index++) {
+            for (int i = 0; i < legal_count[ply_index]; i++) {
+                do_move(&position, moves[i]);
+                undo_move(&position);
+            }
+            made += legal_count[ply_index];
+            moves += legal_count[ply_index];
+            do_move(&position, played[ply_index]);
+        }
+    }
+    return made;
+}
+
+/* Replay the games, writing the FEN string of every position unless write is false, and return
+the number of positions */
+long long write_fens(bool write, long long *checksum)
+{
+    long long written = 0;
+    int ply_index = 0;
+
+    for (int game = 0; game < GAMES; game++) {
+        load_fen(&position, start_fen);
+        for (int ply = 0; ply < game_length[game]; ply++, ply_index++) {
+            do_move(&position, played[ply_index]);
+            if (write) {
+                *checksum += strlen(stringify_fen(&position));
+            }
+            written++;
+        }
+    }
+    return written;
+}
+
+int main(int argc, char *argv[])
+{
+    int passes = argc > 1 ? atoi(argv[1]) : 20;
+    long long made = 0, written = 0, checksum = 0;
+    double start;
+
+    if (argc > 2 || passes < 1) {
+        fprintf(stderr, "usage: movebench [passes]\n");
+        return 2;
+    }
+    record_games();
+
+    start = seconds_now();
+    for (int pass = 0; pass < passes; pass++) {
+        made += make_moves();
+    }
+    double make_seconds = seconds_now() - start;
+
+    // Replaying the games without writing anything gives the time to leave out of the rate
+    start = seconds_now();
+    for (int pass = 0; pass < passes; pass++) {
+        write_fens(false, &checksum);
+    }
+    double replay_seconds = seconds_now() - start;
+    start = seconds_now();
+    for (int pass = 0; pass < passes; pass++) {
+        written += write_fens(true, &checksum);
+    }
+    double fen_seconds = seconds_now() - start - replay_seconds;
+
+    printf("make/unmake  %11lld moves  %7.3fs  %7.2f M moves/s\n", made, make_seconds, made / make_seconds / 1e6);
+    printf("fen          %11lld fens   %7.3fs  %7.2f M fens/s\n", written, fen_seconds, written / fen_seconds / 1e6);
+    return 0;
+}
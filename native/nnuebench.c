@@ -0,0 +1,262 @@
+// nnuebench.c
+/* Check and time the network evaluation on every instruction set this build and CPU support.
+Random games are played from a few positions. At every position on the way each move is made on
+a copy of it, and the copies are then evaluated together, as a search evaluates the moves from
+one position, which updates each copy's accumulators from the position's. Only the evaluations
+are timed. The scores must be the same on every instruction set and the same as evaluating each
+position from scratch.
+
+Until a trained network exists, `nnuebench write` makes networks in the file format nnue.c
+reads: one of random weights, which is as good as any for checking and timing, or with seed 0
+one that only counts material. Run with `material`, every score must then be the material
+balance by piece_values, which checks that the network sees the board the right way round. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "chess.h"
+
+// Random games played from each start position, and their longest length
+#define GAMES 16
+#define GAME_PLIES 80
+
+char *start_positions[] = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+};
+
+#define START_COUNT (int)(sizeof(start_positions) / sizeof(start_positions[0]))
+
+Position position;
+
+double seconds_now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+U64 random_state;
+// Set to check every score against the material balance
+bool check_material;
+long long material_mismatches;
+
+U64 next_random()
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+void write_u32(FILE *file, uint32_t value)
+{
+    for (int i = 0; i < 4; i++) {
+        fputc((value >> (8 * i)) & 255, file);
+    }
+}
+
+void write_i16(FILE *file, int value)
+{
+    fputc(value & 255, file);
+    fputc((value >> 8) & 255, file);
+}
+
+/* Write a network of random weights, small enough that most accumulators stay within the clip
+range, or for seed 0 a network whose first five values for each side count its queens, rooks,
+bishops, knights and pawns, ten for each, and whose output weighs them by piece_values */
+int write_network(char *path, U64 seed)
+{
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        perror(path);
+        return 1;
+    }
+    random_state = seed;
+    write_u32(file, 0x4e4e4357);
+    write_u32(file, 1);
+    write_u32(file, NNUE_FEATURES);
+    write_u32(file, NNUE_HIDDEN);
+    // Output divisor and bias
+    write_u32(file, seed ? 16 : 1);
+    write_u32(file, 0);
+    for (int i = 0; i < NNUE_HIDDEN; i++) {
+        write_i16(file, seed ? next_random() % 64 : 0);
+    }
+    for (int feature = 0; feature < NNUE_FEATURES; feature++) {
+        // Features are ordered by king bucket, then piece as its own side sees it, then square
+        int piece = feature / 64 % 12;
+        for (int i = 0; i < NNUE_HIDDEN; i++) {
+            write_i16(file, seed ? (int)(next_random() % 17) - 8 : i < 5 && piece == i + 1 ? 10 : 0);
+        }
+    }
+    for (int i = 0; i < 2 * NNUE_HIDDEN; i++) {
+        int value = i % NNUE_HIDDEN < 5 ? piece_values[i % NNUE_HIDDEN + 1] / 10 : 0;
+        fputc(seed ? (int)(next_random() % 65) - 32 : i < NNUE_HIDDEN ? value : -value, file);
+    }
+    if (fclose(file) != 0) {
+        perror(path);
+        return 1;
+    }
+    return 0;
+}
+
+enum Eval_Mode {
+    INCREMENTAL,
+    FROM_SCRATCH,
+};
+
+// Evaluate through the network, rather than the tables, once main attaches it
+bool use_network;
+// A copy of the game position per move from it, each with its own accumulator stack
+Position *children;
+
+// Add a score to the checksum, checking it against the material balance if asked
+void check_score(Position *pos, int score, long long *checksum)
+{
+    if (check_material) {
+        int balance = 0;
+        for (int piece = WHITE_QUEEN; piece <= WHITE_PAWN; piece++) {
+            balance += piece_values[piece] * (__builtin_popcountll(pos->bitboards[piece]) - __builtin_popcountll(pos->bitboards[piece + 6]));
+        }
+        if (score != (pos->fen.active_color == 'w' ? balance : -balance)) {
+            material_mismatches++;
+        }
+    }
+    *checksum = *checksum * 31 + score;
+}
+
+/* Copy a position into another, and the accumulators of its top ply into the other's stack,
+which is all evaluating a move made from it reads */
+void copy_position(Position *to, Position *from)
+{
+    Nnue_Accumulator *stack = to->nnue;
+    *to = *from;
+    to->nnue = stack;
+    if (stack) {
+        stack[from->undo_count] = from->nnue[from->undo_count];
+    }
+}
+
+/* Play the random games, evaluating every move from every position reached. FROM_SCRATCH
+recomputes the accumulators for each evaluation. Return the number of evaluations, add up the
+scores in *checksum and the time spent evaluating in *seconds. */
+long long play_games(int mode, long long *checksum, double *seconds)
+{
+    Move move_list[MAX_MOVES];
+    int scores[MAX_MOVES];
+    long long evaluations = 0;
+
+    *seconds = 0;
+    random_state = 88172645463325252ULL;
+    for (int start = 0; start < START_COUNT; start++) {
+        for (int game = 0; game < GAMES; game++) {
+            load_fen(&position, start_positions[start]);
+            double started = seconds_now();
+            int score = evaluate(&position);
+            *seconds += seconds_now() - started;
+            check_score(&position, score, checksum);
+            evaluations++;
+            for (int ply = 0; ply < GAME_PLIES; ply++) {
+                int count = generate_moves(&position, move_list);
+                if (count == 0) {
+                    break;
+                }
+                for (int i = 0; i < count; i++) {
+                    if (use_network && !children[i].nnue && !nnue_attach(&children[i])) {
+                        fprintf(stderr, "out of memory\n");
+                        exit(1);
+                    }
+                    copy_position(&children[i], &position);
+                    do_move(&children[i], move_list[i]);
+                    if (mode == FROM_SCRATCH) {
+                        nnue_invalidate(&children[i]);
+                    }
+                }
+                started = seconds_now();
+                for (int i = 0; i < count; i++) {
+                    scores[i] = evaluate(&children[i]);
+                }
+                *seconds += seconds_now() - started;
+                for (int i = 0; i < count; i++) {
+                    check_score(&children[i], scores[i], checksum);
+                }
+                evaluations += count;
+                // The game goes on from one of the moves, whose accumulators are computed
+                copy_position(&position, &children[next_random() % count]);
+            }
+        }
+    }
+    return evaluations;
+}
+
+void usage()
+{
+    fprintf(stderr, "usage: nnuebench <network file> [material]\n       nnuebench write <network file> [seed]\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    long long reference = 0;
+    int failures = 0;
+
+    if (argc >= 3 && argc <= 4 && strcmp(argv[1], "write") == 0) {
+        return write_network(argv[2], argc == 4 ? strtoull(argv[3], NULL, 10) : 1);
+    }
+    if (argc < 2 || argc > 3 || (argc == 3 && strcmp(argv[2], "material") != 0)) {
+        usage();
+    }
+    if (!nnue_load(argv[1])) {
+        fprintf(stderr, "%s is not a network file\n", argv[1]);
+        return 1;
+    }
+
+    children = calloc(MAX_MOVES, sizeof(Position));
+    if (!children) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    long long checksum = 0;
+    double seconds;
+    long long evaluations = play_games(INCREMENTAL, &checksum, &seconds);
+    printf("%lld evaluations\n%-8s %12.0f evals/s\n", evaluations, "tables", evaluations / seconds);
+
+    if (!nnue_attach(&position)) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    use_network = true;
+    check_material = argc == 3;
+    for (int i = 0; nnue_supported_isa(i); i++) {
+        long long incremental = 0, from_scratch = 0;
+        double incremental_seconds, scratch_seconds;
+        nnue_select_isa(nnue_supported_isa(i));
+
+        play_games(INCREMENTAL, &incremental, &incremental_seconds);
+        play_games(FROM_SCRATCH, &from_scratch, &scratch_seconds);
+
+        if (i == 0) {
+            reference = incremental;
+        }
+        bool wrong = incremental != from_scratch || incremental != reference;
+        if (wrong) {
+            failures++;
+        }
+        printf("%-8s %12.0f evals/s  %12.0f evals/s from scratch  %s\n", nnue_isa(), evaluations / incremental_seconds,
+               evaluations / scratch_seconds, wrong ? "WRONG" : "ok");
+    }
+    for (int i = 0; i < MAX_MOVES; i++) {
+        nnue_detach(&children[i]);
+    }
+    free(children);
+    nnue_detach(&position);
+    if (material_mismatches) {
+        printf("%lld scores are not the material balance\n", material_mismatches);
+        failures++;
+    }
+    return failures ? 1 : 0;
+}
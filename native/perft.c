@@ -0,0 +1,171 @@
+// perft.c
+/* Count the leaf nodes of the legal move tree to a fixed depth for a suite of standard positions,
+check the counts against their published values, and report nodes per second. Every change to
+move generation should keep this passing. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "chess.h"
+
+typedef struct {
+    char *name;
+    char *fen;
+    // Depth searched by default, chosen so the whole suite runs in seconds
+    int depth;
+    // Published node counts indexed by depth
+    long long nodes[7];
+} Perft_Position;
+
+Perft_Position suite[] = {
+    {
+        "start position",
+        "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+        5,
+        {1, 20, 400, 8902, 197281, 4865609, 119060324},
+    },
+    {
+        "kiwipete",
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+        4,
+        {1, 48, 2039, 97862, 4085603, 193690690, 0},
+    },
+    {
+        "en passant and pins",
+        "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+        5,
+        {1, 14, 191, 2812, 43238, 674624, 11030083},
+    },
+    {
+        "castling and promotion",
+        "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+        4,
+        {1, 6, 264, 9467, 422333, 15833292, 706045033},
+    },
+    {
+        "promotion with check",
+        "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+        4,
+        {1, 44, 1486, 62379, 2103487, 89941194, 0},
+    },
+    {
+        "middlegame",
+        "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+        4,
+        {1, 46, 2079, 89890, 3894594, 164075551, 6923051137},
+    },
+};
+
+#define SUITE_SIZE (int)(sizeof(suite) / sizeof(suite[0]))
+
+Position position;
+
+// Return the number of leaf nodes of the legal move tree at a depth of at least 1
+long long perft(Position *pos, int depth)
+{
+    Move move_list[MAX_MOVES];
+    int count = generate_moves(pos, move_list);
+    long long nodes = 0;
+
+    if (depth == 1) {
+        return count;
+    }
+    for (int i = 0; i < count; i++) {
+        do_move(pos, move_list[i]);
+        nodes += perft(pos, depth - 1);
+        undo_move(pos);
+    }
+    return nodes;
+}
+
+// Print the number of leaf nodes below each legal move, for finding the move a bug hides under
+long long divide(Position *pos, int depth)
+{
+    Move move_list[MAX_MOVES];
+    int count = generate_moves(pos, move_list);
+    long long total = 0;
+
+    for (int i = 0; i < count; i++) {
+        Move move = move_list[i];
+        char name[6];
+        long long nodes = 1;
+
+        move_to_uci(move, name);
+        do_move(pos, move);
+        if (depth > 1) {
+            nodes = perft(pos, depth - 1);
+        }
+        undo_move(pos);
+        printf("%s %lld\n", name, nodes);
+        total += nodes;
+    }
+    return total;
+}
+
+double seconds_now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+void usage()
+{
+    fprintf(stderr, "usage: perft [depth]\n       perft divide <depth> <position 1-%d>\n", SUITE_SIZE);
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    int depth = 0;
+    int failures = 0;
+    long long total_nodes = 0;
+    double total_seconds = 0;
+
+    if (argc == 4 && strcmp(argv[1], "divide") == 0) {
+        int index = atoi(argv[3]) - 1;
+        depth = atoi(argv[2]);
+        if (index < 0 || index >= SUITE_SIZE || depth < 1) {
+            usage();
+        }
+        load_fen(&position, suite[index].fen);
+        printf("total %lld\n", divide(&position, depth));
+        return 0;
+    }
+    if (argc == 2) {
+        depth = atoi(argv[1]);
+        if (depth < 1 || depth > 6) {
+            usage();
+        }
+    } else if (argc != 1) {
+        usage();
+    }
+
+    for (int i = 0; i < SUITE_SIZE; i++) {
+        Perft_Position *entry = &suite[i];
+        int position_depth = depth ? depth : entry->depth;
+        long long expected = entry->nodes[position_depth];
+        if (!expected) {
+            printf("%-24s depth %d  no published count, skipped\n", entry->name, position_depth);
+            continue;
+        }
+
+        load_fen(&position, entry->fen);
+        double start = seconds_now();
+        long long nodes = perft(&position, position_depth);
+        double seconds = seconds_now() - start;
+
+        total_nodes += nodes;
+        total_seconds += seconds;
+        if (nodes != expected) {
+            failures++;
+        }
+        printf("%-24s depth %d  %12lld nodes  %8.3fs  %6.2f Mnps  %s\n", entry->name, position_depth,
+               nodes, seconds, nodes / seconds / 1e6, nodes == expected ? "ok" : "FAILED");
+        if (nodes != expected) {
+            printf("    expected %lld for %s\n", expected, entry->fen);
+        }
+    }
+    printf("total %lld nodes in %.3fs, %.2f Mnps\n", total_nodes, total_seconds, total_nodes / total_seconds / 1e6);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,495 @@
+// pgnbench.c
+/* Replay PGN files through the engine on several threads, and write PGN files to replay.
+
+`pgnbench <file> [threads]` streams a file, or standard input for -, through a reader that
+splits it into chunks of whole games. Worker threads replay the chunks on positions of their
+own, resolving every SAN move against the legal move generator, and the reader keeps reading
+while they do. It reports games and moves per second and lists every game with an illegal
+move or that disagrees with itself (see pgn_replay), and fails if there are any.
+
+`pgnbench generate <games> [seed] > file` writes random games, with comments, variations and
+annotations among the moves and every tenth game starting from a FEN tag.
+
+Both first check SAN moves and short games whose readings are known. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "chess.h"
+
+// Bytes read from the file at a time, and the most a chunk of games handed to a thread holds
+#define READ_SIZE (1 << 20)
+#define CHUNK_SIZE (64 << 10)
+// Chunks read ahead of the threads replaying them
+#define QUEUE_SIZE 64
+// Games listed as illegal or inconsistent, of all that are counted
+#define MAX_LISTED 100
+#define MAX_THREADS 64
+#define GAME_PLIES 300
+
+char *start_fen = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+
+typedef struct {
+    char *fen;
+    char *san;
+    // The move in UCI notation, or "" if there is no one legal move it can be
+    char *uci;
+    // How move_to_san writes the move
+    char *written;
+} San_Case;
+
+San_Case san_cases[] = {
+    {"rnbqkb1r/ppp1pppp/5n2/3p4/3P4/5N2/PPP1PPPP/RNBQKB1R b KQkq - 1 3", "Nbd7", "b8d7", "Nbd7"},
+    {"rnbqkb1r/ppp1pppp/5n2/3p4/3P4/5N2/PPP1PPPP/RNBQKB1R b KQkq - 1 3", "Nfd7", "f6d7", "Nfd7"},
+    {"rnbqkb1r/ppp1pppp/5n2/3p4/3P4/5N2/PPP1PPPP/RNBQKB1R b KQkq - 1 3", "Nd7", "", ""},
+    {"3r3k/4P3/8/8/8/8/8/4K3 w - - 0 1", "exd8=Q+", "e7d8q", "exd8=Q+"},
+    {"3r3k/4P3/8/8/8/8/8/4K3 w - - 0 1", "exd8Q", "e7d8q", "exd8=Q+"},
+    {"3r3k/4P3/8/8/8/8/8/4K3 w - - 0 1", "e8=N", "e7e8n", "e8=N"},
+    {"3r3k/4P3/8/8/8/8/8/4K3 w - - 0 1", "exd8", "", ""},
+    {"4k3/8/8/R7/8/8/8/R3K3 w - - 0 1", "R1a3", "a1a3", "R1a3"},
+    {"4k3/8/8/R7/8/8/8/R3K3 w - - 0 1", "R5a3", "a5a3", "R5a3"},
+    {"4k3/8/8/R7/8/8/8/R3K3 w - - 0 1", "Ra3", "", ""},
+    {"4k3/8/8/8/8/N7/8/N3N2K w - - 0 1", "Na1c2", "a1c2", "Na1c2"},
+    {"4k3/8/8/8/8/N7/8/N3N2K w - - 0 1", "N1c2", "", ""},
+    // The knight on e2 is pinned, so the one on b1 needs no start file
+    {"4k3/4r3/8/8/8/8/4N3/1N2K3 w - - 0 1", "Nc3", "b1c3", "Nc3"},
+    {"r3k2r/8/8/8/8/8/8/R3K2R w KQkq - 0 1", "O-O-O", "e1c1", "O-O-O"},
+    {"r3k2r/8/8/8/8/8/8/R3K2R w KQkq - 0 1", "0-0", "e1g1", "O-O"},
+    {"4k3/8/8/3pP3/8/8/8/4K3 w - d6 0 1", "exd6", "e5d6", "exd6"},
+    {"4k3/8/8/8/8/8/3r4/4K3 w - - 0 1", "Kd1", "", ""},
+    {"4k3/8/8/8/8/8/3r4/4K3 w - - 0 1", "Kxd2", "e1d2", "Kxd2"},
+    {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", "e2-e4", "e2e4", "e4"},
+    {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", "e5", "", ""},
+    {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", "Zz9", "", ""},
+};
+
+typedef struct {
+    char *name;
+    char *pgn;
+    int verdict;
+} Game_Case;
+
+Game_Case game_cases[] = {
+    {"scholar's mate",
+     "[Event \"test\"]\n[Result \"1-0\"]\n\n1. e4 e5 2. Bc4 Nc6 3. Qh5 Nf6?? 4. Qxf7# 1-0\n", PGN_OK},
+    {"comments, variations and annotations",
+     "1. e4 {best by test} e5 (1... c5 2. Nf3 (2. c3) d6) 2. Nf3 $1 Nc6 ; to the end\n"
+     "% an escaped line\n3. Bb5 a6 {[%clk 0:01:00]} 4. Ba4 *\n", PGN_OK},
+    {"start from a FEN tag",
+     "[SetUp \"1\"]\n[FEN \"4k3/8/8/8/8/8/8/R3K3 w Q - 0 1\"]\n\n1. O-O-O Kf7 2. Kb1 *\n", PGN_OK},
+    {"black to move first",
+     "[FEN \"4k3/8/8/8/8/8/8/R3K3 b Q - 0 30\"]\n\n30... Kd7 31. O-O-O+ Ke6 1/2-1/2\n", PGN_OK},
+    {"wrong result for checkmate",
+     "1. e4 e5 2. Bc4 Nc6 3. Qh5 Nf6 4. Qxf7# 0-1\n", PGN_INCONSISTENT},
+    {"checkmate not marked",
+     "1. e4 e5 2. Bc4 Nc6 3. Qh5 Nf6 4. Qxf7 1-0\n", PGN_INCONSISTENT},
+    {"check that isn't",
+     "1. e4+ e5 *\n", PGN_INCONSISTENT},
+    {"capture without x",
+     "1. e4 d5 2. ed5 *\n", PGN_INCONSISTENT},
+    {"result tag disagrees",
+     "[Result \"1-0\"]\n1. e4 *\n", PGN_INCONSISTENT},
+    {"move number out of step",
+     "1. e4 e5 3. Nf3 *\n", PGN_INCONSISTENT},
+    {"stalemate scored as a win",
+     "[FEN \"7k/8/6K1/5Q2/8/8/8/8 w - - 0 1\"]\n1. Qf7 1-0\n", PGN_INCONSISTENT},
+    {"no result",
+     "1. e4 e5\n", PGN_INCONSISTENT},
+    {"illegal king move",
+     "1. e4 e5 2. Ke3 *\n", PGN_ILLEGAL},
+    {"moves after checkmate",
+     "1. f3 e5 2. g4 Qh4# 3. a3 0-1\n", PGN_ILLEGAL},
+    {"bad FEN tag",
+     "[FEN \"8/8/8 w - - 0 1\"]\n1. e4 *\n", PGN_ILLEGAL},
+    {"comment never closed",
+     "1. e4 { forever\n", PGN_ILLEGAL},
+};
+
+#define SAN_CASES (int)(sizeof(san_cases) / sizeof(san_cases[0]))
+#define GAME_CASES (int)(sizeof(game_cases) / sizeof(game_cases[0]))
+
+double seconds_now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Check the SAN moves and games whose readings are known, and return the number that are wrong
+int check_known(Position *pos)
+{
+    char uci[6] = "", san[MAX_SAN];
+    Pgn_Game game;
+    int failures = 0;
+
+    for (int i = 0; i < SAN_CASES; i++) {
+        San_Case *c = &san_cases[i];
+        load_fen(pos, c->fen);
+        Move move = san_to_move(pos, c->san);
+        strcpy(uci, "");
+        if (move) {
+            move_to_uci(move, uci);
+            move_to_san(pos, move, san);
+        }
+        if (strcmp(uci, c->uci) != 0 || (move && strcmp(san, c->written) != 0)) {
+            printf("%-8s in %s reads as %s, written %s, expected %s written %s\n", c->san, c->fen,
+                   move ? uci : "nothing", move ? san : "-", c->uci[0] ? c->uci : "nothing", c->written);
+            failures++;
+        }
+    }
+    for (int i = 0; i < GAME_CASES; i++) {
+        Game_Case *c = &game_cases[i];
+        int verdict = pgn_replay(pos, c->pgn, strlen(c->pgn), &game);
+        if (verdict != c->verdict || pgn_game_length(c->pgn, strlen(c->pgn)) != strlen(c->pgn)) {
+            printf("%s: verdict %d, expected %d: %s\n", c->name, verdict, c->verdict, game.message);
+            failures++;
+        }
+    }
+    return failures;
+}
+
+// Write a word of a game's moves, wrapping lines before they pass 80 columns
+void write_word(const char *word, int *column)
+{
+    int length = strlen(word);
+    if (*column > 0 && *column + 1 + length > 80) {
+        printf("\n");
+        *column = 0;
+    } else if (*column > 0) {
+        printf(" ");
+        (*column)++;
+    }
+    printf("%s", word);
+    *column += length;
+}
+
+/* Write random games as PGN, each played until game_status ends it or for GAME_PLIES moves.
+Every tenth game starts from a FEN tag after a few random moves. */
+void generate_games(long long games, unsigned seed)
+{
+    static const char *result_text[4] = {"*", "1-0", "0-1", "1/2-1/2"};
+    Move move_list[MAX_MOVES], moves[GAME_PLIES];
+    Position *pos = calloc(1, sizeof(Position));
+    Position *start = calloc(1, sizeof(Position));
+    char san[MAX_SAN], word[64];
+
+    srand(seed);
+    for (long long game = 1; game <= games; game++) {
+        bool from_fen = game % 10 == 0;
+        load_fen(pos, start_fen);
+        for (int ply = from_fen ? rand() % 20 : 0; ply > 0 && game_status(pos) == GAME_ONGOING; ply--) {
+            int count = generate_moves(pos, move_list);
+            play_move(pos, move_list[rand() % count]);
+        }
+        load_fen(start, stringify_fen(pos));
+
+        // Play the game before writing it, as the result comes first in its tags
+        int plies = 0, status;
+        while ((status = game_status(pos)) == GAME_ONGOING && plies < GAME_PLIES) {
+            int count = generate_moves(pos, move_list);
+            moves[plies] = move_list[rand() % count];
+            play_move(pos, moves[plies++]);
+        }
+        int result = status == CHECKMATE ? (pos->fen.active_color == 'w' ? PGN_BLACK_WINS : PGN_WHITE_WINS)
+                   : status == GAME_ONGOING ? PGN_UNKNOWN : PGN_DRAW;
+
+        printf("[Event \"pgnbench\"]\n[Site \"?\"]\n[Date \"????.??.??\"]\n[Round \"%lld\"]\n", game);
+        printf("[White \"random\"]\n[Black \"random\"]\n[Result \"%s\"]\n", result_text[result]);
+        if (from_fen) {
+            printf("[SetUp \"1\"]\n[FEN \"%s\"]\n", stringify_fen(start));
+        }
+        printf("\n");
+
+        // Black's moves are numbered too at the start and after a comment or variation
+        int column = 0;
+        bool numbered = true;
+        for (int ply = 0; ply < plies; ply++) {
+            bool is_white = start->fen.active_color == 'w';
+            if (is_white || numbered) {
+                sprintf(word, "%d%s", start->fen.fullmove_number, is_white ? "." : "...");
+                write_word(word, &column);
+            }
+            write_word(move_to_san(start, moves[ply], san), &column);
+            numbered = false;
+            // Now and then a comment, an annotation, or another move in place of this one
+            int extra = rand() % 40;
+            if (extra == 0) {
+                write_word("{a comment (with [brackets])}", &column);
+                numbered = true;
+            } else if (extra == 1) {
+                write_word("$1", &column);
+            } else if (extra == 2) {
+                int count = generate_moves(start, move_list);
+                sprintf(word, "(%d%s %s)", start->fen.fullmove_number, is_white ? "." : "...",
+                        move_to_san(start, move_list[rand() % count], san));
+                write_word(word, &column);
+                numbered = true;
+            }
+            play_move(start, moves[ply]);
+        }
+        write_word(result_text[result], &column);
+        printf("\n\n");
+    }
+    free(pos);
+    free(start);
+}
+
+// A run of whole games, and the number in the file of the first of them, counted from 1
+typedef struct {
+    char *text;
+    size_t length;
+    long long first_game;
+} Chunk;
+
+typedef struct {
+    long long game;
+    int verdict;
+    char message[96];
+} Listed_Game;
+
+typedef struct {
+    pthread_t handle;
+    long long games;
+    long long plies;
+    long long results[4];
+    long long verdicts[3];
+    Listed_Game listed[MAX_LISTED];
+    int listed_count;
+} Worker;
+
+// The chunks read and not yet replayed, which the reader fills and the workers empty
+struct {
+    Chunk chunks[QUEUE_SIZE];
+    int head;
+    int count;
+    bool finished;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} queue = {.lock = PTHREAD_MUTEX_INITIALIZER, .not_empty = PTHREAD_COND_INITIALIZER, .not_full = PTHREAD_COND_INITIALIZER};
+
+void push_chunk(Chunk chunk)
+{
+    pthread_mutex_lock(&queue.lock);
+    while (queue.count == QUEUE_SIZE) {
+        pthread_cond_wait(&queue.not_full, &queue.lock);
+    }
+    queue.chunks[(queue.head + queue.count++) % QUEUE_SIZE] = chunk;
+    pthread_cond_signal(&queue.not_empty);
+    pthread_mutex_unlock(&queue.lock);
+}
+
+// Take the next chunk, waiting for one to be read, or return false once the file is finished
+bool pop_chunk(Chunk *chunk)
+{
+    pthread_mutex_lock(&queue.lock);
+    while (queue.count == 0 && !queue.finished) {
+        pthread_cond_wait(&queue.not_empty, &queue.lock);
+    }
+    bool popped = queue.count > 0;
+    if (popped) {
+        *chunk = queue.chunks[queue.head];
+        queue.head = (queue.head + 1) % QUEUE_SIZE;
+        queue.count--;
+        pthread_cond_signal(&queue.not_full);
+    }
+    pthread_mutex_unlock(&queue.lock);
+    return popped;
+}
+
+// Text between games, such as the blank lines after the last one, is not a game
+bool is_blank(const char *text, size_t length)
+{
+    for (size_t i = 0; i < length; i++) {
+        if (text[i] != ' ' && text[i] != '\t' && text[i] != '\r' && text[i] != '\n') {
+            return false;
+        }
+    }
+    return true;
+}
+
+void *replay_chunks(void *arg)
+{
+    Worker *worker = arg;
+    Position *pos = calloc(1, sizeof(Position));
+    Pgn_Game game;
+    Chunk chunk;
+
+    while (pop_chunk(&chunk)) {
+        long long number = chunk.first_game;
+        for (size_t offset = 0; offset < chunk.length; ) {
+            size_t length = pgn_game_length(chunk.text + offset, chunk.length - offset);
+            if (!is_blank(chunk.text + offset, length)) {
+                int verdict = pgn_replay(pos, chunk.text + offset, length, &game);
+                worker->games++;
+                worker->plies += game.plies;
+                worker->results[game.result]++;
+                worker->verdicts[verdict]++;
+                if (verdict != PGN_OK && worker->listed_count < MAX_LISTED) {
+                    Listed_Game *listed = &worker->listed[worker->listed_count++];
+                    listed->game = number;
+                    listed->verdict = verdict;
+                    strcpy(listed->message, game.message);
+                }
+                number++;
+            }
+            offset += length;
+        }
+        free(chunk.text);
+    }
+    free(pos);
+    return NULL;
+}
+
+/* Read a file into chunks of whole games for the workers. A game that runs past the end of
+what has been read waits for the next read, and the buffer grows for one longer than itself. */
+bool read_chunks(FILE *file, long long *bytes)
+{
+    size_t capacity = READ_SIZE, filled = 0;
+    char *buffer = malloc(capacity);
+    long long games = 0;
+
+    while (buffer) {
+        size_t read = fread(buffer + filled, 1, capacity - filled, file);
+        bool end = read < capacity - filled;
+        filled += read;
+        *bytes += read;
+
+        // Split off whole games until a chunk is full, holding back the last game until the end
+        size_t start = 0, offset = 0;
+        long long first_game = games + 1;
+        while (offset < filled) {
+            size_t length = pgn_game_length(buffer + offset, filled - offset);
+            // The games since the last chunk are read again with the rest of the last one
+            if (offset + length == filled && !end) {
+                games = first_game - 1;
+                break;
+            }
+            if (!is_blank(buffer + offset, length)) {
+                games++;
+            }
+            offset += length;
+            if (offset - start >= CHUNK_SIZE || offset == filled) {
+                Chunk chunk = {malloc(offset - start), offset - start, first_game};
+                memcpy(chunk.text, buffer + start, offset - start);
+                push_chunk(chunk);
+                start = offset;
+                first_game = games + 1;
+            }
+        }
+        if (end) {
+            break;
+        }
+        // Keep the games not handed over, and make room if a single one fills the buffer
+        memmove(buffer, buffer + start, filled - start);
+        filled -= start;
+        if (filled == capacity) {
+            capacity *= 2;
+            buffer = realloc(buffer, capacity);
+        }
+    }
+    free(buffer);
+    return buffer != NULL;
+}
+
+int compare_listed(const void *a, const void *b)
+{
+    const Listed_Game *x = a, *y = b;
+    return x->game < y->game ? -1 : x->game > y->game;
+}
+
+int replay_file(char *path, int threads)
+{
+    static Worker workers[MAX_THREADS];
+    static Listed_Game listed[MAX_THREADS * MAX_LISTED];
+    static const char *verdict_text[3] = {"ok", "illegal", "inconsistent"};
+    FILE *file = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    Worker total = {0};
+    long long bytes = 0;
+    int listed_count = 0;
+
+    if (!file) {
+        perror(path);
+        return 1;
+    }
+    double start = seconds_now();
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&workers[i].handle, NULL, replay_chunks, &workers[i]);
+    }
+    bool read = read_chunks(file, &bytes);
+    pthread_mutex_lock(&queue.lock);
+    queue.finished = true;
+    pthread_cond_broadcast(&queue.not_empty);
+    pthread_mutex_unlock(&queue.lock);
+    for (int i = 0; i < threads; i++) {
+        pthread_join(workers[i].handle, NULL);
+    }
+    double seconds = seconds_now() - start;
+    if (file != stdin) {
+        fclose(file);
+    }
+    if (!read) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    for (int i = 0; i < threads; i++) {
+        total.games += workers[i].games;
+        total.plies += workers[i].plies;
+        for (int j = 0; j < 4; j++) {
+            total.results[j] += workers[i].results[j];
+        }
+        for (int j = 0; j < 3; j++) {
+            total.verdicts[j] += workers[i].verdicts[j];
+        }
+        memcpy(listed + listed_count, workers[i].listed, workers[i].listed_count * sizeof(Listed_Game));
+        listed_count += workers[i].listed_count;
+    }
+    qsort(listed, listed_count, sizeof(Listed_Game), compare_listed);
+    for (int i = 0; i < listed_count && i < MAX_LISTED; i++) {
+        printf("game %lld %s: %s\n", listed[i].game, verdict_text[listed[i].verdict], listed[i].message);
+    }
+    long long problems = total.verdicts[PGN_ILLEGAL] + total.verdicts[PGN_INCONSISTENT];
+    if (problems > MAX_LISTED) {
+        printf("... and %lld more\n", problems - MAX_LISTED);
+    }
+
+    printf("%lld games, %lld moves, %.1f MB in %.3fs on %d threads: %.0f games/sec, %.0f moves/sec\n",
+           total.games, total.plies, bytes / 1e6, seconds, threads, total.games / seconds, total.plies / seconds);
+    printf("%lld white wins, %lld black wins, %lld draws, %lld unfinished\n", total.results[PGN_WHITE_WINS],
+           total.results[PGN_BLACK_WINS], total.results[PGN_DRAW], total.results[PGN_UNKNOWN]);
+    printf("%lld illegal, %lld inconsistent\n", total.verdicts[PGN_ILLEGAL], total.verdicts[PGN_INCONSISTENT]);
+    return problems ? 1 : 0;
+}
+
+void usage()
+{
+    fprintf(stderr, "usage: pgnbench <file or -> [threads]\n       pgnbench generate <games> [seed] > file\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    Position *pos = calloc(1, sizeof(Position));
+    int failures = check_known(pos);
+    free(pos);
+    if (failures) {
+        fprintf(stderr, "%d known moves and games read wrongly\n", failures);
+        return 1;
+    }
+
+    if (argc >= 3 && argc <= 4 && strcmp(argv[1], "generate") == 0) {
+        generate_games(atoll(argv[2]), argc > 3 ? (unsigned)atoi(argv[3]) : 1);
+        return 0;
+    }
+    if (argc < 2 || argc > 3) {
+        usage();
+    }
+    int threads = argc > 2 ? atoi(argv[2]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1 || threads > MAX_THREADS) {
+        threads = threads < 1 ? 1 : MAX_THREADS;
+    }
+    return replay_file(argv[1], threads);
+}
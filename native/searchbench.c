@@ -0,0 +1,99 @@
+// searchbench.c
+/* Search a fixed set of positions for a fixed time or to a fixed depth, and report the depth
+reached, nodes per second and the move chosen for each. The suite includes short mates, so a
+search that misses them is broken. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "chess.h"
+
+typedef struct {
+    char *name;
+    char *fen;
+    // The best move, for positions that have only one, or NULL
+    char *best_move;
+} Bench_Position;
+
+Bench_Position suite[] = {
+    {"start position", "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", NULL},
+    {"kiwipete", "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", NULL},
+    {"middlegame", "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10", NULL},
+    {"scholar's mate", "r1bqkbnr/pppp1ppp/2n5/4p3/2B1P3/5Q2/PPPP1PPP/RNB1K1NR w KQkq - 4 4", "f3f7"},
+    {"back rank mate in 2", "2r3k1/5ppp/8/8/8/8/4RPPP/4R1K1 w - - 0 1", "e2e8"},
+    {"hanging queen", "4k3/8/8/3q4/8/8/8/3RK3 w - - 0 1", "d1d5"},
+    {"rook endgame", "8/5pk1/6p1/8/1R6/6P1/5PK1/r7 w - - 0 40", NULL},
+    {"pawn race", "8/1p6/8/8/8/8/6P1/k6K w - - 0 1", NULL},
+};
+
+#define SUITE_SIZE (int)(sizeof(suite) / sizeof(suite[0]))
+
+Position position;
+
+void usage()
+{
+    fprintf(stderr, "usage: searchbench [milliseconds per position] [hash megabytes]\n       searchbench depth <depth> [hash megabytes]\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    Search_Limits limits = {0, 1000, 0, 1};
+    long long total_nodes = 0;
+    double total_seconds = 0;
+    int hash_megabytes = 16;
+    int failures = 0;
+
+    if (argc >= 3 && argc <= 4 && strcmp(argv[1], "depth") == 0) {
+        limits.depth = atoi(argv[2]);
+        limits.time_ms = 0;
+        if (limits.depth < 1) {
+            usage();
+        }
+        if (argc == 4) {
+            hash_megabytes = atoi(argv[3]);
+        }
+    } else if (argc >= 2 && argc <= 3) {
+        limits.time_ms = atoi(argv[1]);
+        if (limits.time_ms < 1) {
+            usage();
+        }
+        if (argc == 3) {
+            hash_megabytes = atoi(argv[2]);
+        }
+    } else if (argc != 1) {
+        usage();
+    }
+    printf("%d MB hash\n", tt_init(hash_megabytes));
+
+    for (int i = 0; i < SUITE_SIZE; i++) {
+        Bench_Position *entry = &suite[i];
+        Search_Info info;
+        char best[6], pv[MAX_SEARCH_DEPTH * 6] = "";
+
+        // Each position starts from an empty table, so results don't depend on the order of the suite
+        tt_clear();
+        load_fen(&position, entry->fen);
+        search_position(&position, &limits, &info);
+        total_nodes += info.nodes;
+        total_seconds += info.seconds;
+
+        move_to_uci(info.best_move, best);
+        for (int ply = 0; ply < info.pv_length && ply < 8; ply++) {
+            char move[6];
+            strcat(pv, ply ? " " : "");
+            strcat(pv, move_to_uci(info.pv[ply], move));
+        }
+        bool wrong = entry->best_move && strcmp(best, entry->best_move) != 0;
+        if (wrong) {
+            failures++;
+        }
+        printf("%-20s depth %2d  score %6d  %10lld nodes  %7.3fs  %7.0f knps  %-5s %s  pv %s\n", entry->name,
+               info.depth, info.score, info.nodes, info.seconds, info.nodes / info.seconds / 1e3, best,
+               wrong ? "WRONG" : "", pv);
+        printf("%20s hash hits %5.1f%%  collisions %lld  fill %.1f%%  first move cutoffs %5.1f%%\n", "",
+               100.0 * info.hash_hits / (info.hash_probes ? info.hash_probes : 1), info.hash_collisions,
+               info.hash_fill_permille / 10.0, 100.0 * info.first_move_cutoffs / (info.cutoffs ? info.cutoffs : 1));
+    }
+    printf("total %lld nodes in %.3fs, %.0f knps\n", total_nodes, total_seconds, total_nodes / total_seconds / 1e3);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,64 @@
+// smpbench.c
+/* Measure how much faster a search reaches a fixed depth on more threads. Each position is
+searched from an empty transposition table on 1, 2, 4... threads up to the maximum, and the
+time to depth is reported with its speedup over one thread. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "chess.h"
+
+char *positions[] = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+    "r1bq1rk1/pp2bppp/2n1pn2/3p4/2PP4/2N1PN2/PP3PPP/R2QKB1R w KQ - 0 8",
+    "8/5pk1/6p1/8/1R6/6P1/5PK1/r7 w - - 0 40",
+};
+
+#define POSITION_COUNT (int)(sizeof(positions) / sizeof(positions[0]))
+
+Position position;
+
+void usage()
+{
+    fprintf(stderr, "usage: smpbench [depth] [maximum threads] [hash megabytes]\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    int depth = argc > 1 ? atoi(argv[1]) : 7;
+    int max_threads = argc > 2 ? atoi(argv[2]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int hash_megabytes = argc > 3 ? atoi(argv[3]) : 64;
+    double single_thread_seconds = 0;
+
+    if (argc > 4 || depth < 1 || max_threads < 1 || hash_megabytes < 1) {
+        usage();
+    }
+    printf("depth %d, %d MB hash, %d cores\n", depth, tt_init(hash_megabytes), (int)sysconf(_SC_NPROCESSORS_ONLN));
+
+    for (int threads = 1; ; threads = threads * 2 > max_threads && threads < max_threads ? max_threads : threads * 2) {
+        Search_Limits limits = {depth, 0, 0, threads};
+        long long nodes = 0;
+        double seconds = 0;
+
+        for (int i = 0; i < POSITION_COUNT; i++) {
+            Search_Info info;
+            tt_clear();
+            load_fen(&position, positions[i]);
+            search_position(&position, &limits, &info);
+            nodes += info.nodes;
+            seconds += info.seconds;
+        }
+        if (threads == 1) {
+            single_thread_seconds = seconds;
+        }
+        printf("%3d threads  %8.3fs to depth  %5.2fx speedup  %11lld nodes  %7.0f knps\n", threads, seconds,
+               single_thread_seconds / seconds, nodes, nodes / seconds / 1e3);
+        if (threads >= max_threads) {
+            break;
+        }
+    }
+    return 0;
+}
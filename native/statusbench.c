@@ -0,0 +1,158 @@
+// statusbench.c
+/* Check game_status on positions whose result is known, and that has_legal_move agrees with
+generating every legal move on every position of a set of random games. Then time the status
+check each move needs against generating every legal move, which is how the end of a game used
+to be found. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "chess.h"
+
+typedef struct {
+    char *name;
+    char *fen;
+    // Moves in UCI notation made through make_move before the status is checked, or NULL
+    char *moves;
+    int status;
+} Status_Position;
+
+Status_Position suite[] = {
+    {"start position", "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", NULL, GAME_ONGOING},
+    {"fool's mate", "rnb1kbnr/pppp1ppp/8/4p3/6Pq/5P2/PPPPP2P/RNBQKBNR w KQkq - 1 3", NULL, CHECKMATE},
+    {"smothered mate", "6rk/5Npp/8/8/8/8/8/6K1 b - - 0 1", NULL, CHECKMATE},
+    {"mate on the 100th ply", "R5k1/5ppp/8/8/8/8/8/6K1 b - - 100 80", NULL, CHECKMATE},
+    {"stalemate", "7k/5Q2/6K1/8/8/8/8/8 b - - 0 1", NULL, STALEMATE},
+    {"fifty moves", "8/8/4k3/8/8/3K4/8/R7 w - - 100 80", NULL, FIFTY_MOVE_RULE},
+    {"bare kings", "8/8/4k3/8/8/3K4/8/8 w - - 0 1", NULL, INSUFFICIENT_MATERIAL},
+    {"king and bishop", "8/8/4k3/8/8/3KB3/8/8 w - - 0 1", NULL, INSUFFICIENT_MATERIAL},
+    {"bishops on one color", "8/8/4k3/8/3b4/3KB3/8/8 w - - 0 1", NULL, INSUFFICIENT_MATERIAL},
+    {"bishops on both colors", "8/8/4k3/3b4/8/3KB3/8/8 w - - 0 1", NULL, GAME_ONGOING},
+    {"two knights", "8/8/4k3/8/8/3KNN2/8/8 w - - 0 1", NULL, GAME_ONGOING},
+    {"check answered en passant", "8/8/8/2k5/3Pp3/8/8/4K3 b - d3 0 1", NULL, GAME_ONGOING},
+    {"twofold repetition", "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", "g1f3 g8f6 f3g1 f6g8", GAME_ONGOING},
+    {"threefold repetition", "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+     "g1f3 g8f6 f3g1 f6g8 g1f3 g8f6 f3g1 f6g8", THREEFOLD_REPETITION},
+    {"repetition broken by a pawn move", "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+     "g1f3 g8f6 f3g1 f6g8 e2e3 e7e6 g1f3 g8f6 f3g1 f6g8", GAME_ONGOING},
+};
+
+#define SUITE_SIZE (int)(sizeof(suite) / sizeof(suite[0]))
+
+char *status_names[] = {"ongoing", "insufficient material", "checkmate", "stalemate", "fifty-move rule", "threefold repetition"};
+
+#define GAMES 200
+#define GAME_PLIES 300
+
+Position position;
+
+double seconds_now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Make the moves of a suite entry through make_move, and return false if one is not legal
+bool make_moves(Position *pos, char *moves)
+{
+    char from[3] = "", to[3] = "";
+    for (char *s = moves; s && *s; s += s[4] ? 5 : 4) {
+        memcpy(from, s, 2);
+        memcpy(to, s + 2, 2);
+        if (!make_move(pos, from, to)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+enum Status_Mode {
+    NO_STATUS,
+    BY_GENERATION,
+    BY_STATUS,
+    CHECK_PROBE,
+};
+
+/* Play random games until no legal move or mating material is left, or the ply limit, and return the number of positions reached.
+BY_STATUS takes the status of each position by game_status, and BY_GENERATION finds whether it
+has a legal move by generating them all. CHECK_PROBE compares has_legal_move with generating
+every move in each position and each position a move from it, counting disagreements in
+*mismatches. */
+long long play_games(int mode, long long *mismatches, long long *checksum)
+{
+    Move move_list[MAX_MOVES], child_list[MAX_MOVES];
+    long long positions = 0;
+
+    srand(1);
+    for (int game = 0; game < GAMES; game++) {
+        load_fen(&position, "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+        for (int ply = 0; ply < GAME_PLIES; ply++) {
+            int count = generate_moves(&position, move_list);
+            positions++;
+            if (mode == BY_GENERATION) {
+                *checksum += generate_moves(&position, child_list) == 0;
+            } else if (mode == BY_STATUS) {
+                *checksum += game_status(&position);
+            } else if (mode == CHECK_PROBE) {
+                *mismatches += has_legal_move(&position) != (count > 0);
+                for (int i = 0; i < count; i++) {
+                    do_move(&position, move_list[i]);
+                    *mismatches += has_legal_move(&position) != (generate_moves(&position, child_list) > 0);
+                    undo_move(&position);
+                }
+            }
+            // Games that have run down to bare kings would mostly time the material count
+            if (count == 0 || insufficient_material(&position)) {
+                break;
+            }
+            do_move(&position, move_list[rand() % count]);
+            position.undo_count = 0;
+        }
+    }
+    return positions;
+}
+
+int main(int argc, char *argv[])
+{
+    long long mismatches = 0, checksum = 0;
+    int failures = 0;
+
+    if (argc != 1) {
+        fprintf(stderr, "usage: statusbench\n");
+        return 2;
+    }
+    for (int i = 0; i < SUITE_SIZE; i++) {
+        Status_Position *entry = &suite[i];
+        int status = -1;
+
+        if (load_fen(&position, entry->fen) && make_moves(&position, entry->moves)) {
+            status = game_status(&position);
+        }
+        bool wrong = status != entry->status;
+        if (wrong) {
+            failures++;
+        }
+        printf("%-34s %-22s %s\n", entry->name, status < 0 ? "illegal move" : status_names[status], wrong ? "WRONG" : "ok");
+    }
+
+    long long positions = play_games(CHECK_PROBE, &mismatches, &checksum);
+    printf("has_legal_move checked on %lld positions and their children: %lld wrong\n", positions, mismatches);
+    if (mismatches) {
+        failures++;
+    }
+
+    // Playing the games without a status check gives the time to leave out of the rates
+    double start = seconds_now();
+    play_games(NO_STATUS, &mismatches, &checksum);
+    double overhead = seconds_now() - start;
+    start = seconds_now();
+    play_games(BY_GENERATION, &mismatches, &checksum);
+    double generation_seconds = seconds_now() - start - overhead;
+    start = seconds_now();
+    play_games(BY_STATUS, &mismatches, &checksum);
+    double status_seconds = seconds_now() - start - overhead;
+    printf("game_status           %6.0f ns per position\n", 1e9 * status_seconds / positions);
+    printf("generating every move %6.0f ns per position\n", 1e9 * generation_seconds / positions);
+    return failures ? 1 : 0;
+}
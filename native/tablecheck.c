@@ -0,0 +1,79 @@
+// tablecheck.c
+/* Check the attack tables compiled in from attack_tables.h against the code that used to fill
+them at startup, for every square: the leaper attacks against the shifts and masks of the
+pattern functions, and the rays, between and line tables against the magic slider attacks. */
+#include <stdlib.h>
+#include <stdio.h>
+#include "chess.h"
+
+int failures = 0;
+
+// Check one entry of a table, whose second index is -1 if it only has one
+void check(char *table, int index, int other, U64 compiled, U64 expected)
+{
+    if (compiled != expected) {
+        if (failures < 20) {
+            printf("%s[%d]", table, index);
+            if (other >= 0) {
+                printf("[%d]", other);
+            }
+            printf(" is %016llx, expected %016llx\n", compiled, expected);
+        }
+        failures++;
+    }
+}
+
+int main()
+{
+    for (int square = 0; square < 64; square++) {
+        U64 bb = SQUARE_BB(square);
+        check("knight_attacks", square, -1, knight_attacks[square],
+              ((bb << 15) & ~FILE_A) | ((bb <<  6) & ~FILE_A & ~FILE_B)
+            | ((bb >> 10) & ~FILE_A & ~FILE_B) | ((bb >> 17) & ~FILE_A)
+            | ((bb >> 15) & ~FILE_H) | ((bb >>  6) & ~FILE_H & ~FILE_G)
+            | ((bb << 10) & ~FILE_H & ~FILE_G) | ((bb << 17) & ~FILE_H));
+        check("king_attacks", square, -1, king_attacks[square],
+              (bb << 8) | (bb >> 8)
+            | ((bb >> 1) & ~FILE_A) | ((bb << 7) & ~FILE_A) | ((bb >> 9) & ~FILE_A)
+            | ((bb << 1) & ~FILE_H) | ((bb >> 7) & ~FILE_H) | ((bb << 9) & ~FILE_H));
+        check("pawn_attacks", 0, square, pawn_attacks[0][square], ((bb << 9) & ~FILE_H) | ((bb << 7) & ~FILE_A));
+        check("pawn_attacks", 1, square, pawn_attacks[1][square], ((bb >> 9) & ~FILE_A) | ((bb >> 7) & ~FILE_H));
+
+        // Each ray is the part of the empty board attacks on one side of the square
+        U64 rook = rook_attacks(square, 0), bishop = bishop_attacks(square, 0);
+        U64 above = ~0ULL << square << 1, below = bb - 1;
+        U64 file = FILE_H << SQUARE_FILE(square), rank = RANK_1 << (8 * SQUARE_RANK(square));
+        U64 east = FILE_H * ((1ULL << SQUARE_FILE(square)) - 1), west = ~(east | file);
+        check("ray_bb", NORTH, square, ray_bb[NORTH][square], rook & file & above);
+        check("ray_bb", WEST, square, ray_bb[WEST][square], rook & rank & west);
+        check("ray_bb", SOUTH, square, ray_bb[SOUTH][square], rook & file & below);
+        check("ray_bb", EAST, square, ray_bb[EAST][square], rook & rank & east);
+        check("ray_bb", NORTH_WEST, square, ray_bb[NORTH_WEST][square], bishop & above & west);
+        check("ray_bb", NORTH_EAST, square, ray_bb[NORTH_EAST][square], bishop & above & east);
+        check("ray_bb", SOUTH_WEST, square, ray_bb[SOUTH_WEST][square], bishop & below & west);
+        check("ray_bb", SOUTH_EAST, square, ray_bb[SOUTH_EAST][square], bishop & below & east);
+    }
+
+    // Rays from both ends meet only between them, and empty-board rays only on their line
+    for (int a = 0; a < 64; a++) {
+        for (int b = 0; b < 64; b++) {
+            U64 between = 0, line = 0, ends = SQUARE_BB(a) | SQUARE_BB(b);
+            if (a != b && (rook_attacks(a, 0) & SQUARE_BB(b))) {
+                between = rook_attacks(a, SQUARE_BB(b)) & rook_attacks(b, SQUARE_BB(a));
+                line = (rook_attacks(a, 0) & rook_attacks(b, 0)) | ends;
+            } else if (a != b && (bishop_attacks(a, 0) & SQUARE_BB(b))) {
+                between = bishop_attacks(a, SQUARE_BB(b)) & bishop_attacks(b, SQUARE_BB(a));
+                line = (bishop_attacks(a, 0) & bishop_attacks(b, 0)) | ends;
+            }
+            check("between_bb", a, b, between_bb[a][b], between);
+            check("line_bb", a, b, line_bb[a][b], line);
+        }
+    }
+
+    if (failures) {
+        printf("%d table entries differ\n", failures);
+        return 1;
+    }
+    printf("knight, king, pawn, ray, between and line tables agree on every square\n");
+    return 0;
+}
@@ -0,0 +1,202 @@
+// workerbench.js
+// Play random games through public/engine.js, which runs public/engine-worker.js on a worker
+// thread as the page does, and report the round trip latency of its requests and how long they
+// hold up the main thread. Searches are timed on the worker and on the main thread, where
+// script.js used to call the engine, and a search is cancelled to time how quickly the engine
+// answers again. Every move list the worker sends is checked against the native build.
+// Usage: node native/workerbench.js [games] [search milliseconds]
+const { Worker } = require('worker_threads');
+const { monitorEventLoopDelay, performance } = require('perf_hooks');
+const path = require('path');
+const { Engine } = require('../public/engine.js');
+// The same exports the worker runs on when there is no wasm build, called here on the main thread
+const native = require('../build/module.node');
+
+const gameCount = parseInt(process.argv[2]) || 200;
+const searchMs = parseInt(process.argv[3]) || 500;
+const maxPlies = 200;
+
+// A small xorshift generator, so every run plays the same games
+let seed = 2463534242;
+function random(n) {
+    seed ^= seed << 13;
+    seed ^= seed >>> 17;
+    seed ^= seed << 5;
+    return (seed >>> 0) % n;
+}
+
+function percentile(sorted, p) {
+    return sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * p))];
+}
+
+// Convert a square index used by chess.c (0 is h1, 63 is a8) to algebraic notation
+function squareToAn(square) {
+    return String.fromCharCode(104 - (square % 8)) + (Math.trunc(square / 8) + 1);
+}
+
+function createWorker() {
+    const worker = new Worker(path.join(__dirname, 'workerhost.js'));
+    const adapter = {
+        postMessage: (message, transfer) => worker.postMessage(message, transfer),
+        // A browser stops a worker running wasm at once, but Node lets native code run on
+        terminate: () => {
+            native.abortSearch();
+            worker.terminate();
+        },
+    };
+    worker.on('message', (data) => adapter.onmessage({ data: data }));
+    worker.on('error', (err) => adapter.onerror({ message: err.message }));
+    return adapter;
+}
+
+const engine = new Engine(createWorker);
+const movesPtr = native._malloc(2 * 256);
+const scorePtr = native._malloc(8);
+const nativeMoves = new Uint16Array(native.heap);
+const latencies = {};
+let mainThreadMs = 0;
+let requestCount = 0;
+let mismatches = 0;
+
+// Make a request, timing how long the call itself takes on the main thread and how long its answer takes
+async function timed(type, call) {
+    const start = performance.now();
+    const promise = call();
+    const returned = performance.now();
+    mainThreadMs += returned - start;
+    requestCount++;
+    const result = await promise;
+    (latencies[type] = latencies[type] || []).push(performance.now() - start);
+    return result;
+}
+
+function nativeLegalMoves() {
+    const count = native.generate_moves(0, movesPtr);
+    return nativeMoves.subarray(movesPtr / 2, movesPtr / 2 + count);
+}
+
+function sameMoves(a, b) {
+    return a.length == b.length && a.every((move, i) => move == b[i]);
+}
+
+// Play a random game on the worker, and the same game natively, comparing their move lists
+async function playGame(game) {
+    await timed('newGame', () => engine.newGame());
+    native.set_start_bitboards(0);
+    let plies = 0;
+    for ( ; plies < maxPlies; plies++) {
+        const moves = await timed('legalMoves', () => engine.legalMoves());
+        if (!sameMoves(moves, nativeLegalMoves())) {
+            if (mismatches++ < 10) {
+                console.error(`game ${game} ply ${plies}: the worker's legal moves differ from the native build's`);
+            }
+        }
+        if (moves.length == 0) {
+            break;
+        }
+        const move = moves[random(moves.length)];
+        const from = squareToAn(move & 63), to = squareToAn((move >> 6) & 63);
+        await timed('makeMove', () => engine.makeMove(from, to));
+        native.make_move(0, from, to);
+        const square = await timed('pawnPromotion', () => engine.pawnPromotion());
+        if (square) {
+            // Queens, numbered 1 for white and 7 for black
+            const piece = to[1] == '8' ? 1 : 7;
+            await timed('promotePawn', () => engine.promotePawn(square, piece));
+            native.promote_pawn(0, square, piece);
+        }
+        if (await timed('status', () => engine.status())) {
+            break;
+        }
+    }
+    return plies;
+}
+
+// Return the longest the event loop was held up while a function ran
+async function loopDelayDuring(run) {
+    const loopDelay = monitorEventLoopDelay({ resolution: 1 });
+    loopDelay.enable();
+    // The delay is sampled between timer ticks, so one has to pass before the function starts
+    await new Promise(resolve => setTimeout(resolve, 5));
+    await run();
+    // Let the timer that samples the delay see the end of a blocking call
+    await new Promise(resolve => setTimeout(resolve, 5));
+    loopDelay.disable();
+    return loopDelay.max / 1e6;
+}
+
+async function main() {
+    // The first answer waits for the worker to start and the engine to load
+    const startup = performance.now();
+    await engine.newGame();
+    console.log(`worker ready in ${(performance.now() - startup).toFixed(2)}ms`);
+
+    let plies = 0;
+    const start = performance.now();
+    const eventLoop = performance.eventLoopUtilization();
+    const gameDelay = await loopDelayDuring(async () => {
+        for (let game = 0; game < gameCount; game++) {
+            plies += await playGame(game);
+        }
+    });
+    const seconds = (performance.now() - start) / 1000;
+    const utilization = performance.eventLoopUtilization(eventLoop).utilization;
+
+    console.log(`${gameCount} games, ${plies} plies, ${requestCount} requests in ${seconds.toFixed(3)}s, ${Math.round(requestCount / seconds)} requests/sec`);
+    for (const type in latencies) {
+        const sorted = latencies[type].sort((a, b) => a - b);
+        console.log(`${type.padEnd(14)} round trip p50 ${percentile(sorted, 0.5).toFixed(3)}ms  p99 ${percentile(sorted, 0.99).toFixed(3)}ms  max ${sorted[sorted.length - 1].toFixed(3)}ms`);
+    }
+    console.log(`main thread ${(1000 * mainThreadMs / requestCount).toFixed(1)}us per request call, busy ${(100 * utilization).toFixed(1)}% of the time, event loop delay max ${gameDelay.toFixed(2)}ms`);
+
+    // A search on the worker leaves the main thread free, and one on the main thread holds it for the whole search
+    native.set_start_bitboards(0);
+    await engine.newGame();
+    let workerResult;
+    const workerDelay = await loopDelayDuring(async () => {
+        workerResult = await engine.search(0, searchMs);
+    });
+    const mainDelay = await loopDelayDuring(async () => {
+        native.search_best_move(0, 0, searchMs, scorePtr);
+    });
+    const best = squareToAn(workerResult.move & 63) + squareToAn((workerResult.move >> 6) & 63);
+    console.log(`${searchMs}ms search: event loop delay max ${workerDelay.toFixed(2)}ms on the worker, ${mainDelay.toFixed(2)}ms on the main thread (${best}, score ${workerResult.score})`);
+
+    // Play a few moves, then cancel a long search and a request queued behind it
+    for (const [from, to] of [['e2', 'e4'], ['e7', 'e5'], ['g1', 'f3']]) {
+        await engine.makeMove(from, to);
+        native.make_move(0, from, to);
+    }
+    const controller = new AbortController(), queuedController = new AbortController();
+    const search = engine.search(0, 60000, controller.signal);
+    const queued = engine.legalMoves(queuedController.signal);
+    const after = engine.legalMoves();
+    await new Promise(resolve => setTimeout(resolve, 100));
+    const cancelled = performance.now();
+    queuedController.abort();
+    controller.abort();
+    const cancelMs = performance.now() - cancelled;
+    const outcomes = await Promise.allSettled([search, queued]);
+    const rejectedMs = performance.now() - cancelled;
+    const moves = await after;
+    const answeredMs = performance.now() - cancelled;
+    if (outcomes.some(outcome => outcome.status != 'rejected')) {
+        mismatches++;
+        console.error('a cancelled request was answered');
+    }
+    if (!sameMoves(moves, nativeLegalMoves())) {
+        mismatches++;
+        console.error('the legal moves after the worker restarted differ from the native build\'s');
+    }
+    const how = engine.restarts ? `by restarting the worker and replaying ${engine.history.length} requests` : 'through search_abort';
+    console.log(`cancelling took ${cancelMs.toFixed(2)}ms on the main thread ${how}`);
+    console.log(`cancelled search rejected in ${rejectedMs.toFixed(2)}ms, next request answered in ${answeredMs.toFixed(2)}ms`);
+
+    engine.worker.terminate();
+    if (mismatches) {
+        console.log(`${mismatches} answers differ from the native build`);
+        process.exit(1);
+    }
+}
+
+main();
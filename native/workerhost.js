@@ -0,0 +1,50 @@
+// workerhost.js
+// Run public/engine-worker.js on a worker_threads worker the way a browser runs it in a
+// dedicated Worker, for native/workerbench.js: self, postMessage, onmessage and importScripts
+// mean what they do there. importScripts('a.out.js') runs public/a.out.js when `make wasm` has
+// built one, and otherwise sets Module up on build/module.node, a native build of the same exports.
+const { parentPort } = require('worker_threads');
+const fs = require('fs');
+const path = require('path');
+const vm = require('vm');
+
+const publicDir = path.join(__dirname, '..', 'public');
+
+globalThis.self = globalThis;
+self.postMessage = (message, transfer) => parentPort.postMessage(message, transfer);
+parentPort.on('message', (data) => self.onmessage({ data: data }));
+
+function runScript(file) {
+    vm.runInThisContext(fs.readFileSync(file, 'utf8'), { filename: file });
+}
+
+// What emcc's a.out.js adds to Module that engine-worker.js uses, on the native build
+function nativeModule(native) {
+    const HEAP32 = new Int32Array(native.heap);
+    return {
+        // The native functions take and return strings as they are, so need no wrapping
+        cwrap: (name) => native[name],
+        _malloc: native._malloc,
+        HEAPU8: new Uint8Array(native.heap),
+        HEAPU16: new Uint16Array(native.heap),
+        HEAP32: HEAP32,
+        getValue: (pointer) => HEAP32[pointer >> 2],
+    };
+}
+
+self.importScripts = (file) => {
+    const script = path.join(publicDir, file);
+    if (fs.existsSync(script)) {
+        // a.out.js loads a.out.wasm from beside itself with these under Node
+        globalThis.require = require;
+        globalThis.__dirname = publicDir;
+        globalThis.__filename = script;
+        runScript(script);
+        return;
+    }
+    Object.assign(self.Module, nativeModule(require('../build/module.node')));
+    // a.out.js calls it once the wasm has compiled, after the script that loaded it has run
+    setImmediate(() => self.Module.onRuntimeInitialized());
+};
+
+runScript(path.join(publicDir, 'engine-worker.js'));
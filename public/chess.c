@@ -4,83 +4,42 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
-#include "emscripten.h"
-
-/* 8x8 bitboards are stored as 64 bit unsigned integers.
-files correspond to columns, and ranks correspond to rows. */
-#define FILE_A 0x8080808080808080ULL
-#define FILE_B 0x4040404040404040ULL
-#define FILE_C 0x2020202020202020ULL
-#define FILE_D 0x1010101010101010ULL
-#define FILE_E 0x0808080808080808ULL
-#define FILE_F 0x0404040404040404ULL
-#define FILE_G 0x0202020202020202ULL
-#define FILE_H 0x0101010101010101ULL
-
-#define RANK_1 0x00000000000000ffULL
-#define RANK_2 0x000000000000ff00ULL
-#define RANK_3 0x0000000000ff0000ULL
-#define RANK_4 0x00000000ff000000ULL
-#define RANK_5 0x000000ff00000000ULL
-#define RANK_6 0x0000ff0000000000ULL
-#define RANK_7 0x00ff000000000000ULL
-#define RANK_8 0xff00000000000000ULL
-
-typedef unsigned long long U64;
-
-enum Piece_Type {
-    WHITE_KING = 0,
-    WHITE_QUEEN = 1,
-    WHITE_ROOK = 2,
-    WHITE_BISHOP = 3,
-    WHITE_KNIGHT = 4,
-    WHITE_PAWN = 5,
-    BLACK_KING = 6,
-    BLACK_QUEEN = 7,
-    BLACK_ROOK = 8,
-    BLACK_BISHOP = 9,
-    BLACK_KNIGHT = 10,
-    BLACK_PAWN = 11,
-};
+#include <assert.h>
+#ifdef __EMSCRIPTEN__
+#include <emscripten.h>
+#endif
+#include "chess.h"
 
-// A struct representing the Forsyth–Edwards Notation (FEN) of the board state
-typedef struct {
-    char piece_placement[74];
-    char active_color;
-    char castling_availability[5];
-    char en_passant_target[3];
-    int halfmove_clock;
-    int fullmove_number;
-} Fen;
-
-// Set default starting fen 
-Fen fen = {
-    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR",
-    'w',
-    "KQkq",
-    "-",
-    0,
-    1,
+/* The position used by the JavaScript interface, which passes a null position pointer to
+exported functions. Its bitboards are filled in by set_start_bitboards. */
+Position default_position = {
+    .fen = {
+        "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR",
+        'w',
+        ALL_CASTLING,
+        NO_SQUARE,
+        0,
+        1,
+    },
 };
 
+/* Zobrist hashing gives each position a 64 bit key: the XOR of a random number for every
+piece on its square, the castling rights, the en passant file, and black to move. The key
+is updated incrementally by every move. The random numbers come from a fixed seed, so every
+build and every peer computes the same key for the same position. */
+U64 zobrist_pieces[12][64];
+U64 zobrist_castling[16];
+U64 zobrist_en_passant[8];
+U64 zobrist_black_to_move;
+
+/* Castling rights that survive a move from or to each square: moving the king or a rook,
+or capturing a rook on its starting square, loses the matching rights. */
+int castling_rights_mask[64];
+
 /* Pieces in Forsyth-Edwards notation are represented by the characters in this array,
 which we can index with the Piece_Type enum */
 char fen_lookup[13] = "KQRBNPkqrbnp";
 
-// A global array of 12 bitboards representing piece placement
-U64 bitboards[12];
-
-// Calculated moves at depth 0 will be stored in this char array representating them in algebraic notation
-char primary_moves_arr[43];
-
-// Calculated moves at depth 1 will be stored in this char array representating them in algebraic notation
-char secondary_moves_arr[43];
-
-// Function prototypes to avoid implicit declarations
-char *find_moves(char start_pos[], U64* bitboards_ptr, bool check_for_checks);
-void process_move(char start_pos[], char end_pos[], U64 bitboards_arr[], Fen* fen_ptr);
-void update_piece_placement();
-
 // Print a single bitboard
 void print_bitboard(U64 bitboard) {
     U64 bit = 1ULL << 63;
@@ -99,13 +58,13 @@ void print_bitboard(U64 bitboard) {
 }
 
 // Print the full board
-void print_board() {
+void print_board(Position *pos) {
     U64 bit = 1ULL << 63;
     char c;
     for (int i=0; i<64; i++) {
         c = '-';
         for (int j=0; j<12; j++) {
-            if (bit & bitboards[j]) {
+            if (bit & pos->bitboards[j]) {
                 c = fen_lookup[j];
             }
         }
@@ -118,37 +77,35 @@ void print_board() {
     printf("\n");
 }
 
-// Convert from algebraic notation to bitboard representation
-U64 an_to_bitboard(char *an)
+/* Convert a square in algebraic notation, such as e4, to its index, or return NO_SQUARE if it
+is not one. Only the functions called from JavaScript take squares in algebraic notation. */
+int an_to_square(const char *an)
 {
-    char file, rank;
-    U64 bitboard;
-
-    file = an[0];
-    rank = an[1];
-    bitboard = 1ULL;
+    if (!an || an[0] < 'a' || an[0] > 'h' || an[1] < '1' || an[1] > '8') {
+        return NO_SQUARE;
+    }
+    return (an[1] - '1') * 8 + ('h' - an[0]);
+}
 
-    bitboard = bitboard << (104 - file);
-    bitboard = bitboard << (8 * (rank - 49));
-    return bitboard;
+// Write a square in algebraic notation to an and return it
+char *square_to_an(int square, char an[3])
+{
+    an[0] = 'h' - SQUARE_FILE(square);
+    an[1] = '1' + SQUARE_RANK(square);
+    an[2] = '\0';
+    return an;
 }
 
-// Convert from bitboard representation to algebraic notation and return it as a pointer
-char *bitboard_to_an(U64 bitboard) {
-    static char an[3];
-    U64 single_pos = 1ULL;
-    for (int i = 0; i < 64; i++) {
-        if (bitboard & single_pos) {
-            // Determine File
-            an[0] = ('h' - (i % 8));
-            // Determine Rank
-            an[1] = ((i / 8) + '1');
-            an[2] = '\0';
-            return an;
-        }
-        single_pos = single_pos << 1;
+// Write a move in the long algebraic notation used by UCI, e.g. e2e4 or a7a8q, and return it
+char *move_to_uci(Move move, char uci[6])
+{
+    square_to_an(MOVE_FROM(move), uci);
+    square_to_an(MOVE_TO(move), uci + 2);
+    if (IS_PROMOTION(move)) {
+        uci[4] = "nbrq"[MOVE_FLAGS(move) & 3];
+        uci[5] = '\0';
     }
-    return "";
+    return uci;
 }
 
 // Return a bitboard containing all of one side's pieces
@@ -185,782 +142,1262 @@ U64 all_bitboard(U64* bitboards_ptr)
     return all_bb;
 }
 
-// Return true if a square is unoccupied
-bool unoccupied_square(U64 square, U64* bitboards_ptr)
+// Write a number in decimal at s and return the end of it
+static char *write_number(char *s, int number)
 {
-    if ((all_bitboard(bitboards_ptr) & square) == 0) {
-        return true;
-    } else {
-        return false;
+    char digits[12];
+    int length = 0;
+    unsigned value = number < 0 ? -(unsigned)number : number;
+
+    do {
+        digits[length++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    if (number < 0) {
+        *s++ = '-';
     }
+    while (length) {
+        *s++ = digits[--length];
+    }
+    return s;
 }
 
-// Return the rank of a square
-int rank(U64 square)
+/* Write a string representing the entirety of the fen struct to the position and return it,
+bringing the piece placement up to date first */
+char *stringify_fen(Position *pos)
 {
-    U64 bitshift_me = 1ULL;
-    for (int i=0; i<64; i++) {
-        if (square & bitshift_me) {
-            return ((i / 8) + 1);
+    char *s = pos->fen_string;
+    size_t placement_length;
+
+    update_piece_placement(pos);
+    placement_length = strlen(pos->fen.piece_placement);
+    memcpy(s, pos->fen.piece_placement, placement_length);
+    s += placement_length;
+    *s++ = ' ';
+    *s++ = pos->fen.active_color;
+    *s++ = ' ';
+    if (!(pos->fen.castling_rights & ALL_CASTLING)) {
+        *s++ = '-';
+    }
+    for (int i = 0; i < 4; i++) {
+        if (pos->fen.castling_rights & (1 << i)) {
+            *s++ = "KQkq"[i];
         }
-        bitshift_me = bitshift_me << 1;
     }
-    return 0;
+    *s++ = ' ';
+    if (pos->fen.en_passant_square != NO_SQUARE) {
+        square_to_an(pos->fen.en_passant_square, s);
+        s += 2;
+    } else {
+        *s++ = '-';
+    }
+    *s++ = ' ';
+    s = write_number(s, pos->fen.halfmove_clock);
+    *s++ = ' ';
+    s = write_number(s, pos->fen.fullmove_number);
+    *s = '\0';
+    return pos->fen_string;
 }
 
-// Return the file of a square
-char file(U64 square)
+/* Standard start position. These "magic numbers" are all precalculated bitboards
+representing where you would expect to find each piece at the beginning of the game. */
+void set_start_bitboards(Position *pos)
 {
-    U64 bitshift_me = 1ULL;
-    for (int i=0; i<64; i++) {
-        if (square & bitshift_me) {
-            return ('h' - (i % 8));
+    if (!pos) {
+        pos = &default_position;
+    }
+    pos->bitboards[WHITE_KING] = 8ULL;
+    pos->bitboards[WHITE_QUEEN] = 16ULL;
+    pos->bitboards[WHITE_ROOK] = 129ULL;
+    pos->bitboards[WHITE_BISHOP] = 36ULL;
+    pos->bitboards[WHITE_KNIGHT] = 66ULL;
+    pos->bitboards[WHITE_PAWN] = 65280ULL;
+    pos->bitboards[BLACK_KING] = 576460752303423488ULL;
+    pos->bitboards[BLACK_QUEEN] = 1152921504606846976ULL;
+    pos->bitboards[BLACK_ROOK] = 9295429630892703744ULL;
+    pos->bitboards[BLACK_BISHOP] = 2594073385365405696ULL;
+    pos->bitboards[BLACK_KNIGHT] = 4755801206503243776ULL;
+    pos->bitboards[BLACK_PAWN] = 71776119061217280ULL;
+    // The position may have been played on, so every other part of it starts over too
+    pos->fen.active_color = 'w';
+    pos->fen.castling_rights = ALL_CASTLING;
+    pos->fen.en_passant_square = NO_SQUARE;
+    pos->fen.halfmove_clock = 0;
+    pos->fen.fullmove_number = 1;
+    update_mailbox(pos);
+    pos->undo_count = 0;
+    pos->history_count = 0;
+    pos->zobrist_key = compute_zobrist_key(pos);
+    pos->eval = compute_eval_terms(pos);
+    nnue_invalidate(pos);
+}
+
+// Set up an arbitrary position from its bitboards and fen state
+void set_position(Position *pos, U64 position_bitboards[12], Fen *position_fen)
+{
+    memcpy(pos->bitboards, position_bitboards, sizeof(pos->bitboards));
+    pos->fen = *position_fen;
+    pos->undo_count = 0;
+    pos->history_count = 0;
+    update_mailbox(pos);
+    pos->zobrist_key = compute_zobrist_key(pos);
+    pos->eval = compute_eval_terms(pos);
+    nnue_invalidate(pos);
+}
+
+// Rebuild the piece on every square from the bitboards
+void update_mailbox(Position *pos)
+{
+    memset(pos->piece_on, NO_PIECE, sizeof(pos->piece_on));
+    for (int piece = 0; piece < 12; piece++) {
+        U64 pieces = pos->bitboards[piece];
+        while (pieces) {
+            pos->piece_on[pop_lsb(&pieces)] = piece;
         }
-        bitshift_me = bitshift_me << 1;
     }
-    return '0';
+    pos->stale_ranks = 255;
 }
 
-// Remove all chars of a certain type from a string
-void remove_chars(char *s, char c)
+// Return true if the piece on every square agrees with the bitboards
+bool mailbox_matches(Position *pos)
 {
-    int writer = 0, reader = 0;
-    while (s[reader]) {
-        if (s[reader] != c) {   
-            s[writer++] = s[reader];
+    for (int square = 0; square < 64; square++) {
+        int expected = NO_PIECE;
+        for (int piece = 0; piece < 12; piece++) {
+            if (pos->bitboards[piece] & SQUARE_BB(square)) {
+                expected = piece;
+                break;
+            }
+        }
+        if (pos->piece_on[square] != expected) {
+            return false;
         }
-        reader++;       
     }
-    s[writer]=0;
+    return true;
 }
 
-// Return true if string contains a certain character
-bool string_contains(char *string, char c)
+// Skip the spaces between fields of a FEN string
+char *skip_spaces(char *s)
 {
-    if (*string == c) {
-        return 1;
-    } else if (*string == '\0') {
-        return 0;
-    } else {
-        return string_contains(string + 1, c);
+    while (*s == ' ' || *s == '\t') {
+        s++;
     }
+    return s;
 }
 
-// Return a pointer to a string representing the entirety of the fen struct
-char *stringify_fen()
+// Read an optional non-negative number field, leaving value unchanged if there is none
+char *read_number_field(char *s, int *value)
 {
-    static char result[100];
-    sprintf(result, "%s %c %s %s %i %i", fen.piece_placement, fen.active_color, fen.castling_availability, fen.en_passant_target, fen.halfmove_clock, fen.fullmove_number);
-    return result;
+    char *start = skip_spaces(s);
+    int number = 0;
+
+    if (*start < '0' || *start > '9') {
+        return s;
+    }
+    while (*start >= '0' && *start <= '9') {
+        number = number * 10 + (*start - '0');
+        start++;
+    }
+    *value = number;
+    return start;
 }
 
-/* Standard start position. These "magic numbers" are all precalculated bitboards
-representing where you would expect to find each piece at the beginning of the game. */
-void set_start_bitboards()
-{
-    bitboards[WHITE_KING] = 8ULL;
-    bitboards[WHITE_QUEEN] = 16ULL;
-    bitboards[WHITE_ROOK] = 129ULL;
-    bitboards[WHITE_BISHOP] = 36ULL;
-    bitboards[WHITE_KNIGHT] = 66ULL;
-    bitboards[WHITE_PAWN] = 65280ULL;
-    bitboards[BLACK_KING] = 576460752303423488ULL;
-    bitboards[BLACK_QUEEN] = 1152921504606846976ULL;
-    bitboards[BLACK_ROOK] = 9295429630892703744ULL;
-    bitboards[BLACK_BISHOP] = 2594073385365405696ULL;
-    bitboards[BLACK_KNIGHT] = 4755801206503243776ULL;
-    bitboards[BLACK_PAWN] = 71776119061217280ULL;
-}
-
-/* Given a start position, a color, and the current piece placement, return 
-a bitboard representing all pseudo-legal king moves. */
-U64 king_pattern(U64 start_pos, bool is_white, U64* bitboards_ptr)
-{
-    U64 moves = 0ULL;
-    U64 not_my_bb = ~my_bitboard(is_white, bitboards_ptr);
-    U64 possible_move;
-
-    possible_move = (start_pos << 8) & not_my_bb & ~RANK_1;
-    moves = moves | possible_move;
-    possible_move = (start_pos >> 1) & not_my_bb & ~FILE_A;
-    moves = moves | possible_move;
-    possible_move = (start_pos >> 8) & not_my_bb & ~RANK_8;
-    moves = moves | possible_move;
-    possible_move = (start_pos << 1) & not_my_bb & ~FILE_H;
-    moves = moves | possible_move;
-    possible_move = (start_pos << 7) & not_my_bb & ~FILE_A & ~RANK_1;
-    moves = moves | possible_move;
-    possible_move = (start_pos >> 9) & not_my_bb & ~FILE_A & ~RANK_8;
-    moves = moves | possible_move;
-    possible_move = (start_pos >> 7) & not_my_bb & ~FILE_H & ~RANK_8;
-    moves = moves | possible_move;
-    possible_move = (start_pos << 9) & not_my_bb & ~FILE_H & ~RANK_1;
-    moves = moves | possible_move;
-
-    // Castling
-    if (is_white) {
-        if (string_contains(fen.castling_availability, 'K')) {
-            if (unoccupied_square(2ULL, bitboards_ptr) && unoccupied_square(4ULL, bitboards_ptr)) {
-                moves = moves | 2ULL;
-            }
-        }
-        if (string_contains(fen.castling_availability, 'Q')) {
-            if (unoccupied_square(16ULL, bitboards_ptr) && unoccupied_square(32ULL, bitboards_ptr) && unoccupied_square(64ULL, bitboards_ptr)) {
-                moves = moves | 32ULL;
+/* Set up the position described by a FEN string, or by the first four fields of an EPD line
+when the clocks are missing. Return a pointer to whatever follows the last field read, such as
+EPD operations, or NULL if the string is not a valid position, in which case the engine state
+is left unchanged. Castling rights that the king and rook no longer have are dropped, and so
+is an en passant target that no pawn can just have skipped. Nothing is allocated, so this can
+be called millions of times in a row. */
+char *load_fen(Position *pos, char *fen_string)
+{
+    U64 position_bitboards[12] = {0};
+    Fen position_fen = {"", 'w', 0, NO_SQUARE, 0, 1};
+    char *s = skip_spaces(fen_string);
+    int square = 63;
+    int placement_length = 0;
+
+    // Piece placement, from a8 down to h1
+    for (int rank = 7; rank >= 0; rank--) {
+        int rank_end = rank * 8 - 1;
+        while (square > rank_end) {
+            char *piece = (*s && *s != '/') ? strchr(fen_lookup, *s) : NULL;
+            if (*s >= '1' && *s <= '8') {
+                square -= *s - '0';
+            } else if (piece) {
+                position_bitboards[piece - fen_lookup] |= 1ULL << square;
+                square--;
+            } else {
+                return NULL;
             }
+            position_fen.piece_placement[placement_length++] = *s++;
         }
-    }
-    // Black
-    else {
-        if (string_contains(fen.castling_availability, 'k')) {
-            if (unoccupied_square(144115188075855872ULL, bitboards_ptr) && unoccupied_square(288230376151711744ULL, bitboards_ptr)) {
-                moves = moves | 144115188075855872ULL;
-            }
+        if (square != rank_end || (rank && *s != '/')) {
+            return NULL;
         }
-        if (string_contains(fen.castling_availability, 'q')) {
-            if (unoccupied_square(1152921504606846976ULL, bitboards_ptr) && unoccupied_square(2305843009213693952ULL, bitboards_ptr) && unoccupied_square(4611686018427387904ULL, bitboards_ptr)) {
-                moves = moves | 2305843009213693952ULL;
-            }
+        if (rank) {
+            position_fen.piece_placement[placement_length++] = *s++;
         }
     }
+    position_fen.piece_placement[placement_length] = '\0';
+    if (__builtin_popcountll(position_bitboards[WHITE_KING]) != 1 || __builtin_popcountll(position_bitboards[BLACK_KING]) != 1) {
+        return NULL;
+    }
 
-    return moves;
-}
-
-/* Given a start position, a color, and the current piece placement, return 
-a bitboard representing all pseudo-legal queen moves. */
-U64 queen_pattern(U64 start_pos, bool is_white, U64* bitboards_ptr)
-{
-    U64 moves = 0ULL;
-    U64 not_my_bb = ~my_bitboard(is_white, bitboards_ptr);
-    U64 opp_bb = opp_bitboard(is_white, bitboards_ptr);
-    U64 possible_move;
+    // Active color
+    s = skip_spaces(s);
+    if (*s != 'w' && *s != 'b') {
+        return NULL;
+    }
+    position_fen.active_color = *s++;
 
-    possible_move = start_pos;
-    while (possible_move) {
-        possible_move = (possible_move << 8) & not_my_bb & ~RANK_1;
-        moves = moves | possible_move;
-        if (possible_move & opp_bb) {
-            break;
+    // Castling availability
+    s = skip_spaces(s);
+    if (*s == '-') {
+        s++;
+    } else {
+        char *start = s;
+        for ( ; *s == 'K' || *s == 'Q' || *s == 'k' || *s == 'q'; s++) {
+            position_fen.castling_rights |= 1 << (strchr("KQkq", *s) - "KQkq");
         }
-    }
-    possible_move = start_pos;
-    while (possible_move) {
-        possible_move = (possible_move << 7) & not_my_bb & ~FILE_A & ~RANK_1;
-        moves = moves | possible_move;
-        if (possible_move & opp_bb) {
-            break;
+        if (s == start) {
+            return NULL;
         }
-    }
-    possible_move = start_pos;
-    while (possible_move) {
-        possible_move = (possible_move >> 1) & not_my_bb & ~FILE_A;
-        moves = moves | possible_move;
-        if (possible_move & opp_bb) {
-            break;
+        // A right is only kept while the king and that rook stand on their starting squares
+        if (!(position_bitboards[WHITE_KING] & 1ULL << 3)) {
+            position_fen.castling_rights &= ~(WHITE_KINGSIDE | WHITE_QUEENSIDE);
         }
-    }
-    possible_move = start_pos;
-    while (possible_move) {
-        possible_move = (possible_move >> 9) & not_my_bb & ~FILE_A & ~RANK_8;
-        moves = moves | possible_move;
-        if (possible_move & opp_bb) {
-            break;
+        if (!(position_bitboards[WHITE_ROOK] & 1ULL << 0)) {
+            position_fen.castling_rights &= ~WHITE_KINGSIDE;
         }
-    }
-    possible_move = start_pos;
-    while (possible_move) {
-        possible_move = (possible_move >> 8) & not_my_bb & ~RANK_8;
-        moves = moves | possible_move;
-        if (possible_move & opp_bb) {
-            break;
+        if (!(position_bitboards[WHITE_ROOK] & 1ULL << 7)) {
+            position_fen.castling_rights &= ~WHITE_QUEENSIDE;
         }
-    }
-    possible_move = start_pos;
-    while (possible_move) {
-        possible_move = (possible_move >> 7) & not_my_bb & ~FILE_H & ~RANK_8;
-        moves = moves | possible_move;
-        if (possible_move & opp_bb) {
-            break;
+        if (!(position_bitboards[BLACK_KING] & 1ULL << 59)) {
+            position_fen.castling_rights &= ~(BLACK_KINGSIDE | BLACK_QUEENSIDE);
         }
-    }
-    possible_move = start_pos;
-    while (possible_move) {
-        possible_move = (possible_move << 1) & not_my_bb & ~FILE_H;
-        moves = moves | possible_move;
-        if (possible_move & opp_bb) {
-            break;
+        if (!(position_bitboards[BLACK_ROOK] & 1ULL << 56)) {
+            position_fen.castling_rights &= ~BLACK_KINGSIDE;
+        }
+        if (!(position_bitboards[BLACK_ROOK] & 1ULL << 63)) {
+            position_fen.castling_rights &= ~BLACK_QUEENSIDE;
         }
     }
-    possible_move = start_pos;
-    while (possible_move) {
-        possible_move = (possible_move << 9) & not_my_bb & ~FILE_H & ~RANK_1;
-        moves = moves | possible_move;
-        if (possible_move & opp_bb) {
-            break;
+
+    // En passant target
+    s = skip_spaces(s);
+    if (*s == '-') {
+        s++;
+    } else if (*s >= 'a' && *s <= 'h' && (s[1] == '3' || s[1] == '6')) {
+        position_fen.en_passant_square = (s[1] - '1') * 8 + ('h' - *s);
+        s += 2;
+        // A target is only kept behind an enemy pawn that could just have moved two squares past it
+        int target = position_fen.en_passant_square;
+        int forward = position_fen.active_color == 'w' ? 8 : -8;
+        U64 occupied = 0;
+        for (int piece = 0; piece < 12; piece++) {
+            occupied |= position_bitboards[piece];
         }
+        if (SQUARE_RANK(target) != (forward > 0 ? 5 : 2)
+            || !(position_bitboards[forward > 0 ? BLACK_PAWN : WHITE_PAWN] & 1ULL << (target - forward))
+            || (occupied & (1ULL << target | 1ULL << (target + forward)))) {
+            position_fen.en_passant_square = NO_SQUARE;
+        }
+    } else {
+        return NULL;
     }
 
-    return moves;
+    // Halfmove clock and fullmove number, which EPD leaves out
+    s = read_number_field(s, &position_fen.halfmove_clock);
+    s = read_number_field(s, &position_fen.fullmove_number);
+
+    memcpy(pos->bitboards, position_bitboards, sizeof(pos->bitboards));
+    pos->fen = position_fen;
+    pos->undo_count = 0;
+    pos->history_count = 0;
+    update_mailbox(pos);
+    pos->zobrist_key = compute_zobrist_key(pos);
+    pos->eval = compute_eval_terms(pos);
+    nnue_invalidate(pos);
+    return s;
 }
 
-/* Given a start position, a color, and the current piece placement, return 
-a bitboard representing all pseudo-legal rook moves. */
-U64 rook_pattern(U64 start_pos, bool is_white, U64* bitboards_ptr)
+/* Sliding piece attacks are looked up in precomputed tables indexed by square and by the
+occupancy of the squares that could block the slider. The relevant occupancy bits are
+compressed into a table index with PEXT on CPUs with BMI2, and with a magic multiplication
+everywhere else (including WebAssembly). */
+#if defined(__BMI2__) && !defined(NO_PEXT)
+#include <immintrin.h>
+#define USE_PEXT
+#endif
+
+typedef struct {
+    U64 mask;
+    U64 magic;
+    U64 *attacks;
+    int shift;
+} Magic;
+
+Magic rook_magics[64];
+Magic bishop_magics[64];
+
+// Every rook and bishop occupancy subset summed over all 64 squares
+U64 rook_table[102400];
+U64 bishop_table[5248];
+
+int rook_directions[4][2] = {{1, 0}, {0, 1}, {-1, 0}, {0, -1}};
+int bishop_directions[4][2] = {{1, 1}, {1, -1}, {-1, 1}, {-1, -1}};
+
+// Return the table index of an occupancy for a given square
+static inline unsigned magic_index(Magic *m, U64 occupancy)
 {
-    U64 moves = 0ULL;
-    U64 not_my_bb = ~my_bitboard(is_white, bitboards_ptr);
-    U64 opp_bb = opp_bitboard(is_white, bitboards_ptr);
-    U64 possible_move;
+#ifdef USE_PEXT
+    return (unsigned)_pext_u64(occupancy, m->mask);
+#else
+    return (unsigned)(((occupancy & m->mask) * m->magic) >> m->shift);
+#endif
+}
 
-    possible_move = start_pos;
-    while (possible_move) {
-        possible_move = (possible_move << 8) & not_my_bb & ~RANK_1;
-        moves = moves | possible_move;
-        if (possible_move & opp_bb) {
-            break;
+/* Walk each ray from a square one step at a time, stopping after the first occupied square.
+Only used to fill the lookup tables. */
+U64 sliding_attacks(int square, U64 occupancy, int directions[4][2])
+{
+    U64 attacks = 0ULL;
+    for (int d = 0; d < 4; d++) {
+        int r = square / 8 + directions[d][0];
+        int f = square % 8 + directions[d][1];
+        while (r >= 0 && r < 8 && f >= 0 && f < 8) {
+            U64 target = 1ULL << (r * 8 + f);
+            attacks = attacks | target;
+            if (occupancy & target) {
+                break;
+            }
+            r += directions[d][0];
+            f += directions[d][1];
         }
     }
-    possible_move = start_pos;
-    while (possible_move) {
-        possible_move = (possible_move >> 1) & not_my_bb & ~FILE_A;
-        moves = moves | possible_move;
-        if (possible_move & opp_bb) {
-            break;
+    return attacks;
+}
+
+// A small xorshift generator used for magic numbers and hash keys
+U64 random_u64(U64 *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+/* Fill the attack table of one slider type for every square. Magic numbers are found by trial
+with sparse random candidates; the search is deterministic and takes a few milliseconds. */
+void init_magics(Magic magics[64], U64 *table, int directions[4][2])
+{
+    U64 *attacks = table;
+#ifndef USE_PEXT
+    static U64 occupancies[4096], references[4096];
+    static int epochs[4096];
+    int epoch = 0;
+    U64 seed = 1070372ULL;
+#endif
+
+    for (int square = 0; square < 64; square++) {
+        Magic *m = &magics[square];
+        // Squares on the board edge never block, unless the slider stands on that edge
+        U64 edges = ((RANK_1 | RANK_8) & ~(RANK_1 << (8 * (square / 8))))
+                  | ((FILE_A | FILE_H) & ~(FILE_H << (square % 8)));
+        m->mask = sliding_attacks(square, 0ULL, directions) & ~edges;
+        m->shift = 64 - __builtin_popcountll(m->mask);
+        m->attacks = attacks;
+
+        // Enumerate all subsets of the mask with the carry-rippler trick
+        int size = 0;
+        U64 occupancy = 0ULL;
+        do {
+#ifdef USE_PEXT
+            m->attacks[_pext_u64(occupancy, m->mask)] = sliding_attacks(square, occupancy, directions);
+#else
+            occupancies[size] = occupancy;
+            references[size] = sliding_attacks(square, occupancy, directions);
+#endif
+            size++;
+            occupancy = (occupancy - m->mask) & m->mask;
+        } while (occupancy);
+        attacks += size;
+
+#ifndef USE_PEXT
+        for (int i = 0; i < size; ) {
+            do {
+                m->magic = random_u64(&seed) & random_u64(&seed) & random_u64(&seed);
+            } while (__builtin_popcountll((m->magic * m->mask) >> 56) < 6);
+            // A magic is good if no two occupancies with different attacks share an index
+            epoch++;
+            for (i = 0; i < size; i++) {
+                unsigned index = magic_index(m, occupancies[i]);
+                if (epochs[index] < epoch) {
+                    epochs[index] = epoch;
+                    m->attacks[index] = references[i];
+                } else if (m->attacks[index] != references[i]) {
+                    break;
+                }
+            }
         }
+#endif
     }
-    possible_move = start_pos;
-    while (possible_move) {
-        possible_move = (possible_move >> 8) & not_my_bb & ~RANK_8;
-        moves = moves | possible_move;
-        if (possible_move & opp_bb) {
-            break;
+}
+
+// Return a bitboard of all squares attacked by a rook on a square given the board occupancy
+U64 rook_attacks(int square, U64 occupancy)
+{
+    Magic *m = &rook_magics[square];
+    return m->attacks[magic_index(m, occupancy)];
+}
+
+// Return a bitboard of all squares attacked by a bishop on a square given the board occupancy
+U64 bishop_attacks(int square, U64 occupancy)
+{
+    Magic *m = &bishop_magics[square];
+    return m->attacks[magic_index(m, occupancy)];
+}
+
+// Return a bitboard of all squares attacked by a queen on a square given the board occupancy
+U64 queen_attacks(int square, U64 occupancy)
+{
+    return rook_attacks(square, occupancy) | bishop_attacks(square, occupancy);
+}
+
+// The leaper and line tables, which are written by native/gentables.c rather than filled at startup
+#include "attack_tables.h"
+
+// Build the lookup tables once, before any exported function can be called
+__attribute__((constructor)) void init_attack_tables()
+{
+    init_magics(rook_magics, rook_table, rook_directions);
+    init_magics(bishop_magics, bishop_table, bishop_directions);
+    for (int square = 0; square < 64; square++) {
+        castling_rights_mask[square] = ALL_CASTLING;
+    }
+    castling_rights_mask[0] &= ~WHITE_KINGSIDE;
+    castling_rights_mask[7] &= ~WHITE_QUEENSIDE;
+    castling_rights_mask[3] &= ~(WHITE_KINGSIDE | WHITE_QUEENSIDE);
+    castling_rights_mask[56] &= ~BLACK_KINGSIDE;
+    castling_rights_mask[63] &= ~BLACK_QUEENSIDE;
+    castling_rights_mask[59] &= ~(BLACK_KINGSIDE | BLACK_QUEENSIDE);
+
+    U64 seed = 0x5eed2c4e55ULL;
+    for (int piece = 0; piece < 12; piece++) {
+        for (int square = 0; square < 64; square++) {
+            zobrist_pieces[piece][square] = random_u64(&seed);
         }
     }
-    possible_move = start_pos;
-    while (possible_move) {
-        possible_move = (possible_move << 1) & not_my_bb & ~FILE_H;
-        moves = moves | possible_move;
-        if (possible_move & opp_bb) {
-            break;
+    for (int rights = 0; rights < 16; rights++) {
+        zobrist_castling[rights] = random_u64(&seed);
+    }
+    for (int file = 0; file < 8; file++) {
+        zobrist_en_passant[file] = random_u64(&seed);
+    }
+    zobrist_black_to_move = random_u64(&seed);
+}
+
+// Compute the Zobrist key of the current position from scratch
+U64 compute_zobrist_key(Position *pos)
+{
+    U64 key = zobrist_castling[pos->fen.castling_rights];
+    for (int piece = 0; piece < 12; piece++) {
+        U64 pieces = pos->bitboards[piece];
+        while (pieces) {
+            key ^= zobrist_pieces[piece][pop_lsb(&pieces)];
         }
     }
+    if (pos->fen.en_passant_square != NO_SQUARE) {
+        key ^= zobrist_en_passant[pos->fen.en_passant_square % 8];
+    }
+    if (pos->fen.active_color == 'b') {
+        key ^= zobrist_black_to_move;
+    }
+    return key;
+}
 
-    return moves;
+// Return the Zobrist key of the current position
+U64 get_zobrist_key(Position *pos)
+{
+    return pos->zobrist_key;
 }
 
-/* Given a start position, a color, and the current piece placement, return 
-a bitboard representing all pseudo-legal bishop moves. */
-U64 bishop_pattern(U64 start_pos, bool is_white, U64* bitboards_ptr)
+/* Return a bitboard of all pieces of either color attacking a square, given the occupancy
+used to block sliders. Each piece type is found by looking outward from the target square
+with that piece's own attack pattern. */
+U64 attackers_to(int square, U64 occupancy, U64 *bitboards_ptr)
 {
-    U64 moves = 0ULL;
-    U64 not_my_bb = ~my_bitboard(is_white, bitboards_ptr);
-    U64 opp_bb = opp_bitboard(is_white, bitboards_ptr);
-    U64 possible_move;
-    
-    possible_move = start_pos;
-    while (possible_move) {
-        possible_move = (possible_move << 7) & not_my_bb & ~FILE_A & ~RANK_1;
-        moves = moves | possible_move;
-        if (possible_move & opp_bb) {
-            break;
+    U64 diagonal = bitboards_ptr[WHITE_QUEEN] | bitboards_ptr[BLACK_QUEEN]
+                 | bitboards_ptr[WHITE_BISHOP] | bitboards_ptr[BLACK_BISHOP];
+    U64 straight = bitboards_ptr[WHITE_QUEEN] | bitboards_ptr[BLACK_QUEEN]
+                 | bitboards_ptr[WHITE_ROOK] | bitboards_ptr[BLACK_ROOK];
+
+    return (pawn_attacks[1][square] & bitboards_ptr[WHITE_PAWN])
+         | (pawn_attacks[0][square] & bitboards_ptr[BLACK_PAWN])
+         | (knight_attacks[square] & (bitboards_ptr[WHITE_KNIGHT] | bitboards_ptr[BLACK_KNIGHT]))
+         | (king_attacks[square] & (bitboards_ptr[WHITE_KING] | bitboards_ptr[BLACK_KING]))
+         | (bishop_attacks(square, occupancy) & diagonal)
+         | (rook_attacks(square, occupancy) & straight);
+}
+
+// Return true if a square is attacked by any piece of the given color
+bool is_square_attacked(int square, bool by_white, U64 *bitboards_ptr)
+{
+    U64 *bb = bitboards_ptr + (by_white ? WHITE_KING : BLACK_KING);
+    U64 occupancy = all_bitboard(bitboards_ptr);
+
+    // Cheapest tests first
+    return (pawn_attacks[by_white ? 1 : 0][square] & bb[WHITE_PAWN])
+        || (knight_attacks[square] & bb[WHITE_KNIGHT])
+        || (king_attacks[square] & bb[WHITE_KING])
+        || (bishop_attacks(square, occupancy) & (bb[WHITE_QUEEN] | bb[WHITE_BISHOP]))
+        || (rook_attacks(square, occupancy) & (bb[WHITE_QUEEN] | bb[WHITE_ROOK]));
+}
+
+/* Given a square, a color, and the current piece placement, return a bitboard representing
+all pseudo-legal king moves from the square, castling included. */
+U64 king_pattern(int square, bool is_white, Position *pos)
+{
+    U64 *bitboards_ptr = pos->bitboards;
+    U64 occupancy = all_bitboard(bitboards_ptr);
+    U64 moves = king_attacks[square] & ~my_bitboard(is_white, bitboards_ptr);
+
+    // Castling, which is not allowed out of, through, or into check
+    if (is_white) {
+        if ((pos->fen.castling_rights & WHITE_KINGSIDE) && !(occupancy & 0x6ULL)
+            && !is_square_attacked(3, false, bitboards_ptr) && !is_square_attacked(2, false, bitboards_ptr)
+            && !is_square_attacked(1, false, bitboards_ptr)) {
+            moves |= SQUARE_BB(1);
         }
-    }
-    possible_move = start_pos;
-    while (possible_move) {
-        possible_move = (possible_move >> 9) & not_my_bb & ~FILE_A & ~RANK_8;
-        moves = moves | possible_move;
-        if (possible_move & opp_bb) {
-            break;
+        if ((pos->fen.castling_rights & WHITE_QUEENSIDE) && !(occupancy & 0x70ULL)
+            && !is_square_attacked(3, false, bitboards_ptr) && !is_square_attacked(4, false, bitboards_ptr)
+            && !is_square_attacked(5, false, bitboards_ptr)) {
+            moves |= SQUARE_BB(5);
         }
     }
-    possible_move = start_pos;
-    while (possible_move) {
-        possible_move = (possible_move >> 7) & not_my_bb & ~FILE_H & ~RANK_8;
-        moves = moves | possible_move;
-        if (possible_move & opp_bb) {
-            break;
+    // Black
+    else {
+        if ((pos->fen.castling_rights & BLACK_KINGSIDE) && !(occupancy & 0x0600000000000000ULL)
+            && !is_square_attacked(59, true, bitboards_ptr) && !is_square_attacked(58, true, bitboards_ptr)
+            && !is_square_attacked(57, true, bitboards_ptr)) {
+            moves |= SQUARE_BB(57);
         }
-    }
-    possible_move = start_pos;
-    while (possible_move) {
-        possible_move = (possible_move << 9) & not_my_bb & ~FILE_H & ~RANK_1;
-        moves = moves | possible_move;
-        if (possible_move & opp_bb) {
-            break;
+        if ((pos->fen.castling_rights & BLACK_QUEENSIDE) && !(occupancy & 0x7000000000000000ULL)
+            && !is_square_attacked(59, true, bitboards_ptr) && !is_square_attacked(60, true, bitboards_ptr)
+            && !is_square_attacked(61, true, bitboards_ptr)) {
+            moves |= SQUARE_BB(61);
         }
     }
 
     return moves;
 }
 
-/* Given a start position, a color, and the current piece placement, return 
-a bitboard representing all pseudo-legal knight moves. */
-U64 knight_pattern(U64 start_pos, bool is_white, U64* bitboards_ptr)
+/* Given a square, a color, and the current piece placement, return a bitboard representing
+all pseudo-legal queen moves from the square. */
+U64 queen_pattern(int square, bool is_white, U64* bitboards_ptr)
 {
-    U64 moves = 0ULL;
-    U64 not_my_bb = ~my_bitboard(is_white, bitboards_ptr);
+    return queen_attacks(square, all_bitboard(bitboards_ptr)) & ~my_bitboard(is_white, bitboards_ptr);
+}
 
-    moves = moves | ((start_pos << 15) & not_my_bb & ~FILE_A);
-    moves = moves | ((start_pos <<  6) & not_my_bb & ~FILE_A & ~FILE_B);
-    moves = moves | ((start_pos >> 10) & not_my_bb & ~FILE_A & ~FILE_B);
-    moves = moves | ((start_pos >> 17) & not_my_bb & ~FILE_A);
-    moves = moves | ((start_pos >> 15) & not_my_bb & ~FILE_H);
-    moves = moves | ((start_pos >>  6) & not_my_bb & ~FILE_H & ~FILE_G);
-    moves = moves | ((start_pos << 10) & not_my_bb & ~FILE_H & ~FILE_G);
-    moves = moves | ((start_pos << 17) & not_my_bb & ~FILE_H);
+/* Given a square, a color, and the current piece placement, return a bitboard representing
+all pseudo-legal rook moves from the square. */
+U64 rook_pattern(int square, bool is_white, U64* bitboards_ptr)
+{
+    return rook_attacks(square, all_bitboard(bitboards_ptr)) & ~my_bitboard(is_white, bitboards_ptr);
+}
 
-    return moves;
+/* Given a square, a color, and the current piece placement, return a bitboard representing
+all pseudo-legal bishop moves from the square. */
+U64 bishop_pattern(int square, bool is_white, U64* bitboards_ptr)
+{
+    return bishop_attacks(square, all_bitboard(bitboards_ptr)) & ~my_bitboard(is_white, bitboards_ptr);
 }
 
-/* Given a start position, a color, and the current piece placement, return 
-a bitboard representing all pseudo-legal king moves. */
-U64 pawn_pattern(U64 start_pos, bool is_white, U64* bitboards_ptr)
+/* Given a square, a color, and the current piece placement, return a bitboard representing
+all pseudo-legal knight moves from the square. */
+U64 knight_pattern(int square, bool is_white, U64* bitboards_ptr)
 {
-    U64 moves = 0ULL;
-    U64 opp_bb = opp_bitboard(is_white, bitboards_ptr);
-    U64 ep_target = an_to_bitboard(fen.en_passant_target);
-    U64 forward_and_to_left;
-    U64 forward_and_to_right;
+    return knight_attacks[square] & ~my_bitboard(is_white, bitboards_ptr);
+}
+
+/* Given a square, a color, and the current piece placement, return a bitboard representing
+all pseudo-legal pawn moves from the square, en passant included. */
+U64 pawn_pattern(int square, bool is_white, Position *pos)
+{
+    U64 *bitboards_ptr = pos->bitboards;
+    U64 empty = ~all_bitboard(bitboards_ptr);
+    U64 ep_target = pos->fen.en_passant_square == NO_SQUARE ? 0ULL : SQUARE_BB(pos->fen.en_passant_square);
+    U64 moves = pawn_attacks[is_white ? 0 : 1][square] & (opp_bitboard(is_white, bitboards_ptr) | ep_target);
+    U64 push;
 
+    // One square forward, and two from the starting rank
     if (is_white) {
-        if (unoccupied_square(start_pos << 8, bitboards_ptr)) {
-            moves = moves | (start_pos << 8);
-            if (rank(start_pos) == 2 && unoccupied_square(start_pos << 16, bitboards_ptr)) {
-                moves = moves | (start_pos << 16);
-            }
-        }
-        forward_and_to_left = start_pos << 9;
-        forward_and_to_right = start_pos << 7;
-        if ((opp_bb | ep_target) & (forward_and_to_left & ~FILE_H)) {
-            moves = moves | forward_and_to_left;
-        }
-        if ((opp_bb | ep_target) & (forward_and_to_right & ~FILE_A)) {
-            moves = moves | forward_and_to_right;
+        push = (SQUARE_BB(square) << 8) & empty;
+        if (SQUARE_RANK(square) == 1) {
+            push |= (push << 8) & empty;
         }
     }
     else {
-        if (unoccupied_square(start_pos >> 8, bitboards_ptr)) {
-            moves = moves | (start_pos >> 8);
-            if (rank(start_pos) == 7 && unoccupied_square(start_pos >> 16, bitboards_ptr)) {
-                moves = moves | (start_pos >> 16);
-            }
-        }
-        forward_and_to_left = start_pos >> 9;
-        forward_and_to_right = start_pos >> 7;
-        if ((opp_bb | ep_target) & (forward_and_to_left & ~FILE_A)) {
-            moves = moves | forward_and_to_left;
-        }
-        if ((opp_bb | ep_target) & (forward_and_to_right & ~FILE_H)) {
-            moves = moves | forward_and_to_right;
+        push = (SQUARE_BB(square) >> 8) & empty;
+        if (SQUARE_RANK(square) == 6) {
+            push |= (push >> 8) & empty;
         }
     }
 
-    return moves;
+    return moves | push;
 }
 
-// return true if I'm checked
+// Return true if my king is attacked
 bool am_i_checked(U64 *bitboards_ptr, bool is_white) {
-    U64 single_pos = 1ULL;
-    U64 opp_bb = opp_bitboard(is_white, bitboards_ptr);
-    U64 king_bb;
-    if (is_white) {
-        king_bb = bitboards_ptr[WHITE_KING];
-    } else {
-        king_bb = bitboards_ptr[BLACK_KING];
-    }
-    // king algebraic notation string
-    char king_an[3];
-    strcpy(king_an, bitboard_to_an(king_bb));
-    for (int i=0; i< 64; i++) {
-        if (single_pos & opp_bb) {
-            // moves algebraic notation string
-            char *moves_an = find_moves(bitboard_to_an(single_pos), bitboards_ptr, false);
-            // check if moves algebraic notation string contains king algebraic notation string
-            if (strstr(moves_an, king_an) != NULL) {
-                return true;
-            }
-        }
-        single_pos = single_pos << 1;
+    U64 king_bb = bitboards_ptr[is_white ? WHITE_KING : BLACK_KING];
+    if (!king_bb) {
+        return false;
     }
-    return false;
+    return is_square_attacked(__builtin_ctzll(king_bb), !is_white, bitboards_ptr);
 }
 
-// Return true if I'm checkmated
-bool detect_checkmate(bool is_white) {
-    U64 my_bb = my_bitboard(is_white, bitboards);
-    U64 single_pos = 1ULL;
-    char *moves_ptr;
-    char *local_an;
-    for (int i=0; i<64; i++) {
-        if (my_bb & single_pos) {
-            strcpy(local_an, bitboard_to_an(single_pos));
-            moves_ptr = find_moves(local_an, bitboards, true);
-            if (moves_ptr[0]) {
-                return false;
-            }
-        }
-        single_pos = single_pos << 1;
+// Add or remove a piece's material and square bonus and its weight in the game phase
+static inline void add_eval_piece(Eval_Terms *eval, int piece, int square)
+{
+    eval->middlegame += middlegame_table[piece][square];
+    eval->endgame += endgame_table[piece][square];
+    eval->phase += phase_weights[piece];
+}
+
+static inline void remove_eval_piece(Eval_Terms *eval, int piece, int square)
+{
+    eval->middlegame -= middlegame_table[piece][square];
+    eval->endgame -= endgame_table[piece][square];
+    eval->phase -= phase_weights[piece];
+}
+
+/* Account for a piece do_move puts on or takes off the board: in the evaluation terms, and in
+the accumulator stack of a position evaluated by the network */
+static inline void put_piece_terms(Position *pos, int piece, int square)
+{
+    add_eval_piece(&pos->eval, piece, square);
+    if (pos->nnue) {
+        Nnue_Accumulator *entry = &pos->nnue[pos->undo_count];
+        entry->added_piece[entry->added_count] = piece;
+        entry->added_square[entry->added_count++] = square;
     }
-    return true;
 }
 
-// Return pawn's position if a pawn needs promotion
-char *detect_pawn_promotion() {
-    U64 pawn_promotion_bb = ((bitboards[WHITE_PAWN] & RANK_8) | (bitboards[BLACK_PAWN] & RANK_1));
-    if (pawn_promotion_bb) {
-        return bitboard_to_an(pawn_promotion_bb);
+static inline void take_piece_terms(Position *pos, int piece, int square)
+{
+    remove_eval_piece(&pos->eval, piece, square);
+    if (pos->nnue) {
+        Nnue_Accumulator *entry = &pos->nnue[pos->undo_count];
+        entry->removed_piece[entry->removed_count] = piece;
+        entry->removed_square[entry->removed_count++] = square;
     }
-    return NULL;
 }
 
-// Promote a pawn and return the fen string
-char *promote_pawn(char *pawn_pos, int piece_number) {
-    // Convert pawn_pos to bitboard
-    U64 pawn_pos_bb = an_to_bitboard(pawn_pos);
-    // Remove pawn_pos_bb from both pawn bitboards
-    bitboards[WHITE_PAWN] = bitboards[WHITE_PAWN] & ~pawn_pos_bb;
-    bitboards[BLACK_PAWN] = bitboards[BLACK_PAWN] & ~pawn_pos_bb;
-    // Add the promoted piece to its bitboard
-    bitboards[piece_number] = bitboards[piece_number] | pawn_pos_bb;
-    // Update the fen string and return it
-    update_piece_placement();
-    return stringify_fen();
-}
-
-/* Convert multiple moves from bitboard representation to algebraic notation, prevent self checks at 
-depth zero, and store in moves_ptr */
-void update_moves(U64 bitboard, char *start_pos, bool is_white, bool check_for_checks) {
-    char *moves_ptr;
-    // if we are checking for self checks then we are at depth zero and will use the primary moves array
-    if (check_for_checks) {
-        moves_ptr = primary_moves_arr;
-    /* otherwise we are at depth one and will use the secondary moves array so as not to overwrite the 
-    primary moves array */
+/* Make a move on the bitboards and fen in place, pushing an undo record. The move must be
+pseudo-legal for the piece on its start square. */
+void do_move(Position *pos, Move move)
+{
+    Undo *undo = &pos->undo_stack[pos->undo_count++];
+    int from = MOVE_FROM(move);
+    int to = MOVE_TO(move);
+    int flags = MOVE_FLAGS(move);
+    U64 from_bb = 1ULL << from;
+    U64 to_bb = 1ULL << to;
+    int piece = piece_at(pos, from);
+    bool is_white = piece < 6;
+    int captured_piece = NO_PIECE;
+
+    undo->move = move;
+    undo->castling_rights = pos->fen.castling_rights;
+    undo->en_passant_square = pos->fen.en_passant_square;
+    undo->halfmove_clock = pos->fen.halfmove_clock;
+    undo->zobrist_key = pos->zobrist_key;
+    undo->eval = pos->eval;
+    // Castling and en passant change no other rank than those of the start and end squares
+    pos->stale_ranks |= 1 << SQUARE_RANK(from) | 1 << SQUARE_RANK(to);
+    if (pos->nnue) {
+        Nnue_Accumulator *entry = &pos->nnue[pos->undo_count];
+        entry->computed[0] = entry->computed[1] = false;
+        entry->refresh = false;
+        entry->added_count = entry->removed_count = 0;
+    }
+
+    // Remove any captured piece
+    if (flags == EN_PASSANT) {
+        captured_piece = is_white ? BLACK_PAWN : WHITE_PAWN;
+        pos->bitboards[captured_piece] &= ~(is_white ? to_bb >> 8 : to_bb << 8);
+        pos->piece_on[is_white ? to - 8 : to + 8] = NO_PIECE;
+        pos->zobrist_key ^= zobrist_pieces[captured_piece][is_white ? to - 8 : to + 8];
+        take_piece_terms(pos, captured_piece, is_white ? to - 8 : to + 8);
+    }
+    else if (IS_CAPTURE(move)) {
+        captured_piece = piece_at(pos, to);
+        pos->bitboards[captured_piece] &= ~to_bb;
+        pos->zobrist_key ^= zobrist_pieces[captured_piece][to];
+        take_piece_terms(pos, captured_piece, to);
+    }
+    undo->captured_piece = captured_piece;
+
+    // Move the piece, replacing a promoted pawn
+    pos->bitboards[piece] &= ~from_bb;
+    pos->piece_on[from] = NO_PIECE;
+    pos->zobrist_key ^= zobrist_pieces[piece][from];
+    take_piece_terms(pos, piece, from);
+    if (IS_PROMOTION(move)) {
+        int promoted_piece = PROMOTION_PIECE(move) + (is_white ? 0 : 6);
+        pos->bitboards[promoted_piece] |= to_bb;
+        pos->piece_on[to] = promoted_piece;
+        pos->zobrist_key ^= zobrist_pieces[promoted_piece][to];
+        put_piece_terms(pos, promoted_piece, to);
     } else {
-        moves_ptr = secondary_moves_arr;
-    }
-    int moves_ptr_index = 0;
-    U64 single_pos = 1ULL;
-    U64 local_bitboards[12];
-    Fen local_fen;
-    char file;
-    char rank;
-    for (int i = 0; i < 64; i++) {
-        if (bitboard & single_pos) {
-            // Determine File
-            file = ('h' - (i % 8));
-            // Determine Rank
-            rank = ((i / 8) + '1');
-            char end_pos[] = {file, rank, '\0'};
-            // Copy bitboards and fen to local variables
-            memcpy(local_bitboards, bitboards, sizeof(bitboards));
-            *(local_fen.piece_placement) = *(fen.piece_placement);
-            local_fen.active_color = fen.active_color;
-            *(local_fen.castling_availability) = *(fen.castling_availability);
-            *(local_fen.en_passant_target) = *(fen.en_passant_target);
-            local_fen.halfmove_clock = fen.halfmove_clock;
-            local_fen.fullmove_number = fen.fullmove_number;
-            // Make the move on our local copy of the bitboards
-            process_move(start_pos, end_pos, local_bitboards, &local_fen);
-            // Prevent self-check
-            if (check_for_checks) {
-                // Detect if I'm checked on the local bitboards instance
-                if (!am_i_checked(local_bitboards, is_white)) {
-                    // Assign File
-                    moves_ptr[moves_ptr_index] = file;
-                    moves_ptr_index++;
-                    // Assign Rank
-                    moves_ptr[moves_ptr_index] = rank;
-                    moves_ptr_index++;
-                }
-            } else {
-                // Assign File
-                moves_ptr[moves_ptr_index] = file;
-                moves_ptr_index++;
-                // Assign Rank
-                moves_ptr[moves_ptr_index] = rank;
-                moves_ptr_index++;
-            }
-        }
-        single_pos = single_pos << 1;
-    }
-    // Null terminate the end of the array
-    moves_ptr[moves_ptr_index] = '\0';
-}
-
-// Read bitboards, determine piece placement, and store it in fen.pieceplacement
-void update_piece_placement() {
-    // A bitboard with a single occupied square that will be bitshifted down to 1
-    U64 square = 1ULL << 63;
-    char result[74];
-    int result_index = 0;
-    // A rolling count of each blank square
-    int blank_count = 0;
-
-    // Iterate through 8 rows
-    for (int i=0; i<8; i++) {
-        blank_count = 0;
-        // Iterate through 8 squares in a row
-        for (int j=0; j<8; j++) {
-            // Iterate through each type of piece
-            for (int k=0; k<12; k++) {
-                if (bitboards[k] & square) {
-                    // check for previous blank squares
-                    if (blank_count != 0) {
-                        result[result_index] = '0' + blank_count;
-                        result_index++;
-                        blank_count = 0;
-                    }
-                    result[result_index] = fen_lookup[k];
-                    result_index++;
-                    break;
-                }
-                // Increase blank count if square is unoccupied
-                else if (k == 11) {
-                    blank_count++;
-                }
-            }
-            // Bitshift down to the next square
-            square = square >> 1;
-        }
-        // Check for blank spaces at the end of the row and add them to the result
-        if (blank_count != 0) {
-            result[result_index] = '0' + blank_count;
-            result_index++;
-        }
-        // Add slashes to denote a new row
-        result[result_index] = '/';
-        result_index++;
+        pos->bitboards[piece] |= to_bb;
+        pos->piece_on[to] = piece;
+        pos->zobrist_key ^= zobrist_pieces[piece][to];
+        put_piece_terms(pos, piece, to);
+    }
+
+    // Move the rook when castling
+    if (flags == KING_CASTLE) {
+        pos->bitboards[piece + 2] = (pos->bitboards[piece + 2] & ~(to_bb >> 1)) | (to_bb << 1);
+        pos->piece_on[to - 1] = NO_PIECE;
+        pos->piece_on[to + 1] = piece + 2;
+        pos->zobrist_key ^= zobrist_pieces[piece + 2][to - 1] ^ zobrist_pieces[piece + 2][to + 1];
+        take_piece_terms(pos, piece + 2, to - 1);
+        put_piece_terms(pos, piece + 2, to + 1);
     }
-    // Terminate string at last slash
-    result[result_index-1] = 0;
-    // Copy result to fen.piece_placement
-    strcpy(fen.piece_placement, result);
+    else if (flags == QUEEN_CASTLE) {
+        pos->bitboards[piece + 2] = (pos->bitboards[piece + 2] & ~(to_bb << 2)) | (to_bb >> 1);
+        pos->piece_on[to + 2] = NO_PIECE;
+        pos->piece_on[to - 1] = piece + 2;
+        pos->zobrist_key ^= zobrist_pieces[piece + 2][to + 2] ^ zobrist_pieces[piece + 2][to - 1];
+        take_piece_terms(pos, piece + 2, to + 2);
+        put_piece_terms(pos, piece + 2, to - 1);
+    }
+
+    pos->zobrist_key ^= zobrist_castling[pos->fen.castling_rights];
+    pos->fen.castling_rights &= castling_rights_mask[from] & castling_rights_mask[to];
+    pos->zobrist_key ^= zobrist_castling[pos->fen.castling_rights];
+    if (pos->fen.en_passant_square != NO_SQUARE) {
+        pos->zobrist_key ^= zobrist_en_passant[pos->fen.en_passant_square % 8];
+    }
+    pos->fen.en_passant_square = flags == DOUBLE_PAWN_PUSH ? (from + to) / 2 : NO_SQUARE;
+    if (pos->fen.en_passant_square != NO_SQUARE) {
+        pos->zobrist_key ^= zobrist_en_passant[pos->fen.en_passant_square % 8];
+    }
+    if (piece % 6 == 5 || captured_piece != NO_PIECE) {
+        pos->fen.halfmove_clock = 0;
+    } else {
+        pos->fen.halfmove_clock++;
+    }
+    if (!is_white) {
+        pos->fen.fullmove_number++;
+    }
+    pos->fen.active_color = is_white ? 'b' : 'w';
+    pos->zobrist_key ^= zobrist_black_to_move;
+
+#ifdef DEBUG
+    assert(pos->zobrist_key == compute_zobrist_key(pos));
+    assert(eval_terms_match(pos));
+    assert(mailbox_matches(pos));
+#endif
 }
 
-/* Receive the start position in algebraic notation, a pointer to the bitboards representing our 
-piece placement, a boolean representing whether to prevent self-checks, and return a pointer to all
-legal moves in algebraic notation. */
-char *find_moves(char start_pos[], U64* bitboards_ptr, bool check_for_checks) 
+// Take back the last move made by do_move
+void undo_move(Position *pos)
 {
-    U64 moves;
-    bool is_white;
-    char *moves_ptr;
+    Undo *undo = &pos->undo_stack[--pos->undo_count];
+    Move move = undo->move;
+    int from = MOVE_FROM(move);
+    int to = MOVE_TO(move);
+    int flags = MOVE_FLAGS(move);
+    U64 from_bb = 1ULL << from;
+    U64 to_bb = 1ULL << to;
+    int piece = piece_at(pos, to);
+    bool is_white = piece < 6;
+
+    pos->stale_ranks |= 1 << SQUARE_RANK(from) | 1 << SQUARE_RANK(to);
 
-    if (!bitboards_ptr) {
-        bitboards_ptr = bitboards;
+    // Put the piece back, turning a promoted piece back into a pawn
+    pos->bitboards[piece] &= ~to_bb;
+    pos->piece_on[to] = NO_PIECE;
+    if (IS_PROMOTION(move)) {
+        piece = is_white ? WHITE_PAWN : BLACK_PAWN;
     }
+    pos->bitboards[piece] |= from_bb;
+    pos->piece_on[from] = piece;
 
-    /* If we are checking for self checks, then we are at depth zero and will use 
-    the primary moves pointer */
-    if (check_for_checks) {
-        moves_ptr = primary_moves_arr;
-    /* Otherwise we are at depth one and need to use the secondary moves pointer so
-    as not to overwrite the primary */
-    } else {
-        moves_ptr = secondary_moves_arr;
+    // Put the rook back when castling
+    if (flags == KING_CASTLE) {
+        pos->bitboards[piece + 2] = (pos->bitboards[piece + 2] & ~(to_bb << 1)) | (to_bb >> 1);
+        pos->piece_on[to + 1] = NO_PIECE;
+        pos->piece_on[to - 1] = piece + 2;
+    }
+    else if (flags == QUEEN_CASTLE) {
+        pos->bitboards[piece + 2] = (pos->bitboards[piece + 2] & ~(to_bb >> 1)) | (to_bb << 2);
+        pos->piece_on[to - 1] = NO_PIECE;
+        pos->piece_on[to + 2] = piece + 2;
     }
-    // Empty contents of moves_ptr
-    memset(moves_ptr, '\0', 43);
 
-    U64 start_pos_bb = an_to_bitboard(start_pos);
-    for (int i = 0; i < 12; i++) {
-        if (start_pos_bb & bitboards_ptr[i]) {
-            // Determine Color
-            if (i < 6) {
-                is_white = true;
-            } else {
-                is_white = false;
-            }
-            // Determine Piece
-            switch(i % 6) {
-                // King
-                case 0:
-                    moves = king_pattern(start_pos_bb, is_white, bitboards_ptr);
-                    update_moves(moves, start_pos, is_white, check_for_checks);
-                    break;
-                // Queen
-                case 1:
-                    moves = queen_pattern(start_pos_bb, is_white, bitboards_ptr);
-                    update_moves(moves, start_pos, is_white, check_for_checks);
-                    break;
-                // Rook
-                case 2:
-                    moves = rook_pattern(start_pos_bb, is_white, bitboards_ptr);
-                    update_moves(moves, start_pos, is_white, check_for_checks);
-                    break;
-                // Bishop
-                case 3:
-                    moves = bishop_pattern(start_pos_bb, is_white, bitboards_ptr);
-                    update_moves(moves, start_pos, is_white, check_for_checks);
-                    break;
-                // Knight
-                case 4:
-                    moves = knight_pattern(start_pos_bb, is_white, bitboards_ptr);
-                    update_moves(moves, start_pos, is_white, check_for_checks);
-                    break;
-                // Pawn
-                case 5:
-                    moves = pawn_pattern(start_pos_bb, is_white, bitboards_ptr);
-                    update_moves(moves, start_pos, is_white, check_for_checks);
-                    break;
-                // Default
-                default:
-                    memset(moves_ptr, '\0', 43);
+    // Restore any captured piece
+    if (flags == EN_PASSANT) {
+        pos->bitboards[undo->captured_piece] |= is_white ? to_bb >> 8 : to_bb << 8;
+        pos->piece_on[is_white ? to - 8 : to + 8] = undo->captured_piece;
+    }
+    else if (undo->captured_piece != NO_PIECE) {
+        pos->bitboards[undo->captured_piece] |= to_bb;
+        pos->piece_on[to] = undo->captured_piece;
+    }
+
+    pos->fen.castling_rights = undo->castling_rights;
+    pos->fen.en_passant_square = undo->en_passant_square;
+    pos->fen.halfmove_clock = undo->halfmove_clock;
+    pos->zobrist_key = undo->zobrist_key;
+    pos->eval = undo->eval;
+    if (!is_white) {
+        pos->fen.fullmove_number--;
+    }
+    pos->fen.active_color = is_white ? 'w' : 'b';
+#ifdef DEBUG
+    assert(mailbox_matches(pos));
+#endif
+}
+
+// Append a legal move to move_list and return the new count. Debug builds make it to check that.
+static inline int add_move(Position *pos, bool is_white, Move move, Move *move_list, int count)
+{
+#ifdef DEBUG
+    do_move(pos, move);
+    assert(!am_i_checked(pos->bitboards, is_white));
+    undo_move(pos);
+#endif
+    move_list[count] = move;
+    return count + 1;
+}
+
+/* Return true if taking en passant from one square to another leaves the king safe. Taking
+removes two pawns from one rank, which can uncover an attack no pin mask sees, so the board is
+simply looked at from the king as it would be after the capture. */
+static bool is_en_passant_legal(Position *pos, bool is_white, int king, int from, int to)
+{
+    U64 captured_bb = SQUARE_BB(is_white ? to - 8 : to + 8);
+    U64 occupancy = all_bitboard(pos->bitboards) ^ SQUARE_BB(from) ^ captured_bb ^ SQUARE_BB(to);
+    U64 attackers = opp_bitboard(is_white, pos->bitboards) & ~captured_bb;
+
+    return king == NO_SQUARE || !(attackers_to(king, occupancy, pos->bitboards) & attackers);
+}
+
+/* Fill move_list with the legal moves for one side that start on a square of from_mask and end
+on a square of to_mask, stopping once there are limit of them, and return the number of moves.
+The pieces giving check and the pieces pinned to the king are found once, and each piece's
+pseudo-legal targets are cut down to the legal ones: a single check must be captured or
+blocked, a pinned piece stays on the line of its pin, and the king steps only onto squares no
+enemy attacks once it has left its own. */
+static int generate_moves_upto(Position *pos, bool is_white, U64 from_mask, U64 to_mask, Move *move_list, int limit)
+{
+    U64 *bitboards_ptr = pos->bitboards;
+    U64 opp_bb = opp_bitboard(is_white, bitboards_ptr);
+    U64 occupancy = all_bitboard(bitboards_ptr);
+    U64 ep_target = pos->fen.en_passant_square == NO_SQUARE ? 0ULL : 1ULL << pos->fen.en_passant_square;
+    int first = is_white ? WHITE_KING : BLACK_KING;
+    int opp_first = is_white ? BLACK_KING : WHITE_KING;
+    U64 king_bb = bitboards_ptr[first];
+    int king = king_bb ? __builtin_ctzll(king_bb) : NO_SQUARE;
+    // The squares pieces other than the king may move to, all of them unless in check
+    U64 check_mask = ~0ULL;
+    U64 pinned = 0;
+    int count = 0;
+
+    if (king_bb) {
+        U64 opp_straight = bitboards_ptr[opp_first + 1] | bitboards_ptr[opp_first + 2];
+        U64 opp_diagonal = bitboards_ptr[opp_first + 1] | bitboards_ptr[opp_first + 3];
+        U64 checkers = attackers_to(king, occupancy, bitboards_ptr) & opp_bb;
+        // Sliders that would attack the king if our own pieces were out of the way
+        U64 snipers = (rook_attacks(king, opp_bb) & opp_straight) | (bishop_attacks(king, opp_bb) & opp_diagonal);
+
+        if (checkers) {
+            // Only the king can answer a double check
+            check_mask = checkers & (checkers - 1) ? 0 : checkers | between_bb[king][__builtin_ctzll(checkers)];
+        }
+        while (snipers) {
+            U64 blockers = between_bb[king][pop_lsb(&snipers)] & occupancy;
+            if (blockers && !(blockers & (blockers - 1))) {
+                pinned |= blockers;
             }
         }
     }
-    return moves_ptr;
-}
 
-// Take start and end position of move and use it to update bitboards_arr, all of fen_ptr except piece_placement
-void process_move(char start_pos[], char end_pos[], U64 bitboards_arr[], Fen* fen_ptr) {
-    bool is_white;
-    int piece_type;
+    for (int piece = first; piece < first + 6; piece++) {
+        U64 pieces = bitboards_ptr[piece] & from_mask;
+        while (pieces) {
+            int from = pop_lsb(&pieces);
+            U64 targets;
 
-    U64 start_pos_bb = an_to_bitboard(start_pos);
-    U64 end_pos_bb = an_to_bitboard(end_pos);
-    for (int i = 0; i < 12; i++) {
-        if (start_pos_bb & bitboards_arr[i]) {
-            // Determine Color
-            if (i < 6) {
-                is_white = true;
-            } else {
-                is_white = false;
+            switch (piece - first) {
+                case 0: targets = king_pattern(from, is_white, pos); break;
+                case 1: targets = queen_pattern(from, is_white, bitboards_ptr); break;
+                case 2: targets = rook_pattern(from, is_white, bitboards_ptr); break;
+                case 3: targets = bishop_pattern(from, is_white, bitboards_ptr); break;
+                case 4: targets = knight_pattern(from, is_white, bitboards_ptr); break;
+                default: targets = pawn_pattern(from, is_white, pos); break;
             }
-            // Determine Piece Type
-            piece_type = i % 6;
-
-            // Queen, Rook, Bishop, and Knight
-            if (piece_type>0 && piece_type<5) {
-                // And the bitwise complement of our start position to our bitboard to remove it from start position
-                bitboards_arr[i] = bitboards_arr[i] & ~start_pos_bb;
-                // And the bitwise complement of our end position to each bitboard to remove any captured piece
-                for (int j = 0; j < 12; j++) {
-                    bitboards_arr[j] = bitboards_arr[j] & ~end_pos_bb;
-                }
-                // Or the end position to our bitboard to add it to the end position
-                bitboards_arr[i] = bitboards_arr[i] | end_pos_bb;
-                // Update En Passant target
-                strcpy((*fen_ptr).en_passant_target, "-");
-                // Update castling availability
-                if (piece_type == 2) {
-                    if (start_pos_bb == 1ULL) {
-                        remove_chars((*fen_ptr).castling_availability, 'K');
-                    }
-                    else if (start_pos_bb == 128ULL) {
-                        remove_chars((*fen_ptr).castling_availability, 'Q');
-                    }
-                    else if (start_pos_bb == 72057594037927936ULL) {
-                        remove_chars((*fen_ptr).castling_availability, 'k');
-                    }
-                    else if (start_pos_bb == 9223372036854775808ULL) {
-                        remove_chars((*fen_ptr).castling_availability, 'q');
+            targets &= to_mask;
+
+            if (piece == first) {
+                // Castling squares are checked by king_pattern, and every step is checked here
+                U64 steps = targets & king_attacks[from];
+                targets &= ~king_attacks[from];
+                while (steps) {
+                    int to = pop_lsb(&steps);
+                    if (!(attackers_to(to, occupancy ^ king_bb, bitboards_ptr) & opp_bb)) {
+                        targets |= SQUARE_BB(to);
                     }
                 }
             }
-            // King
-            else if (piece_type == 0) {
-                // Castling
-                // King side castling
-                if (start_pos_bb >> 2 == end_pos_bb) {
-                    // Remove rook
-                    bitboards_arr[i+2] = bitboards_arr[i+2] & ~(end_pos_bb >> 1);
-                    // Add rook
-                    bitboards_arr[i+2] = bitboards_arr[i+2] | (end_pos_bb << 1);
-                }
-                // Queen side castling
-                else if (start_pos_bb << 2 == end_pos_bb) {
-                    // Remove rook
-                    bitboards_arr[i+2] = bitboards_arr[i+2] & ~(end_pos_bb << 2);
-                    // Add rook
-                    bitboards_arr[i+2] = bitboards_arr[i+2] | (end_pos_bb >> 1);
-                }
-                // And the bitwise complement of our start position to our bitboard to remove it from start position
-                bitboards_arr[i] = bitboards_arr[i] & ~start_pos_bb;
-                // And the bitwise complement of our end position to each bitboard to remove any captured piece
-                for (int j = 0; j < 12; j++) {
-                    bitboards_arr[j] = bitboards_arr[j] & ~end_pos_bb;
-                }
-                // Or the end position to our bitboard to add it to the end position
-                bitboards_arr[i] = bitboards_arr[i] | end_pos_bb;
-                // Update castling availability
-                if (is_white) {
-                    remove_chars((*fen_ptr).castling_availability, 'K');
-                    remove_chars((*fen_ptr).castling_availability, 'Q');
+            else {
+                U64 en_passant = piece - first == 5 ? targets & ep_target : 0;
+                targets &= check_mask & ~en_passant;
+                if (pinned & SQUARE_BB(from)) {
+                    targets &= line_bb[king][from];
                 }
-                else {
-                    remove_chars((*fen_ptr).castling_availability, 'k');
-                    remove_chars((*fen_ptr).castling_availability, 'q');
+                if (en_passant && is_en_passant_legal(pos, is_white, king, from, pos->fen.en_passant_square)) {
+                    targets |= en_passant;
                 }
-                // Update En Passant target
-                strcpy((*fen_ptr).en_passant_target, "-");
             }
-            // Pawn
-            else if (piece_type == 5) {
-                // Non-capture
-                if (file(start_pos_bb) == file(end_pos_bb)) {
-                    // And the bitwise complement of our start position to our bitboard to remove it from start position
-                    bitboards_arr[i] = bitboards_arr[i] & ~start_pos_bb;
-                    // Or the end position to our bitboard to add it to the end position
-                    bitboards_arr[i] = bitboards_arr[i] | end_pos_bb;
-                    // Pawn double move
-                    // White
-                    if ((start_pos_bb << 16) == end_pos_bb) {
-                        // Update En Passant target
-                        strcpy((*fen_ptr).en_passant_target, bitboard_to_an(start_pos_bb << 8));
-                    } 
-                    // Black
-                    else if ((start_pos_bb >> 16) == end_pos_bb) {
-                        // Update En Passant target
-                        strcpy((*fen_ptr).en_passant_target, bitboard_to_an(start_pos_bb >> 8));
-                    }
-                    else {
-                        // Update En Passant target
-                        strcpy((*fen_ptr).en_passant_target, "-");
+
+            while (targets) {
+                int to = pop_lsb(&targets);
+                U64 to_bb = SQUARE_BB(to);
+                int flags = (to_bb & opp_bb) ? CAPTURE : QUIET;
+
+                if (piece - first == 0) {
+                    if (to == from - 2) {
+                        flags = KING_CASTLE;
+                    } else if (to == from + 2) {
+                        flags = QUEEN_CASTLE;
                     }
                 }
-                // En Passant
-                else if (strcmp(end_pos, fen.en_passant_target) == 0) {
-                    if (is_white) {
-                        // Remove captured pawn
-                        bitboards_arr[11] = bitboards_arr[11] & ~(end_pos_bb >> 8);
+                else if (piece - first == 5) {
+                    if (to_bb & (RANK_1 | RANK_8)) {
+                        // One move per promotion piece, queen first
+                        for (int promotion = QUEEN_PROMOTION; promotion >= KNIGHT_PROMOTION && count < limit; promotion--) {
+                            count = add_move(pos, is_white, MOVE(from, to, promotion | flags), move_list, count);
+                        }
+                        if (count >= limit) {
+                            return count;
+                        }
+                        continue;
                     }
-                    else {
-                        // Remove captured pawn
-                        bitboards_arr[5] = bitboards_arr[5] & ~(end_pos_bb << 8);
+                    if (to_bb == ep_target) {
+                        flags = EN_PASSANT;
+                    } else if (to == from + 16 || to == from - 16) {
+                        flags = DOUBLE_PAWN_PUSH;
                     }
-                    // And the bitwise complement of our start position to our bitboard to remove it from start position
-                    bitboards_arr[i] = bitboards_arr[i] & ~start_pos_bb;
-                    // Or the end position to our bitboard to add it to the end position
-                    bitboards_arr[i] = bitboards_arr[i] | end_pos_bb;
                 }
-                // Regular capture
-                else {
-                    // And the bitwise complement of our start position to our bitboard to remove it from start position
-                    bitboards_arr[i] = bitboards_arr[i] & ~start_pos_bb;
-                    // And the bitwise complement of our end position to each bitboard to remove any captured piece
-                    for (int j = 0; j < 12; j++) {
-                        bitboards_arr[j] = bitboards_arr[j] & ~end_pos_bb;
-                    }
-                    // Or the end position to our bitboard to add it to the end position
-                    bitboards_arr[i] = bitboards_arr[i] | end_pos_bb;
+                count = add_move(pos, is_white, MOVE(from, to, flags), move_list, count);
+                if (count >= limit) {
+                    return count;
                 }
             }
         }
     }
-    // Update active color
-    if (is_white) {
-        (*fen_ptr).active_color = 'b';
-    } else {
-        (*fen_ptr).active_color = 'w';
+    return count;
+}
+
+/* Fill move_list with the legal moves for one side that start on a square of from_mask and end
+on a square of to_mask, and return the number of moves. move_list must have room for MAX_MOVES
+moves. Masks let a search generate captures and quiet moves separately, or check that a single
+move is legal without generating the rest. */
+int generate_moves_between(Position *pos, bool is_white, U64 from_mask, U64 to_mask, Move *move_list)
+{
+    return generate_moves_upto(pos, is_white, from_mask, to_mask, move_list, MAX_MOVES);
+}
+
+/* Fill move_list with every legal move for one side and return the number of moves.
+move_list must have room for MAX_MOVES moves. */
+int generate_legal_moves(Position *pos, bool is_white, Move *move_list)
+{
+    return generate_moves_between(pos, is_white, ~0ULL, ~0ULL, move_list);
+}
+
+/* Fill move_list with the legal captures, en passant included, of the side to move, and
+return their number */
+int generate_captures(Position *pos, Move *move_list)
+{
+    bool is_white = pos->fen.active_color == 'w';
+    U64 ep_target = pos->fen.en_passant_square == NO_SQUARE ? 0ULL : 1ULL << pos->fen.en_passant_square;
+    return generate_moves_between(pos, is_white, ~0ULL, opp_bitboard(is_white, pos->bitboards) | ep_target, move_list);
+}
+
+// Fill move_list with the legal moves of the side to move that capture nothing, and return their number
+int generate_quiets(Position *pos, Move *move_list)
+{
+    bool is_white = pos->fen.active_color == 'w';
+    U64 ep_target = pos->fen.en_passant_square == NO_SQUARE ? 0ULL : 1ULL << pos->fen.en_passant_square;
+    return generate_moves_between(pos, is_white, ~0ULL, ~(opp_bitboard(is_white, pos->bitboards) | ep_target), move_list);
+}
+
+// Return true if a move is legal for the side to move, without generating any other moves
+bool is_legal_move(Position *pos, Move move)
+{
+    Move move_list[MAX_MOVES];
+    int count = generate_moves_between(pos, pos->fen.active_color == 'w', 1ULL << MOVE_FROM(move), 1ULL << MOVE_TO(move), move_list);
+    for (int i = 0; i < count; i++) {
+        if (move_list[i] == move) {
+            return true;
+        }
     }
+    return false;
+}
+
+/* Return true if the side to move has a legal move, stopping at the first one found. King moves
+are tried first, since they are the only way out of a double check. */
+bool has_legal_move(Position *pos)
+{
+    Move move_list[MAX_MOVES];
+    bool is_white = pos->fen.active_color == 'w';
+    U64 king_bb = pos->bitboards[is_white ? WHITE_KING : BLACK_KING];
+
+    return generate_moves_upto(pos, is_white, king_bb, ~0ULL, move_list, 1)
+        || generate_moves_upto(pos, is_white, ~king_bb, ~0ULL, move_list, 1);
+}
+
+/* Return true if neither side has enough material left to checkmate: bare kings, a single minor
+piece, or only bishops all on squares of one color */
+bool insufficient_material(Position *pos)
+{
+    U64 *bitboards = pos->bitboards;
+    U64 knights = bitboards[WHITE_KNIGHT] | bitboards[BLACK_KNIGHT];
+    U64 bishops = bitboards[WHITE_BISHOP] | bitboards[BLACK_BISHOP];
+
+    if (bitboards[WHITE_PAWN] | bitboards[BLACK_PAWN] | bitboards[WHITE_ROOK] | bitboards[BLACK_ROOK]
+        | bitboards[WHITE_QUEEN] | bitboards[BLACK_QUEEN]) {
+        return false;
+    }
+    if (__builtin_popcountll(knights | bishops) <= 1) {
+        return true;
+    }
+    return !knights && (!(bishops & LIGHT_SQUARES) || !(bishops & ~LIGHT_SQUARES));
+}
+
+// Fill move_list with every legal move for the side to move and return the number of moves
+int generate_moves(Position *pos, Move *move_list)
+{
+    if (!pos) {
+        pos = &default_position;
+    }
+    return generate_legal_moves(pos, pos->fen.active_color == 'w', move_list);
+}
+
+// Return true if I'm checkmated
+bool detect_checkmate(Position *pos, bool is_white) {
+    if (!pos) {
+        pos = &default_position;
+    }
+    if ((pos->fen.active_color == 'w') != is_white) {
+        return false;
+    }
+    return am_i_checked(pos->bitboards, is_white) && !has_legal_move(pos);
 }
 
-char *make_move(char start_pos[], char end_pos[]) 
+/* Return true if the current position has been reached twice before in the game with the same
+side to move */
+static bool is_threefold_repetition(Position *pos)
 {
-    process_move(start_pos, end_pos, bitboards, &fen);
-    update_piece_placement();
-    return stringify_fen();
-}
\ No newline at end of file
+    int repetitions = 0;
+    for (int i = pos->history_count - 2; i >= 0; i -= 2) {
+        if (pos->game_history[i] == pos->zobrist_key && ++repetitions == 2) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Return GAME_ONGOING, or the Game_Status that ends the game in the current position. Checkmate
+on the move that reaches the fifty-move limit still counts as checkmate. */
+int game_status(Position *pos)
+{
+    if (!pos) {
+        pos = &default_position;
+    }
+    if (insufficient_material(pos)) {
+        return INSUFFICIENT_MATERIAL;
+    }
+    if (!has_legal_move(pos)) {
+        return am_i_checked(pos->bitboards, pos->fen.active_color == 'w') ? CHECKMATE : STALEMATE;
+    }
+    if (pos->fen.halfmove_clock >= 100) {
+        return FIFTY_MOVE_RULE;
+    }
+    if (is_threefold_repetition(pos)) {
+        return THREEFOLD_REPETITION;
+    }
+    return GAME_ONGOING;
+}
+
+// Return pawn's position if a pawn needs promotion
+char *detect_pawn_promotion(Position *pos) {
+    if (!pos) {
+        pos = &default_position;
+    }
+    U64 pawn_promotion_bb = ((pos->bitboards[WHITE_PAWN] & RANK_8) | (pos->bitboards[BLACK_PAWN] & RANK_1));
+    if (pawn_promotion_bb) {
+        return square_to_an(__builtin_ctzll(pawn_promotion_bb), pos->square_string);
+    }
+    return NULL;
+}
+
+/* Replace the pawn on a square with the piece numbered piece_number, and return false, changing
+nothing, unless a pawn of the side that just moved stands there on its last rank and the piece
+is a queen, rook, bishop or knight of that side. get_fen returns the resulting fen string. */
+bool promote_pawn(Position *pos, char *pawn_pos, int piece_number) {
+    if (!pos) {
+        pos = &default_position;
+    }
+    int square = an_to_square(pawn_pos);
+    // The side that just moved is the one not to move now
+    bool is_white = pos->fen.active_color == 'b';
+    int pawn = is_white ? WHITE_PAWN : BLACK_PAWN;
+    int queen = is_white ? WHITE_QUEEN : BLACK_QUEEN;
+    if (square == NO_SQUARE || !(pos->bitboards[pawn] & (is_white ? RANK_8 : RANK_1) & SQUARE_BB(square))
+        || piece_number < queen || piece_number > queen + 3) {
+        return false;
+    }
+    U64 pawn_pos_bb = SQUARE_BB(square);
+    pos->bitboards[pawn] = pos->bitboards[pawn] & ~pawn_pos_bb;
+    // Add the promoted piece to its bitboard
+    pos->bitboards[piece_number] = pos->bitboards[piece_number] | pawn_pos_bb;
+    pos->piece_on[square] = piece_number;
+    pos->stale_ranks |= 1 << SQUARE_RANK(square);
+    // Swap the pawn for the promoted piece in the Zobrist key
+    pos->zobrist_key ^= zobrist_pieces[pawn][square] ^ zobrist_pieces[piece_number][square];
+    remove_eval_piece(&pos->eval, pawn, square);
+    add_eval_piece(&pos->eval, piece_number, square);
+    nnue_invalidate(pos);
+#ifdef DEBUG
+    assert(pos->zobrist_key == compute_zobrist_key(pos));
+    assert(eval_terms_match(pos));
+    assert(mailbox_matches(pos));
+#endif
+    return true;
+}
+
+// Write the piece placement of one rank into its cache, given the occupied squares of the board
+static void write_rank(Position *pos, int rank, U64 occupied)
+{
+    unsigned row = (occupied >> (rank * 8)) & 255;
+    char *text = pos->rank_text[rank];
+    int length = 0;
+    // Squares of the rank not yet written, which are the files below this one
+    int file = 8;
+
+    // Jump from one occupied square to the next, from the a file to the h file
+    while (row) {
+        int next = 31 - __builtin_clz(row);
+        if (next < file - 1) {
+            text[length++] = '0' + file - 1 - next;
+        }
+        text[length++] = fen_lookup[pos->piece_on[rank * 8 + next]];
+        row &= ~(1u << next);
+        file = next;
+    }
+    if (file) {
+        text[length++] = '0' + file;
+    }
+    pos->rank_length[rank] = length;
+}
+
+/* Bring pos->fen.piece_placement up to date, writing again only the ranks changed since it was
+last written */
+void update_piece_placement(Position *pos) {
+    char *placement = pos->fen.piece_placement;
+    U64 occupied;
+
+    if (!pos->stale_ranks) {
+        return;
+    }
+    occupied = all_bitboard(pos->bitboards);
+    for (int rank = 7; rank >= 0; rank--) {
+        if (pos->stale_ranks & (1 << rank)) {
+            write_rank(pos, rank, occupied);
+        }
+        memcpy(placement, pos->rank_text[rank], pos->rank_length[rank]);
+        placement += pos->rank_length[rank];
+        if (rank) {
+            *placement++ = '/';
+        }
+    }
+    *placement = '\0';
+    pos->stale_ranks = 0;
+}
+
+// Remember the current position before make_move leaves it, forgetting the oldest when full
+static void push_game_history(Position *pos)
+{
+    if (pos->history_count == MAX_GAME_HISTORY) {
+        memmove(pos->game_history, pos->game_history + 2, (MAX_GAME_HISTORY - 2) * sizeof(U64));
+        pos->history_count -= 2;
+    }
+    pos->game_history[pos->history_count++] = pos->zobrist_key;
+}
+
+/* Play a legal move for good, as a game does rather than a search: the position left is
+remembered for finding repetitions and the move can't be taken back */
+void play_move(Position *pos, Move move)
+{
+    push_game_history(pos);
+    do_move(pos, move);
+    // Positions before a capture or pawn move can never come again
+    if (pos->fen.halfmove_clock == 0) {
+        pos->history_count = 0;
+    }
+    pos->undo_count = 0;
+    nnue_invalidate(pos);
+}
+
+/* Make the legal move between two squares given in algebraic notation, and return false if there
+is none. get_fen returns the resulting fen string. A pawn reaching the last rank is left there
+for promote_pawn to replace once the player has chosen a piece. */
+bool make_move(Position *pos, char start_pos[], char end_pos[])
+{
+    Move move_list[MAX_MOVES];
+    int from = an_to_square(start_pos);
+    int to = an_to_square(end_pos);
+    int count;
+
+    if (!pos) {
+        pos = &default_position;
+    }
+    count = generate_moves(pos, move_list);
+
+    for (int i = 0; i < count; i++) {
+        Move move = move_list[i];
+        if (MOVE_FROM(move) == from && MOVE_TO(move) == to) {
+            if (IS_PROMOTION(move)) {
+                move = MOVE(from, to, IS_CAPTURE(move) ? CAPTURE : QUIET);
+            }
+            play_move(pos, move);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Return the fen string of the position, which is only written when asked for
+char *get_fen(Position *pos)
+{
+    if (!pos) {
+        pos = &default_position;
+    }
+    return stringify_fen(pos);
+}
+
+/* Return the piece on each of the 64 squares, from h1 to a8, numbered like Piece_Type with
+NO_PIECE for an empty square. JavaScript can read the board from these bytes without a fen
+string being written. */
+uint8_t *get_board(Position *pos)
+{
+    if (!pos) {
+        pos = &default_position;
+    }
+    return pos->piece_on;
+}
@@ -0,0 +1,444 @@
+// chess.h
+#ifndef CHESS_H
+#define CHESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* 8x8 bitboards are stored as 64 bit unsigned integers.
+files correspond to columns, and ranks correspond to rows. */
+#define FILE_A 0x8080808080808080ULL
+#define FILE_B 0x4040404040404040ULL
+#define FILE_C 0x2020202020202020ULL
+#define FILE_D 0x1010101010101010ULL
+#define FILE_E 0x0808080808080808ULL
+#define FILE_F 0x0404040404040404ULL
+#define FILE_G 0x0202020202020202ULL
+#define FILE_H 0x0101010101010101ULL
+
+#define RANK_1 0x00000000000000ffULL
+#define RANK_2 0x000000000000ff00ULL
+#define RANK_3 0x0000000000ff0000ULL
+#define RANK_4 0x00000000ff000000ULL
+#define RANK_5 0x000000ff00000000ULL
+#define RANK_6 0x0000ff0000000000ULL
+#define RANK_7 0x00ff000000000000ULL
+#define RANK_8 0xff00000000000000ULL
+
+// The light squares, h1 among them
+#define LIGHT_SQUARES 0xaa55aa55aa55aa55ULL
+
+typedef unsigned long long U64;
+
+/* Squares are numbered from 0 (h1) to 63 (a8), so a square's bitboard is 1ULL << square. Ranks
+count from 0 (the first rank) and files from 0 (the h file). */
+#define SQUARE_BB(square) (1ULL << (square))
+#define SQUARE_RANK(square) ((square) >> 3)
+#define SQUARE_FILE(square) ((square) & 7)
+
+// Return the lowest square of a non-empty bitboard and remove it from the bitboard
+static inline int pop_lsb(U64 *bitboard)
+{
+    int square = __builtin_ctzll(*bitboard);
+    *bitboard &= *bitboard - 1;
+    return square;
+}
+
+enum Piece_Type {
+    WHITE_KING = 0,
+    WHITE_QUEEN = 1,
+    WHITE_ROOK = 2,
+    WHITE_BISHOP = 3,
+    WHITE_KNIGHT = 4,
+    WHITE_PAWN = 5,
+    BLACK_KING = 6,
+    BLACK_QUEEN = 7,
+    BLACK_ROOK = 8,
+    BLACK_BISHOP = 9,
+    BLACK_KNIGHT = 10,
+    BLACK_PAWN = 11,
+    NO_PIECE = 12,
+};
+
+/* Moves are encoded in 16 bits: bits 0-5 hold the start square, bits 6-11 the end square,
+and bits 12-15 the move flags below. Squares are bit indices, so 0 is h1 and 63 is a8. */
+typedef uint16_t Move;
+
+enum Move_Flag {
+    QUIET = 0,
+    DOUBLE_PAWN_PUSH = 1,
+    KING_CASTLE = 2,
+    QUEEN_CASTLE = 3,
+    CAPTURE = 4,
+    EN_PASSANT = 5,
+    // Promotions are 8 and up, with the low two bits selecting the piece and bit 2 marking a capture
+    KNIGHT_PROMOTION = 8,
+    BISHOP_PROMOTION = 9,
+    ROOK_PROMOTION = 10,
+    QUEEN_PROMOTION = 11,
+    KNIGHT_PROMOTION_CAPTURE = 12,
+    BISHOP_PROMOTION_CAPTURE = 13,
+    ROOK_PROMOTION_CAPTURE = 14,
+    QUEEN_PROMOTION_CAPTURE = 15,
+};
+
+#define MOVE(from, to, flags) ((Move)((from) | ((to) << 6) | ((flags) << 12)))
+#define MOVE_FROM(move) ((move) & 63)
+#define MOVE_TO(move) (((move) >> 6) & 63)
+#define MOVE_FLAGS(move) ((move) >> 12)
+#define IS_PROMOTION(move) (MOVE_FLAGS(move) & 8)
+#define IS_CAPTURE(move) (MOVE_FLAGS(move) & 4)
+// The white piece type a promotion creates, from queen (1) to knight (4)
+#define PROMOTION_PIECE(move) (4 - (MOVE_FLAGS(move) & 3))
+
+// No position has more legal moves than this
+#define MAX_MOVES 256
+
+// The deepest line of moves that can be made before they are unmade
+#define MAX_PLY 256
+
+// Marks an empty en passant target
+#define NO_SQUARE -1
+
+// The positions make_move remembers for finding repetitions, far more than the fifty-move rule allows
+#define MAX_GAME_HISTORY 256
+
+// Whether a game is over and why, in the order game_status looks
+enum Game_Status {
+    GAME_ONGOING = 0,
+    INSUFFICIENT_MATERIAL = 1,
+    CHECKMATE = 2,
+    STALEMATE = 3,
+    FIFTY_MOVE_RULE = 4,
+    THREEFOLD_REPETITION = 5,
+};
+
+// Castling rights are stored as bit flags
+enum Castling_Right {
+    WHITE_KINGSIDE = 1,
+    WHITE_QUEENSIDE = 2,
+    BLACK_KINGSIDE = 4,
+    BLACK_QUEENSIDE = 8,
+    ALL_CASTLING = 15,
+};
+
+/* A struct representing the Forsyth–Edwards Notation (FEN) of the board state. Everything but
+the piece placement is kept in binary form and only turned into text by stringify_fen, which
+also brings the piece placement up to date. */
+typedef struct {
+    char piece_placement[74];
+    char active_color;
+    int castling_rights;
+    int en_passant_square;
+    int halfmove_clock;
+    int fullmove_number;
+} Fen;
+
+/* Material and piece-square sums from white's point of view, for the middlegame and the
+endgame, and the game phase: 24 with all the pieces on the board, down to 0 with only kings
+and pawns left. Kept up to date by every move, see eval.c. */
+typedef struct {
+    int middlegame;
+    int endgame;
+    int phase;
+} Eval_Terms;
+
+#define MAX_PHASE 24
+
+// The network evaluation's sizes, see nnue.c
+#define NNUE_KING_BUCKETS 8
+#define NNUE_FEATURES (NNUE_KING_BUCKETS * 12 * 64)
+#define NNUE_HIDDEN 128
+#define NNUE_CLIP 127
+
+/* One entry of a position's accumulator stack: the first layer of the network from white's
+and black's point of view, and the pieces that the move reaching this ply put on and took off
+the board, from which the accumulators are computed when they are needed */
+typedef struct {
+    int16_t values[2][NNUE_HIDDEN] __attribute__((aligned(64)));
+    bool computed[2];
+    // Set when the board changed other than by a move, so the accumulators must be recomputed
+    bool refresh;
+    int8_t added_count;
+    int8_t removed_count;
+    int8_t added_piece[2];
+    int8_t added_square[2];
+    int8_t removed_piece[2];
+    int8_t removed_square[2];
+} Nnue_Accumulator;
+
+// The state a move overwrites, which do_move records so that undo_move can restore it
+typedef struct {
+    Move move;
+    int captured_piece;
+    int castling_rights;
+    int en_passant_square;
+    int halfmove_clock;
+    U64 zobrist_key;
+    Eval_Terms eval;
+} Undo;
+
+/* Everything that describes one game, so that any number of games can be played at once on
+different threads. Every function that reads or changes a game takes a pointer to one. */
+typedef struct {
+    U64 bitboards[12];
+    // The piece on each square, or NO_PIECE, kept in step with the bitboards
+    uint8_t piece_on[64];
+    Fen fen;
+    U64 zobrist_key;
+    Eval_Terms eval;
+    // MAX_PLY + 1 entries indexed by undo_count, or NULL to evaluate without the network
+    Nnue_Accumulator *nnue;
+    // Undo records for the moves made since the last move made through make_move
+    Undo undo_stack[MAX_PLY];
+    int undo_count;
+    /* Zobrist keys of the positions before each move made through make_move since the last
+    capture or pawn move, oldest first. Repetitions of positions earlier in the game are found
+    here, and repetitions within a search on the undo stack. */
+    U64 game_history[MAX_GAME_HISTORY];
+    int history_count;
+    /* The piece placement of each rank, indexed like SQUARE_RANK, and the ranks that moves have
+    changed since fen.piece_placement was last written. Only those are written again. */
+    char rank_text[8][8];
+    uint8_t rank_length[8];
+    uint8_t stale_ranks;
+    // Strings returned to JavaScript are kept here rather than in static buffers
+    char fen_string[100];
+    char square_string[3];
+} Position;
+
+// The position used by the JavaScript interface, defined in chess.c
+extern Position default_position;
+extern char fen_lookup[13];
+
+// Bitboard and notation helpers
+void print_bitboard(U64 bitboard);
+void print_board(Position *pos);
+int an_to_square(const char *an);
+char *square_to_an(int square, char an[3]);
+char *move_to_uci(Move move, char uci[6]);
+U64 my_bitboard(bool is_white, U64* bitboards_ptr);
+U64 opp_bitboard(bool is_white, U64* bitboards_ptr);
+U64 all_bitboard(U64* bitboards_ptr);
+char *stringify_fen(Position *pos);
+void update_piece_placement(Position *pos);
+
+// Position setup
+void set_start_bitboards(Position *pos);
+void set_position(Position *pos, U64 position_bitboards[12], Fen *position_fen);
+void update_mailbox(Position *pos);
+bool mailbox_matches(Position *pos);
+char *load_fen(Position *pos, char *fen_string);
+
+// Directions of the rays in ray_bb, towards rank 8 (north) or the a file (west) and so on
+enum Direction {
+    NORTH = 0,
+    WEST = 1,
+    SOUTH = 2,
+    EAST = 3,
+    NORTH_WEST = 4,
+    NORTH_EAST = 5,
+    SOUTH_WEST = 6,
+    SOUTH_EAST = 7,
+};
+
+/* Attacks. The leaper and line tables are compiled in from attack_tables.h, which
+native/gentables.c writes. Pawn attacks are indexed by color, with white first like the
+Piece_Type enum. between_bb holds the squares strictly between two squares that share a rank,
+file or diagonal, line_bb the whole of that line, ends included, and both are empty for squares
+that share no line. ray_bb runs from a square, not including it, to the edge of the board. */
+extern const U64 knight_attacks[64];
+extern const U64 king_attacks[64];
+extern const U64 pawn_attacks[2][64];
+extern const U64 ray_bb[8][64];
+extern const U64 between_bb[64][64];
+extern const U64 line_bb[64][64];
+U64 rook_attacks(int square, U64 occupancy);
+U64 bishop_attacks(int square, U64 occupancy);
+U64 queen_attacks(int square, U64 occupancy);
+U64 attackers_to(int square, U64 occupancy, U64 *bitboards_ptr);
+bool is_square_attacked(int square, bool by_white, U64 *bitboards_ptr);
+bool am_i_checked(U64 *bitboards_ptr, bool is_white);
+
+// Zobrist hashing
+U64 compute_zobrist_key(Position *pos);
+U64 get_zobrist_key(Position *pos);
+
+// Evaluation
+extern int piece_values[6];
+extern int phase_weights[12];
+extern int middlegame_table[12][64];
+extern int endgame_table[12][64];
+Eval_Terms compute_eval_terms(Position *pos);
+bool eval_terms_match(Position *pos);
+int evaluate(Position *pos);
+
+// Network evaluation
+bool nnue_load(const char *path);
+bool nnue_load_buffer(const void *data, size_t size);
+void nnue_unload();
+bool nnue_loaded();
+bool nnue_select_isa(const char *name);
+const char *nnue_isa();
+const char *nnue_supported_isa(int n);
+bool nnue_attach(Position *pos);
+void nnue_detach(Position *pos);
+void nnue_invalidate(Position *pos);
+int nnue_evaluate(Position *pos);
+
+// Opening book
+// The most moves book_probe returns for one position
+#define MAX_BOOK_MOVES 32
+
+typedef struct {
+    Move move;
+    int weight;
+} Book_Move;
+
+extern const U64 polyglot_random[781];
+bool polyglot_random_is_published();
+U64 polyglot_key(Position *pos);
+bool book_open(const char *path);
+bool book_open_buffer(const void *data, size_t size);
+void book_close();
+bool book_loaded();
+int book_find(U64 key, size_t *first);
+int book_probe(Position *pos, Book_Move *moves);
+
+// Standard algebraic notation and PGN games, see pgn.c
+// The longest move in SAN, such as exd8=Q+ or Qh4xe1#, and its terminating zero
+#define MAX_SAN 8
+
+// How a game ended, from the result at the end of its moves
+enum Pgn_Result {
+    PGN_UNKNOWN = 0,
+    PGN_WHITE_WINS = 1,
+    PGN_BLACK_WINS = 2,
+    PGN_DRAW = 3,
+};
+
+// What replaying a game found wrong with it, if anything
+enum Pgn_Verdict {
+    PGN_OK = 0,
+    // A move is not legal, or can't be read or told apart from another
+    PGN_ILLEGAL = 1,
+    // Every move is legal, but the game disagrees with itself, such as a result that checkmate
+    // on the board contradicts or a move marked as check that isn't
+    PGN_INCONSISTENT = 2,
+};
+
+typedef struct {
+    int verdict;
+    int result;
+    // Moves replayed, by both sides
+    int plies;
+    // The Game_Status of the last position reached
+    int status;
+    // Why a game is not PGN_OK, naming the move where there is one
+    char message[96];
+} Pgn_Game;
+
+Move san_to_move(Position *pos, const char *san);
+char *move_to_san(Position *pos, Move move, char san[MAX_SAN]);
+size_t pgn_game_length(const char *text, size_t length);
+int pgn_replay(Position *pos, const char *text, size_t length, Pgn_Game *game);
+
+// Move generation and make/unmake
+// Return the piece on a square, or NO_PIECE if it is empty
+static inline int piece_at(Position *pos, int square)
+{
+    return pos->piece_on[square];
+}
+
+void do_move(Position *pos, Move move);
+void undo_move(Position *pos);
+void play_move(Position *pos, Move move);
+int generate_moves_between(Position *pos, bool is_white, U64 from_mask, U64 to_mask, Move *move_list);
+int generate_legal_moves(Position *pos, bool is_white, Move *move_list);
+int generate_captures(Position *pos, Move *move_list);
+int generate_quiets(Position *pos, Move *move_list);
+bool is_legal_move(Position *pos, Move move);
+bool has_legal_move(Position *pos);
+bool insufficient_material(Position *pos);
+
+// Transposition table
+// What a stored score says about the true score of its position
+enum Bound {
+    NO_BOUND = 0,
+    // The true score is at most the stored score
+    UPPER_BOUND = 1,
+    // The true score is at least the stored score
+    LOWER_BOUND = 2,
+    EXACT_BOUND = 3,
+};
+
+typedef struct {
+    Move move;
+    int score;
+    int depth;
+    int bound;
+} TT_Entry;
+
+int tt_init(int megabytes);
+void tt_clear();
+void tt_new_search();
+bool tt_probe(U64 key, TT_Entry *entry);
+bool tt_store(U64 key, int depth, int bound, int score, Move move);
+int tt_fill_permille();
+
+// Search
+/* Scores are in centipawns from the point of view of the side to move. Being mated scores
+-MATE_SCORE plus the number of plies until mate, so nearer mates score further from zero. */
+#define MATE_SCORE 32000
+#define MAX_SEARCH_DEPTH 64
+
+/* What a search may spend, where 0 means no limit; at least one must be set. The node limit
+applies to each thread. */
+typedef struct {
+    int depth;
+    int time_ms;
+    long long nodes;
+    // Threads to search on, where 0 or 1 means only the calling thread
+    int threads;
+} Search_Limits;
+
+// The result of the deepest completed iteration of a search
+typedef struct {
+    Move best_move;
+    int score;
+    int depth;
+    long long nodes;
+    double seconds;
+    Move pv[MAX_SEARCH_DEPTH];
+    int pv_length;
+    // Transposition table probes, probes that found their position, and stores that replaced
+    // another position's entry from the same search
+    long long hash_probes;
+    long long hash_hits;
+    long long hash_collisions;
+    int hash_fill_permille;
+    // Beta cutoffs, and those made by the first move searched
+    long long cutoffs;
+    long long first_move_cutoffs;
+} Search_Info;
+
+bool is_repetition(Position *pos);
+void search_position(Position *pos, Search_Limits *limits, Search_Info *info);
+
+/* Functions called from JavaScript, which passes a null position pointer to use the
+default position */
+int generate_moves(Position *pos, Move *move_list);
+bool detect_checkmate(Position *pos, bool is_white);
+int game_status(Position *pos);
+char *detect_pawn_promotion(Position *pos);
+bool promote_pawn(Position *pos, char *pawn_pos, int piece_number);
+bool make_move(Position *pos, char start_pos[], char end_pos[]);
+char *get_fen(Position *pos);
+uint8_t *get_board(Position *pos);
+Move search_best_move(Position *pos, int depth, int time_ms, int *score);
+Move book_move(Position *pos);
+void set_search_threads(int threads);
+int *search_abort_flag();
+
+#endif
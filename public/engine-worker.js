@@ -0,0 +1,100 @@
+// engine-worker.js
+// Runs the wasm build of chess.c in a dedicated Worker, so that moves are generated and
+// positions searched off the page's main thread. engine.js posts it one request at a time as
+// {id, type, args} and it answers {id, result} or {id, error}. Move lists and boards are
+// answered in buffers of their own, which are transferred to the page rather than copied.
+// Every request acts on chess.c's default position.
+
+// a.out.js adds the engine to this object and calls onRuntimeInitialized once it is compiled
+self.Module = { onRuntimeInitialized: ready };
+importScripts('a.out.js');
+
+// generate_moves never writes more moves than this
+const MAX_MOVES = 256;
+
+// What each request type does, filled in once the engine is ready
+let handlers;
+// search_abort, and the id of the last request engine.js cancelled, as indexes into HEAP32,
+// or null if wasm memory isn't shared with the page and a search can't be aborted
+let abortIndex = null;
+let cancelIndex = null;
+
+function ready() {
+    // cwrapped functions, implementation in chess.c and search.c
+    const set_start_bitboards = Module.cwrap('set_start_bitboards', null, ['number']);
+    const generate_moves = Module.cwrap('generate_moves', 'number', ['number', 'number']);
+    const make_move = Module.cwrap('make_move', 'number', ['number', 'string', 'string']);
+    const detect_pawn_promotion = Module.cwrap('detect_pawn_promotion', 'string', ['number']);
+    const promote_pawn = Module.cwrap('promote_pawn', 'number', ['number', 'string', 'number']);
+    const get_fen = Module.cwrap('get_fen', 'string', ['number']);
+    const get_board = Module.cwrap('get_board', 'number', ['number']);
+    const game_status = Module.cwrap('game_status', 'number', ['number']);
+    const search_best_move = Module.cwrap('search_best_move', 'number', ['number', 'number', 'number', 'number']);
+    const set_search_threads = Module.cwrap('set_search_threads', null, ['number']);
+    const search_abort_flag = Module.cwrap('search_abort_flag', 'number', []);
+
+    // Buffers in wasm memory for generate_moves' moves, search_best_move's score and the cancelled id
+    const movesPtr = Module._malloc(2 * MAX_MOVES);
+    const scorePtr = Module._malloc(8);
+
+    handlers = {
+        newGame: () => set_start_bitboards(0),
+        // Copied out of wasm memory into a buffer of their own, which is transferred
+        legalMoves: () => {
+            const count = generate_moves(0, movesPtr);
+            return Module.HEAPU16.slice(movesPtr / 2, movesPtr / 2 + count);
+        },
+        makeMove: (startSquare, endSquare) => Boolean(make_move(0, startSquare, endSquare)),
+        // The square of a pawn waiting to be promoted, or null
+        pawnPromotion: () => detect_pawn_promotion(0) || null,
+        promotePawn: (square, pieceNumber) => Boolean(promote_pawn(0, square, pieceNumber)),
+        fen: () => get_fen(0),
+        board: () => {
+            const board = get_board(0);
+            return Module.HEAPU8.slice(board, board + 64);
+        },
+        status: () => game_status(0),
+        search: (depth, timeMs) => {
+            const move = search_best_move(0, depth, timeMs, scorePtr);
+            return { move: move, score: Module.getValue(scorePtr, 'i32') };
+        },
+        setThreads: (threads) => set_search_threads(threads),
+    };
+
+    // In a `make wasm THREADS=1` build wasm memory is a SharedArrayBuffer, which engine.js can
+    // write search_abort in while a search runs here
+    let memory = null;
+    if (typeof SharedArrayBuffer != 'undefined' && Module.HEAP32.buffer instanceof SharedArrayBuffer) {
+        memory = Module.HEAP32.buffer;
+        abortIndex = search_abort_flag() / 4;
+        cancelIndex = (scorePtr + 4) / 4;
+    }
+    self.postMessage({ type: 'ready', memory: memory, abortIndex: abortIndex, cancelIndex: cancelIndex });
+}
+
+self.onmessage = (event) => {
+    const { id, type, args } = event.data;
+    if (abortIndex != null) {
+        // engine.js writes the id it cancels, then sets search_abort. Clearing search_abort
+        // before reading the id means a cancel that lands while this request starts is kept.
+        Atomics.store(Module.HEAP32, abortIndex, 0);
+        if (Atomics.load(Module.HEAP32, cancelIndex) == id) {
+            Atomics.store(Module.HEAP32, abortIndex, 1);
+        }
+    }
+    let result;
+    try {
+        if (!handlers.hasOwnProperty(type)) {
+            throw new Error('unknown request ' + type);
+        }
+        result = handlers[type](...args);
+    } catch (err) {
+        self.postMessage({ id: id, error: String(err && err.message || err) });
+        return;
+    }
+    if (ArrayBuffer.isView(result)) {
+        self.postMessage({ id: id, result: result }, [result.buffer]);
+    } else {
+        self.postMessage({ id: id, result: result });
+    }
+};
@@ -0,0 +1,192 @@
+// engine.js
+// The page's side of engine-worker.js. Every engine call is a request posted to the worker, and
+// returns a promise of its answer, so the page never waits on the engine. Requests are sent
+// one at a time in the order they are made.
+//
+// Any request can be cancelled with an AbortSignal: one still queued is dropped, and its
+// promise rejected. A search in progress is stopped through search_abort when wasm memory is
+// shared with the worker (`make wasm THREADS=1`). Otherwise the worker is terminated and a new
+// one started, and the requests that set up the game so far are replayed on it.
+
+// Requests whose effects a restarted worker has to be given again, in order
+const ReplayedRequests = new Set(['newGame', 'makeMove', 'promotePawn', 'setThreads']);
+
+class Engine {
+    // createWorker returns a Worker running engine-worker.js, or something that acts like one
+    constructor(createWorker = () => new Worker('engine-worker.js')) {
+        this.createWorker = createWorker;
+        this.nextId = 1;
+        // Requests not yet sent, and the one the worker is answering
+        this.queue = [];
+        this.current = null;
+        // Requests that changed the engine's state, to replay on a restarted worker
+        this.history = [];
+        this.restarts = 0;
+        this.startWorker();
+    }
+
+    startWorker() {
+        this.ready = false;
+        this.abortWords = null;
+        const worker = this.createWorker();
+        // Anything a terminated worker still sends is ignored
+        worker.onmessage = (event) => worker == this.worker && this.receive(event.data);
+        worker.onerror = (event) => worker == this.worker && this.fail(new Error(event.message || 'engine worker failed'));
+        this.worker = worker;
+    }
+
+    // Terminate the worker and start a new one, which is given the game so far before anything else
+    restartWorker() {
+        this.worker.terminate();
+        this.restarts++;
+        const replay = this.history.map(entry => ({ id: this.nextId++, type: entry.type, args: entry.args, replay: true }));
+        this.queue.unshift(...replay);
+        this.startWorker();
+    }
+
+    receive(data) {
+        if (data.type == 'ready') {
+            this.ready = true;
+            if (data.memory) {
+                const words = new Int32Array(data.memory);
+                this.abortWords = { words: words, abort: data.abortIndex, cancel: data.cancelIndex };
+            }
+            this.sendNext();
+            return;
+        }
+        const request = this.current;
+        if (!request || request.id != data.id) {
+            return;
+        }
+        this.current = null;
+        // A cancelled request's promise has already been rejected
+        if (!request.cancelled) {
+            if ('error' in data) {
+                if (request.reject) {
+                    request.reject(new Error(data.error));
+                }
+            } else {
+                if (ReplayedRequests.has(request.type) && !request.replay) {
+                    this.record(request);
+                }
+                if (request.resolve) {
+                    request.resolve(data.result);
+                }
+            }
+        }
+        this.sendNext();
+    }
+
+    // Remember a request that changed the engine's state. A new game forgets the last one's moves.
+    record(request) {
+        if (request.type == 'newGame') {
+            this.history = this.history.filter(entry => entry.type == 'setThreads');
+        }
+        this.history.push({ type: request.type, args: request.args });
+    }
+
+    sendNext() {
+        if (!this.ready || this.current || this.queue.length == 0) {
+            return;
+        }
+        const request = this.queue.shift();
+        this.current = request;
+        this.worker.postMessage({ id: request.id, type: request.type, args: request.args });
+    }
+
+    // The worker died: its request fails, and the rest go to a new worker
+    fail(error) {
+        const request = this.current;
+        this.current = null;
+        if (request && request.reject && !request.cancelled) {
+            request.reject(error);
+        }
+        this.restartWorker();
+    }
+
+    cancel(request, reason) {
+        if (request.cancelled || !request.reject) {
+            return;
+        }
+        request.cancelled = true;
+        request.reject(reason);
+        if (request != this.current) {
+            this.queue.splice(this.queue.indexOf(request), 1);
+        } else if (request.type == 'search' && this.abortWords) {
+            // The worker answers with the best move so far, which is thrown away
+            const { words, abort, cancel } = this.abortWords;
+            Atomics.store(words, cancel, request.id);
+            Atomics.store(words, abort, 1);
+        } else {
+            this.current = null;
+            this.restartWorker();
+        }
+    }
+
+    // Post a request, and return a promise of the worker's answer
+    request(type, args = [], signal = null) {
+        return new Promise((resolve, reject) => {
+            if (signal && signal.aborted) {
+                reject(signal.reason);
+                return;
+            }
+            const request = { id: this.nextId++, type: type, args: args, resolve: resolve, reject: reject };
+            if (signal) {
+                signal.addEventListener('abort', () => this.cancel(request, signal.reason), { once: true });
+            }
+            this.queue.push(request);
+            this.sendNext();
+        });
+    }
+
+    newGame() {
+        return this.request('newGame');
+    }
+
+    // The legal moves of the side to move, encoded as in chess.c, in a Uint16Array
+    legalMoves(signal) {
+        return this.request('legalMoves', [], signal);
+    }
+
+    // Move a piece between squares in algebraic notation, and return false if it can't
+    makeMove(startSquare, endSquare) {
+        return this.request('makeMove', [startSquare, endSquare]);
+    }
+
+    // The square of a pawn waiting to be promoted, or null
+    pawnPromotion() {
+        return this.request('pawnPromotion');
+    }
+
+    promotePawn(square, pieceNumber) {
+        return this.request('promotePawn', [square, pieceNumber]);
+    }
+
+    fen() {
+        return this.request('fen');
+    }
+
+    // The piece on each square from h1 to a8, as get_board numbers them, in a Uint8Array
+    board() {
+        return this.request('board');
+    }
+
+    // How the game has ended, indexed like chess.c's Game_Status, where 0 means it hasn't
+    status() {
+        return this.request('status');
+    }
+
+    // The best move within a depth and a time in milliseconds, as {move, score}
+    search(depth, timeMs, signal) {
+        return this.request('search', [depth, timeMs], signal);
+    }
+
+    setThreads(threads) {
+        return this.request('setThreads', [threads]);
+    }
+}
+
+// native/workerbench.js loads this file in Node
+if (typeof module != 'undefined') {
+    module.exports = { Engine };
+}
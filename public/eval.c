@@ -0,0 +1,164 @@
+// eval.c
+/* Static evaluation by material and piece-square tables, tapered between the middlegame and
+the endgame by how much material is left. Every piece contributes a middlegame and an endgame
+value for its square, and the position keeps the sums of both, with its game phase, in its
+Eval_Terms. do_move and undo_move update the sums for just the pieces that move, so evaluating
+a position costs the same whatever is on the board. */
+#include <stdlib.h>
+#include <string.h>
+#include "chess.h"
+
+// Material values in centipawns, indexed like the white half of the Piece_Type enum
+int piece_values[6] = {0, 900, 500, 330, 320, 100};
+int endgame_piece_values[6] = {0, 950, 520, 320, 300, 130};
+
+// How much each piece counts towards the game phase, by Piece_Type
+int phase_weights[12] = {0, 4, 2, 1, 1, 0, 0, 4, 2, 1, 1, 0};
+
+/* Piece-square bonuses from white's point of view, drawn with a8 at the top left as a board is
+usually printed. The middlegame tables are the Simplified Evaluation Function's; only the king
+and pawns get different endgame tables, the king to come to the centre and pawns to run. */
+static const int middlegame_squares[6][64] = {
+    {   // King
+        -30,-40,-40,-50,-50,-40,-40,-30,
+        -30,-40,-40,-50,-50,-40,-40,-30,
+        -30,-40,-40,-50,-50,-40,-40,-30,
+        -30,-40,-40,-50,-50,-40,-40,-30,
+        -20,-30,-30,-40,-40,-30,-30,-20,
+        -10,-20,-20,-20,-20,-20,-20,-10,
+         20, 20,  0,  0,  0,  0, 20, 20,
+         20, 30, 10,  0,  0, 10, 30, 20,
+    },
+    {   // Queen
+        -20,-10,-10, -5, -5,-10,-10,-20,
+        -10,  0,  0,  0,  0,  0,  0,-10,
+        -10,  0,  5,  5,  5,  5,  0,-10,
+         -5,  0,  5,  5,  5,  5,  0, -5,
+          0,  0,  5,  5,  5,  5,  0, -5,
+        -10,  5,  5,  5,  5,  5,  0,-10,
+        -10,  0,  5,  0,  0,  0,  0,-10,
+        -20,-10,-10, -5, -5,-10,-10,-20,
+    },
+    {   // Rook
+          0,  0,  0,  0,  0,  0,  0,  0,
+          5, 10, 10, 10, 10, 10, 10,  5,
+         -5,  0,  0,  0,  0,  0,  0, -5,
+         -5,  0,  0,  0,  0,  0,  0, -5,
+         -5,  0,  0,  0,  0,  0,  0, -5,
+         -5,  0,  0,  0,  0,  0,  0, -5,
+         -5,  0,  0,  0,  0,  0,  0, -5,
+          0,  0,  0,  5,  5,  0,  0,  0,
+    },
+    {   // Bishop
+        -20,-10,-10,-10,-10,-10,-10,-20,
+        -10,  0,  0,  0,  0,  0,  0,-10,
+        -10,  0,  5, 10, 10,  5,  0,-10,
+        -10,  5,  5, 10, 10,  5,  5,-10,
+        -10,  0, 10, 10, 10, 10,  0,-10,
+        -10, 10, 10, 10, 10, 10, 10,-10,
+        -10,  5,  0,  0,  0,  0,  5,-10,
+        -20,-10,-10,-10,-10,-10,-10,-20,
+    },
+    {   // Knight
+        -50,-40,-30,-30,-30,-30,-40,-50,
+        -40,-20,  0,  0,  0,  0,-20,-40,
+        -30,  0, 10, 15, 15, 10,  0,-30,
+        -30,  5, 15, 20, 20, 15,  5,-30,
+        -30,  0, 15, 20, 20, 15,  0,-30,
+        -30,  5, 10, 15, 15, 10,  5,-30,
+        -40,-20,  0,  5,  5,  0,-20,-40,
+        -50,-40,-30,-30,-30,-30,-40,-50,
+    },
+    {   // Pawn
+          0,  0,  0,  0,  0,  0,  0,  0,
+         50, 50, 50, 50, 50, 50, 50, 50,
+         10, 10, 20, 30, 30, 20, 10, 10,
+          5,  5, 10, 25, 25, 10,  5,  5,
+          0,  0,  0, 20, 20,  0,  0,  0,
+          5, -5,-10,  0,  0,-10, -5,  5,
+          5, 10, 10,-20,-20, 10, 10,  5,
+          0,  0,  0,  0,  0,  0,  0,  0,
+    },
+};
+
+static const int endgame_king_squares[64] = {
+    -50,-40,-30,-20,-20,-30,-40,-50,
+    -30,-20,-10,  0,  0,-10,-20,-30,
+    -30,-10, 20, 30, 30, 20,-10,-30,
+    -30,-10, 30, 40, 40, 30,-10,-30,
+    -30,-10, 30, 40, 40, 30,-10,-30,
+    -30,-10, 20, 30, 30, 20,-10,-30,
+    -30,-30,  0,  0,  0,  0,-30,-30,
+    -50,-30,-30,-30,-30,-30,-30,-50,
+};
+
+static const int endgame_pawn_squares[64] = {
+      0,  0,  0,  0,  0,  0,  0,  0,
+     90, 90, 90, 90, 90, 90, 90, 90,
+     50, 50, 50, 50, 50, 50, 50, 50,
+     30, 30, 30, 30, 30, 30, 30, 30,
+     15, 15, 15, 15, 15, 15, 15, 15,
+      5,  5,  5,  5,  5,  5,  5,  5,
+      0,  0,  0,  0,  0,  0,  0,  0,
+      0,  0,  0,  0,  0,  0,  0,  0,
+};
+
+/* Material plus square bonus for every piece on every square, negated for black pieces, so
+that the sums are from white's point of view */
+int middlegame_table[12][64];
+int endgame_table[12][64];
+
+__attribute__((constructor)) void init_eval_tables()
+{
+    for (int piece = 0; piece < 6; piece++) {
+        for (int square = 0; square < 64; square++) {
+            // Square 0 is h1, the last entry of a drawn table, and black sees the board upside down
+            int white_index = 63 - square;
+            int black_index = white_index ^ 56;
+            const int *endgame_squares = piece == WHITE_KING ? endgame_king_squares
+                : piece == WHITE_PAWN ? endgame_pawn_squares : middlegame_squares[piece];
+
+            middlegame_table[piece][square] = piece_values[piece] + middlegame_squares[piece][white_index];
+            endgame_table[piece][square] = endgame_piece_values[piece] + endgame_squares[white_index];
+            middlegame_table[piece + 6][square] = -piece_values[piece] - middlegame_squares[piece][black_index];
+            endgame_table[piece + 6][square] = -endgame_piece_values[piece] - endgame_squares[black_index];
+        }
+    }
+}
+
+// Compute the evaluation terms of the current position from scratch
+Eval_Terms compute_eval_terms(Position *pos)
+{
+    Eval_Terms terms = {0, 0, 0};
+    for (int piece = 0; piece < 12; piece++) {
+        U64 pieces = pos->bitboards[piece];
+        while (pieces) {
+            int square = pop_lsb(&pieces);
+            terms.middlegame += middlegame_table[piece][square];
+            terms.endgame += endgame_table[piece][square];
+            terms.phase += phase_weights[piece];
+        }
+    }
+    return terms;
+}
+
+// Return true if the incrementally updated terms match a computation from scratch
+bool eval_terms_match(Position *pos)
+{
+    Eval_Terms terms = compute_eval_terms(pos);
+    return terms.middlegame == pos->eval.middlegame && terms.endgame == pos->eval.endgame
+        && terms.phase == pos->eval.phase;
+}
+
+/* Return the score in centipawns from the point of view of the side to move, by the network
+for a position with an accumulator stack, and otherwise by blending the middlegame and endgame
+sums by the game phase */
+int evaluate(Position *pos)
+{
+    if (pos->nnue) {
+        return nnue_evaluate(pos);
+    }
+    int phase = pos->eval.phase < MAX_PHASE ? pos->eval.phase : MAX_PHASE;
+    int score = (pos->eval.middlegame * phase + pos->eval.endgame * (MAX_PHASE - phase)) / MAX_PHASE;
+    return pos->fen.active_color == 'w' ? score : -score;
+}
@@ -0,0 +1,500 @@
+// nnue.c
+/* An efficiently updatable neural network (NNUE) evaluation, used instead of the piece-square
+tables in eval.c once a network has been loaded.
+
+The input is one feature per piece on a square, seen from each side's point of view and
+bucketed by where that side's king stands (HalfKP style, with the kings counted as pieces
+and the 64 king squares folded into 8 buckets to keep the network small enough for the
+browser). The first layer turns the inputs into NNUE_HIDDEN int16 values per side, the
+accumulator, and a move only changes the few columns of the pieces it moves, so accumulators
+are updated rather than recomputed. The output layer clips both accumulators, side to move
+first, to 0..NNUE_CLIP and takes their dot product with int8 weights.
+
+do_move records the pieces each move puts on and takes off the board in the position's
+accumulator stack, one entry per ply. The accumulators themselves are only brought up to date
+when a position is evaluated, from the nearest computed entry below it, so moves that are made
+and taken back without an evaluation, as in perft, cost nothing. A king moving to another
+bucket changes every feature of its side, which is then recomputed from the board.
+
+The first layer and output dot products have SSE4.1, AVX2 and wasm simd128 versions beside the
+scalar one. Natively the best the CPU supports is picked at startup; the wasm build uses
+simd128 when compiled with -msimd128.
+
+A network file, all little-endian:
+    uint32 magic "WCNN", uint32 version 1, uint32 NNUE_FEATURES, uint32 NNUE_HIDDEN
+    int32 output divisor, int32 output bias
+    int16 feature biases[NNUE_HIDDEN]
+    int16 feature weights[NNUE_FEATURES][NNUE_HIDDEN]
+    int8 output weights[2][NNUE_HIDDEN], side to move first
+The score in centipawns is (dot product + output bias) / output divisor. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "chess.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS
+#endif
+#ifdef __wasm_simd128__
+#include <wasm_simd128.h>
+#endif
+
+#define NNUE_MAGIC 0x4e4e4357
+#define NNUE_VERSION 1
+#define NNUE_HEADER_SIZE 24
+
+// Most columns a refresh adds to the accumulator at once
+#define MAX_COLUMNS 32
+
+typedef struct {
+    int32_t output_divisor;
+    int32_t output_bias;
+    int16_t *feature_biases;
+    int16_t *feature_weights;
+    int8_t *output_weights;
+} Network;
+
+Network network;
+bool network_loaded;
+
+/* The kernels for one instruction set: update sets out to in plus the added columns minus the
+removed ones (out may be in), and output returns the output layer's dot product */
+typedef struct {
+    const char *name;
+    void (*update)(int16_t *out, const int16_t *in, const int16_t **added, int added_count,
+                   const int16_t **removed, int removed_count);
+    int32_t (*output)(const int16_t *us, const int16_t *them, const int8_t *weights);
+} Nnue_Kernels;
+
+static inline int clip(int value)
+{
+    return value < 0 ? 0 : value > NNUE_CLIP ? NNUE_CLIP : value;
+}
+
+static void update_scalar(int16_t *out, const int16_t *in, const int16_t **added, int added_count,
+                          const int16_t **removed, int removed_count)
+{
+    for (int i = 0; i < NNUE_HIDDEN; i++) {
+        int16_t value = in[i];
+        for (int a = 0; a < added_count; a++) {
+            value += added[a][i];
+        }
+        for (int r = 0; r < removed_count; r++) {
+            value -= removed[r][i];
+        }
+        out[i] = value;
+    }
+}
+
+static int32_t output_scalar(const int16_t *us, const int16_t *them, const int8_t *weights)
+{
+    int32_t sum = 0;
+    for (int i = 0; i < NNUE_HIDDEN; i++) {
+        sum += clip(us[i]) * weights[i];
+        sum += clip(them[i]) * weights[NNUE_HIDDEN + i];
+    }
+    return sum;
+}
+
+#ifdef HAVE_X86_KERNELS
+__attribute__((target("sse4.1")))
+static void update_sse41(int16_t *out, const int16_t *in, const int16_t **added, int added_count,
+                         const int16_t **removed, int removed_count)
+{
+    for (int i = 0; i < NNUE_HIDDEN; i += 8) {
+        __m128i value = _mm_loadu_si128((const __m128i *)&in[i]);
+        for (int a = 0; a < added_count; a++) {
+            value = _mm_add_epi16(value, _mm_loadu_si128((const __m128i *)&added[a][i]));
+        }
+        for (int r = 0; r < removed_count; r++) {
+            value = _mm_sub_epi16(value, _mm_loadu_si128((const __m128i *)&removed[r][i]));
+        }
+        _mm_storeu_si128((__m128i *)&out[i], value);
+    }
+}
+
+// Clip 8 accumulator values and multiply them by 8 sign-extended weights, summing in pairs
+__attribute__((target("sse4.1")))
+static inline __m128i dot_sse41(const int16_t *values, const int8_t *weights)
+{
+    __m128i clipped = _mm_min_epi16(_mm_max_epi16(_mm_loadu_si128((const __m128i *)values), _mm_setzero_si128()),
+                                    _mm_set1_epi16(NNUE_CLIP));
+    return _mm_madd_epi16(clipped, _mm_cvtepi8_epi16(_mm_loadl_epi64((const __m128i *)weights)));
+}
+
+__attribute__((target("sse4.1")))
+static int32_t output_sse41(const int16_t *us, const int16_t *them, const int8_t *weights)
+{
+    __m128i sum = _mm_setzero_si128();
+    for (int i = 0; i < NNUE_HIDDEN; i += 8) {
+        sum = _mm_add_epi32(sum, dot_sse41(&us[i], &weights[i]));
+        sum = _mm_add_epi32(sum, dot_sse41(&them[i], &weights[NNUE_HIDDEN + i]));
+    }
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+    return _mm_cvtsi128_si32(sum);
+}
+
+__attribute__((target("avx2")))
+static void update_avx2(int16_t *out, const int16_t *in, const int16_t **added, int added_count,
+                        const int16_t **removed, int removed_count)
+{
+    for (int i = 0; i < NNUE_HIDDEN; i += 16) {
+        __m256i value = _mm256_loadu_si256((const __m256i *)&in[i]);
+        for (int a = 0; a < added_count; a++) {
+            value = _mm256_add_epi16(value, _mm256_loadu_si256((const __m256i *)&added[a][i]));
+        }
+        for (int r = 0; r < removed_count; r++) {
+            value = _mm256_sub_epi16(value, _mm256_loadu_si256((const __m256i *)&removed[r][i]));
+        }
+        _mm256_storeu_si256((__m256i *)&out[i], value);
+    }
+}
+
+__attribute__((target("avx2")))
+static inline __m256i dot_avx2(const int16_t *values, const int8_t *weights)
+{
+    __m256i clipped = _mm256_min_epi16(_mm256_max_epi16(_mm256_loadu_si256((const __m256i *)values), _mm256_setzero_si256()),
+                                       _mm256_set1_epi16(NNUE_CLIP));
+    return _mm256_madd_epi16(clipped, _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)weights)));
+}
+
+__attribute__((target("avx2")))
+static int32_t output_avx2(const int16_t *us, const int16_t *them, const int8_t *weights)
+{
+    __m256i sum = _mm256_setzero_si256();
+    for (int i = 0; i < NNUE_HIDDEN; i += 16) {
+        sum = _mm256_add_epi32(sum, dot_avx2(&us[i], &weights[i]));
+        sum = _mm256_add_epi32(sum, dot_avx2(&them[i], &weights[NNUE_HIDDEN + i]));
+    }
+    __m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0x4e));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0xb1));
+    return _mm_cvtsi128_si32(half);
+}
+#endif
+
+#ifdef __wasm_simd128__
+static void update_simd128(int16_t *out, const int16_t *in, const int16_t **added, int added_count,
+                           const int16_t **removed, int removed_count)
+{
+    for (int i = 0; i < NNUE_HIDDEN; i += 8) {
+        v128_t value = wasm_v128_load(&in[i]);
+        for (int a = 0; a < added_count; a++) {
+            value = wasm_i16x8_add(value, wasm_v128_load(&added[a][i]));
+        }
+        for (int r = 0; r < removed_count; r++) {
+            value = wasm_i16x8_sub(value, wasm_v128_load(&removed[r][i]));
+        }
+        wasm_v128_store(&out[i], value);
+    }
+}
+
+static inline v128_t dot_simd128(const int16_t *values, const int8_t *weights)
+{
+    v128_t clipped = wasm_i16x8_min(wasm_i16x8_max(wasm_v128_load(values), wasm_i16x8_splat(0)), wasm_i16x8_splat(NNUE_CLIP));
+    return wasm_i32x4_dot_i16x8(clipped, wasm_i16x8_load8x8(weights));
+}
+
+static int32_t output_simd128(const int16_t *us, const int16_t *them, const int8_t *weights)
+{
+    v128_t sum = wasm_i32x4_splat(0);
+    for (int i = 0; i < NNUE_HIDDEN; i += 8) {
+        sum = wasm_i32x4_add(sum, dot_simd128(&us[i], &weights[i]));
+        sum = wasm_i32x4_add(sum, dot_simd128(&them[i], &weights[NNUE_HIDDEN + i]));
+    }
+    return wasm_i32x4_extract_lane(sum, 0) + wasm_i32x4_extract_lane(sum, 1)
+        + wasm_i32x4_extract_lane(sum, 2) + wasm_i32x4_extract_lane(sum, 3);
+}
+#endif
+
+// Every instruction set this build has kernels for, best first
+static const Nnue_Kernels all_kernels[] = {
+#ifdef HAVE_X86_KERNELS
+    {"avx2", update_avx2, output_avx2},
+    {"sse4.1", update_sse41, output_sse41},
+#endif
+#ifdef __wasm_simd128__
+    {"simd128", update_simd128, output_simd128},
+#endif
+    {"scalar", update_scalar, output_scalar},
+};
+
+#define KERNEL_COUNT (int)(sizeof(all_kernels) / sizeof(all_kernels[0]))
+
+const Nnue_Kernels *kernels = &all_kernels[KERNEL_COUNT - 1];
+
+static bool cpu_supports(const char *name)
+{
+#ifdef HAVE_X86_KERNELS
+    if (strcmp(name, "avx2") == 0) {
+        return __builtin_cpu_supports("avx2");
+    }
+    if (strcmp(name, "sse4.1") == 0) {
+        return __builtin_cpu_supports("sse4.1");
+    }
+#endif
+    return true;
+}
+
+/* Use the kernels for an instruction set by name, or the best the CPU supports for NULL.
+Return false, changing nothing, if this build or CPU doesn't have it. Must not be called while
+a search is running. */
+bool nnue_select_isa(const char *name)
+{
+    for (int i = 0; i < KERNEL_COUNT; i++) {
+        if ((!name || strcmp(name, all_kernels[i].name) == 0) && cpu_supports(all_kernels[i].name)) {
+            kernels = &all_kernels[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+// Return the name of the instruction set in use
+const char *nnue_isa()
+{
+    return kernels->name;
+}
+
+/* Return the name of the nth instruction set this build and CPU support, best first, or NULL
+past the last */
+const char *nnue_supported_isa(int n)
+{
+    for (int i = 0; i < KERNEL_COUNT; i++) {
+        if (cpu_supports(all_kernels[i].name) && n-- == 0) {
+            return all_kernels[i].name;
+        }
+    }
+    return NULL;
+}
+
+__attribute__((constructor)) void init_nnue_kernels()
+{
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+#endif
+    nnue_select_isa(NULL);
+}
+
+static uint32_t read_u32(const unsigned char *bytes)
+{
+    return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+// Forget the loaded network, so that evaluate goes back to the piece-square tables
+void nnue_unload()
+{
+    free(network.feature_biases);
+    free(network.feature_weights);
+    free(network.output_weights);
+    memset(&network, 0, sizeof(network));
+    network_loaded = false;
+}
+
+/* Load a network from a buffer in the file format above, and return false, leaving no network
+loaded, if it is not one. Must not be called while a search is running. */
+bool nnue_load_buffer(const void *data, size_t size)
+{
+    const unsigned char *bytes = data;
+    size_t biases_size = NNUE_HIDDEN * sizeof(int16_t);
+    size_t weights_size = (size_t)NNUE_FEATURES * NNUE_HIDDEN * sizeof(int16_t);
+    size_t output_size = 2 * NNUE_HIDDEN * sizeof(int8_t);
+
+    nnue_unload();
+    if (size != NNUE_HEADER_SIZE + biases_size + weights_size + output_size
+        || read_u32(bytes) != NNUE_MAGIC || read_u32(bytes + 4) != NNUE_VERSION
+        || read_u32(bytes + 8) != NNUE_FEATURES || read_u32(bytes + 12) != NNUE_HIDDEN
+        || (int32_t)read_u32(bytes + 16) <= 0) {
+        return false;
+    }
+    network.output_divisor = (int32_t)read_u32(bytes + 16);
+    network.output_bias = (int32_t)read_u32(bytes + 20);
+    network.feature_biases = malloc(biases_size);
+    network.feature_weights = malloc(weights_size);
+    network.output_weights = malloc(output_size);
+    if (!network.feature_biases || !network.feature_weights || !network.output_weights) {
+        nnue_unload();
+        return false;
+    }
+    bytes += NNUE_HEADER_SIZE;
+    memcpy(network.feature_biases, bytes, biases_size);
+    memcpy(network.feature_weights, bytes + biases_size, weights_size);
+    memcpy(network.output_weights, bytes + biases_size + weights_size, output_size);
+    network_loaded = true;
+    return true;
+}
+
+// Load a network file, returning false if it can't be read or is not a network
+bool nnue_load(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    unsigned char *data;
+    long size;
+    bool loaded = false;
+
+    if (!file) {
+        return false;
+    }
+    if (fseek(file, 0, SEEK_END) == 0 && (size = ftell(file)) > 0 && fseek(file, 0, SEEK_SET) == 0
+        && (data = malloc(size))) {
+        if (fread(data, 1, size, file) == (size_t)size) {
+            loaded = nnue_load_buffer(data, size);
+        }
+        free(data);
+    }
+    fclose(file);
+    return loaded;
+}
+
+bool nnue_loaded()
+{
+    return network_loaded;
+}
+
+// Mark the top of the accumulator stack to be recomputed, after the board changed other than by do_move
+void nnue_invalidate(Position *pos)
+{
+    if (pos->nnue) {
+        Nnue_Accumulator *entry = &pos->nnue[pos->undo_count];
+        entry->computed[0] = entry->computed[1] = false;
+        entry->refresh = true;
+        entry->added_count = entry->removed_count = 0;
+    }
+}
+
+/* Give a position an accumulator stack, so that evaluate uses the network for it. Return false
+if no network is loaded or there is no memory. */
+bool nnue_attach(Position *pos)
+{
+    if (!network_loaded) {
+        return false;
+    }
+    pos->nnue = aligned_alloc(64, (MAX_PLY + 1) * sizeof(Nnue_Accumulator));
+    if (!pos->nnue) {
+        return false;
+    }
+    // No entry below the current one describes a move made from the one below it
+    for (int i = 0; i <= MAX_PLY; i++) {
+        pos->nnue[i].computed[0] = pos->nnue[i].computed[1] = false;
+        pos->nnue[i].refresh = true;
+        pos->nnue[i].added_count = pos->nnue[i].removed_count = 0;
+    }
+    return true;
+}
+
+void nnue_detach(Position *pos)
+{
+    free(pos->nnue);
+    pos->nnue = NULL;
+}
+
+// Kings on the same rank pair of files, on the first two ranks or further up, share a bucket
+static inline int king_bucket(int square)
+{
+    return (square % 8) / 2 + (square >= 16 ? 4 : 0);
+}
+
+/* The first layer column of a piece on a square, from one side's point of view. Black sees
+the board upside down with the colors swapped, so that both sides see their own pieces as
+white ones. */
+static inline const int16_t *feature_column(int perspective, int king_square, int piece, int square)
+{
+    if (perspective) {
+        piece = piece < 6 ? piece + 6 : piece - 6;
+        square ^= 56;
+        king_square ^= 56;
+    }
+    return &network.feature_weights[((king_bucket(king_square) * 12 + piece) * 64 + square) * NNUE_HIDDEN];
+}
+
+// Return true if an accumulator can't be computed from the one below it for one side
+static bool needs_refresh(Nnue_Accumulator *entry, int perspective)
+{
+    int king = perspective ? BLACK_KING : WHITE_KING;
+    int flip = perspective ? 56 : 0;
+
+    if (entry->refresh) {
+        return true;
+    }
+    for (int r = 0; r < entry->removed_count; r++) {
+        for (int a = 0; a < entry->added_count; a++) {
+            if (entry->removed_piece[r] == king && entry->added_piece[a] == king) {
+                return king_bucket(entry->removed_square[r] ^ flip) != king_bucket(entry->added_square[a] ^ flip);
+            }
+        }
+    }
+    return false;
+}
+
+// Compute one side's accumulator from every piece on the board
+static void refresh_accumulator(Position *pos, int16_t *values, int perspective)
+{
+    int king_square = __builtin_ctzll(pos->bitboards[perspective ? BLACK_KING : WHITE_KING]);
+    const int16_t *columns[MAX_COLUMNS];
+    const int16_t *base = network.feature_biases;
+    int count = 0;
+
+    for (int piece = 0; piece < 12; piece++) {
+        U64 pieces = pos->bitboards[piece];
+        while (pieces) {
+            columns[count++] = feature_column(perspective, king_square, piece, pop_lsb(&pieces));
+            if (count == MAX_COLUMNS) {
+                kernels->update(values, base, columns, count, NULL, 0);
+                base = values;
+                count = 0;
+            }
+        }
+    }
+    kernels->update(values, base, columns, count, NULL, 0);
+}
+
+// Bring one side's accumulator at the top of the stack up to date
+static void update_accumulator(Position *pos, int perspective)
+{
+    Nnue_Accumulator *stack = pos->nnue;
+    int top = pos->undo_count;
+    int king_square = __builtin_ctzll(pos->bitboards[perspective ? BLACK_KING : WHITE_KING]);
+    int i = top;
+
+    // Find the nearest computed accumulator below, unless a refresh is needed on the way
+    while (!stack[i].computed[perspective]) {
+        if (i == 0 || needs_refresh(&stack[i], perspective)) {
+            refresh_accumulator(pos, stack[top].values[perspective], perspective);
+            stack[top].computed[perspective] = true;
+            return;
+        }
+        i--;
+    }
+    // Then apply the moves above it, keeping every step for the sibling moves searched next
+    for (i++; i <= top; i++) {
+        Nnue_Accumulator *entry = &stack[i];
+        const int16_t *added[2], *removed[2];
+        for (int a = 0; a < entry->added_count; a++) {
+            added[a] = feature_column(perspective, king_square, entry->added_piece[a], entry->added_square[a]);
+        }
+        for (int r = 0; r < entry->removed_count; r++) {
+            removed[r] = feature_column(perspective, king_square, entry->removed_piece[r], entry->removed_square[r]);
+        }
+        kernels->update(entry->values[perspective], stack[i - 1].values[perspective],
+                        added, entry->added_count, removed, entry->removed_count);
+        entry->computed[perspective] = true;
+    }
+}
+
+/* Return the network's score in centipawns from the point of view of the side to move. The
+position must have an accumulator stack. */
+int nnue_evaluate(Position *pos)
+{
+    Nnue_Accumulator *top = &pos->nnue[pos->undo_count];
+    int us = pos->fen.active_color == 'w' ? 0 : 1;
+
+    for (int perspective = 0; perspective < 2; perspective++) {
+        if (!top->computed[perspective]) {
+            update_accumulator(pos, perspective);
+        }
+    }
+    int32_t output = kernels->output(top->values[us], top->values[!us], network.output_weights);
+    return (output + network.output_bias) / network.output_divisor;
+}
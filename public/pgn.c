@@ -0,0 +1,476 @@
+// pgn.c
+/* Moves in Standard Algebraic Notation (SAN), and games in Portable Game Notation (PGN).
+
+A move in SAN names the piece, or no piece for a pawn, then the start file, rank or both only
+when another piece of the same kind could go to the same square, x for a capture, the square,
+= and a piece for a promotion, and + or # for check or checkmate: Nbd7, exd8=Q+, R1a3, O-O-O.
+Moves are resolved against the legal move generator, so a pinned piece never needs telling
+apart from one that is free to move.
+
+A PGN file is a run of games, each a block of [Tag "value"] lines followed by its moves. Moves
+come with move numbers, {comments}, comments after ; to the end of the line, (variations),
+which may nest, $ numeric annotations and ! or ? marks, and end with the result: 1-0, 0-1,
+1/2-1/2 or * for a game that didn't finish. A game that doesn't start from the start position
+gives the one it starts from in a FEN tag. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include "chess.h"
+
+#define START_FEN "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"
+
+// The longest token read from the moves of a game, far more than any move needs
+#define MAX_TOKEN 32
+
+// The longest tag value kept, which a FEN string fits in
+#define MAX_TAG_VALUE 100
+
+// Results as they are written, indexed by Pgn_Result
+static const char *result_text[4] = {"*", "1-0", "0-1", "1/2-1/2"};
+
+/* Find the legal moves a move in SAN can stand for, and return how many there are with one of
+them in *move. The x, +, #, !, ?, = and - of a move don't tell it apart from any other and are
+left out, so a move written without its x or + is found too, and so is e2-e4. */
+static int san_matches(Position *pos, const char *san, Move *move)
+{
+    Move move_list[MAX_MOVES];
+    bool is_white = pos->fen.active_color == 'w';
+    char text[MAX_TOKEN];
+    int length = 0, start = 0, matches = 0;
+    int piece = WHITE_PAWN, promotion = 0;
+
+    for (const char *s = san; *s; s++) {
+        if (strchr("x+#!?=-", *s)) {
+            continue;
+        }
+        if (length == MAX_TOKEN - 1) {
+            return 0;
+        }
+        text[length++] = *s;
+    }
+    text[length] = '\0';
+
+    // Castling, with letters or with the zeros some programs write
+    if (strcmp(text, "OO") == 0 || strcmp(text, "00") == 0 || strcmp(text, "OOO") == 0 || strcmp(text, "000") == 0) {
+        int flags = length == 2 ? KING_CASTLE : QUEEN_CASTLE;
+        int count = generate_moves_between(pos, is_white, pos->bitboards[is_white ? WHITE_KING : BLACK_KING], ~0ULL, move_list);
+        for (int i = 0; i < count; i++) {
+            if (MOVE_FLAGS(move_list[i]) == flags) {
+                *move = move_list[i];
+                matches++;
+            }
+        }
+        return matches;
+    }
+
+    if (length > 0 && strchr("KQRBN", text[0])) {
+        piece = strchr("KQRBN", text[0]) - "KQRBN";
+        start = 1;
+    }
+    if (piece == WHITE_PAWN && length > 2 && strchr("QRBN", text[length - 1])) {
+        promotion = strchr("KQRBN", text[--length]) - "KQRBN";
+    }
+    if (length - start < 2) {
+        return 0;
+    }
+    int to = an_to_square(text + length - 2);
+    if (to == NO_SQUARE) {
+        return 0;
+    }
+
+    // The start file and rank, either of which may be left out, and a pawn that doesn't capture stays on its file
+    U64 from_mask = pos->bitboards[is_white ? piece : piece + 6];
+    int i = start;
+    if (i < length - 2 && text[i] >= 'a' && text[i] <= 'h') {
+        from_mask &= FILE_H << ('h' - text[i++]);
+    } else if (piece == WHITE_PAWN) {
+        from_mask &= FILE_H << SQUARE_FILE(to);
+    }
+    if (i < length - 2 && text[i] >= '1' && text[i] <= '8') {
+        from_mask &= RANK_1 << (8 * (text[i++] - '1'));
+    }
+    if (i != length - 2) {
+        return 0;
+    }
+
+    int count = generate_moves_between(pos, is_white, from_mask, SQUARE_BB(to), move_list);
+    for (int j = 0; j < count; j++) {
+        if ((IS_PROMOTION(move_list[j]) ? PROMOTION_PIECE(move_list[j]) : 0) == promotion) {
+            *move = move_list[j];
+            matches++;
+        }
+    }
+    return matches;
+}
+
+// Return the legal move a move in SAN stands for, or 0 if it is not legal or could be more than one
+Move san_to_move(Position *pos, const char *san)
+{
+    Move move = 0;
+    if (!pos) {
+        pos = &default_position;
+    }
+    return san_matches(pos, san, &move) == 1 ? move : 0;
+}
+
+/* Write a legal move in SAN to san and return it. The start file is given when it tells the
+move apart from the other pieces of its kind that can go to the same square, else the start
+rank, else both. */
+char *move_to_san(Position *pos, Move move, char san[MAX_SAN])
+{
+    Move move_list[MAX_MOVES];
+    int from = MOVE_FROM(move);
+    int to = MOVE_TO(move);
+    int piece = piece_at(pos, from);
+    bool is_white = piece < 6;
+    char *s = san;
+
+    if (MOVE_FLAGS(move) == KING_CASTLE || MOVE_FLAGS(move) == QUEEN_CASTLE) {
+        strcpy(s, MOVE_FLAGS(move) == KING_CASTLE ? "O-O" : "O-O-O");
+        s += strlen(s);
+    } else {
+        if (piece % 6 == WHITE_PAWN) {
+            if (IS_CAPTURE(move)) {
+                *s++ = 'h' - SQUARE_FILE(from);
+            }
+        } else {
+            *s++ = "KQRBN"[piece % 6];
+            U64 rivals = 0;
+            int count = generate_moves_between(pos, is_white, pos->bitboards[piece] & ~SQUARE_BB(from), SQUARE_BB(to), move_list);
+            for (int i = 0; i < count; i++) {
+                rivals |= SQUARE_BB(MOVE_FROM(move_list[i]));
+            }
+            if (rivals) {
+                bool file_shared = rivals & (FILE_H << SQUARE_FILE(from));
+                bool rank_shared = rivals & (RANK_1 << (8 * SQUARE_RANK(from)));
+                if (!file_shared || rank_shared) {
+                    *s++ = 'h' - SQUARE_FILE(from);
+                }
+                if (file_shared) {
+                    *s++ = '1' + SQUARE_RANK(from);
+                }
+            }
+        }
+        if (IS_CAPTURE(move)) {
+            *s++ = 'x';
+        }
+        square_to_an(to, s);
+        s += 2;
+        if (IS_PROMOTION(move)) {
+            *s++ = '=';
+            *s++ = "KQRBN"[PROMOTION_PIECE(move)];
+        }
+    }
+
+    do_move(pos, move);
+    if (am_i_checked(pos->bitboards, !is_white)) {
+        *s++ = has_legal_move(pos) ? '+' : '#';
+    }
+    undo_move(pos);
+    *s = '\0';
+    return san;
+}
+
+// Return the index just past a tag that starts at text[i], whose value may hold a ]
+static size_t skip_tag(const char *text, size_t length, size_t i)
+{
+    bool quoted = false;
+    for (i++; i < length; i++) {
+        if (quoted && text[i] == '\\') {
+            i++;
+        } else if (text[i] == '"') {
+            quoted = !quoted;
+        } else if (!quoted && text[i] == ']') {
+            return i + 1;
+        }
+    }
+    return length;
+}
+
+// Return the index of the end of the line text[i] is on
+static size_t skip_line(const char *text, size_t length, size_t i)
+{
+    while (i < length && text[i] != '\n') {
+        i++;
+    }
+    return i;
+}
+
+/* Return the length of the first game of text: everything up to the tag that starts the next
+game, or all of it when no game follows. Comments are skipped, so a [ in one never starts a
+game, and a file can be split into games this way without any moves being read. */
+size_t pgn_game_length(const char *text, size_t length)
+{
+    bool in_moves = false;
+    size_t i = 0;
+
+    while (i < length) {
+        char c = text[i];
+        if (c == '{') {
+            const char *end = memchr(text + i, '}', length - i);
+            i = end ? (size_t)(end - text) + 1 : length;
+        } else if (c == ';' || (c == '%' && (i == 0 || text[i - 1] == '\n'))) {
+            i = skip_line(text, length, i);
+        } else if (c == '[') {
+            if (in_moves) {
+                return i;
+            }
+            i = skip_tag(text, length, i);
+        } else {
+            in_moves |= !isspace((unsigned char)c);
+            i++;
+        }
+    }
+    return length;
+}
+
+// Record what is wrong with a game, keeping the first problem found unless a worse one follows
+static void flag(Pgn_Game *game, int verdict, const char *format, ...)
+{
+    va_list args;
+    if (game->verdict == PGN_ILLEGAL || game->verdict == verdict) {
+        return;
+    }
+    game->verdict = verdict;
+    va_start(args, format);
+    vsnprintf(game->message, sizeof(game->message), format, args);
+    va_end(args);
+}
+
+static int parse_result(const char *text)
+{
+    for (int result = 0; result < 4; result++) {
+        if (strcmp(text, result_text[result]) == 0) {
+            return result;
+        }
+    }
+    return -1;
+}
+
+/* Read the tag at text[*i] into name and value and move *i past it, or return false if it is
+not a tag */
+static bool read_tag(const char *text, size_t length, size_t *i, char *name, size_t name_size, char *value)
+{
+    size_t j = *i + 1, n = 0, v = 0;
+
+    while (j < length && (isalnum((unsigned char)text[j]) || text[j] == '_')) {
+        if (n < name_size - 1) {
+            name[n++] = text[j];
+        }
+        j++;
+    }
+    name[n] = '\0';
+    while (j < length && text[j] == ' ') {
+        j++;
+    }
+    if (n == 0 || j == length || text[j] != '"') {
+        return false;
+    }
+    for (j++; j < length && text[j] != '"'; j++) {
+        if (text[j] == '\\' && j + 1 < length) {
+            j++;
+        }
+        if (v < MAX_TAG_VALUE - 1) {
+            value[v++] = text[j];
+        }
+    }
+    value[v] = '\0';
+    for (j++; j < length && text[j] == ' '; j++) {
+    }
+    if (j >= length || text[j] != ']') {
+        return false;
+    }
+    *i = j + 1;
+    return true;
+}
+
+// Return the index just past the variation that starts at text[i], or 0 if it is never closed
+static size_t skip_variation(const char *text, size_t length, size_t i)
+{
+    int depth = 0;
+    while (i < length) {
+        char c = text[i];
+        if (c == '{') {
+            const char *end = memchr(text + i, '}', length - i);
+            if (!end) {
+                return 0;
+            }
+            i = end - text;
+        } else if (c == ';') {
+            i = skip_line(text, length, i);
+            continue;
+        } else if (c == '(') {
+            depth++;
+        } else if (c == ')' && --depth == 0) {
+            return i + 1;
+        }
+        i++;
+    }
+    return 0;
+}
+
+static const char *check_text(char mark)
+{
+    return mark == '#' ? "checkmate" : mark == '+' ? "check" : "no check";
+}
+
+/* Play a move of a game given in SAN, and check the way it is written: its x and its + or #
+must agree with the move. Return false if it is not a legal move. */
+static bool replay_move(Position *pos, const char *san, Pgn_Game *game)
+{
+    char label[MAX_TOKEN + 16];
+    bool is_white = pos->fen.active_color == 'w';
+    int length = strlen(san);
+    Move move;
+
+    snprintf(label, sizeof(label), "%d%s%s", pos->fen.fullmove_number, is_white ? "." : "...", san);
+    int matches = san_matches(pos, san, &move);
+    if (matches != 1) {
+        flag(game, PGN_ILLEGAL, "%s is %s", label, matches ? "ambiguous" : "not a legal move");
+        return false;
+    }
+    // Annotations like ! and ?! come after the check mark
+    while (length > 0 && (san[length - 1] == '!' || san[length - 1] == '?')) {
+        length--;
+    }
+    char written = length > 0 && (san[length - 1] == '+' || san[length - 1] == '#') ? san[length - 1] : 0;
+    bool castles = MOVE_FLAGS(move) == KING_CASTLE || MOVE_FLAGS(move) == QUEEN_CASTLE;
+    if (!castles && (strchr(san, 'x') != NULL) != (IS_CAPTURE(move) != 0)) {
+        flag(game, PGN_INCONSISTENT, "%s %s", label, IS_CAPTURE(move) ? "is a capture written without x" : "is written with x but captures nothing");
+    }
+
+    play_move(pos, move);
+    game->plies++;
+    char actual = 0;
+    if (am_i_checked(pos->bitboards, !is_white)) {
+        actual = has_legal_move(pos) ? '+' : '#';
+    }
+    if (written != actual) {
+        flag(game, PGN_INCONSISTENT, "%s is marked %s but gives %s", label, check_text(written), check_text(actual));
+    }
+    return true;
+}
+
+/* Replay one game of PGN text from its tags to its result in pos, which is left where the game
+ends, and fill in game with what was found. Return its Pgn_Verdict. Variations are skipped
+without being checked. Besides illegal moves, the game is inconsistent if its move numbers are
+out of step with its moves, its result disagrees with its Result tag or with checkmate,
+stalemate or insufficient material at the end, it has no result, or a move is marked as check,
+checkmate or capture wrongly. */
+int pgn_replay(Position *pos, const char *text, size_t length, Pgn_Game *game)
+{
+    char token[MAX_TOKEN], tag_name[16], tag_value[MAX_TAG_VALUE];
+    int tag_result = -1;
+    bool in_moves = false, ended = false;
+    size_t i = 0;
+
+    memset(game, 0, sizeof(*game));
+    game->result = PGN_UNKNOWN;
+    load_fen(pos, START_FEN);
+
+    while (i < length && !ended && game->verdict != PGN_ILLEGAL) {
+        char c = text[i];
+        if (isspace((unsigned char)c)) {
+            i++;
+        } else if (c == '{') {
+            const char *end = memchr(text + i, '}', length - i);
+            if (!end) {
+                flag(game, PGN_ILLEGAL, "a comment is never closed");
+                break;
+            }
+            i = end - text + 1;
+        } else if (c == ';' || (c == '%' && (i == 0 || text[i - 1] == '\n'))) {
+            i = skip_line(text, length, i);
+        } else if (c == '(') {
+            i = skip_variation(text, length, i);
+            if (i == 0) {
+                flag(game, PGN_ILLEGAL, "a variation is never closed");
+                break;
+            }
+        } else if (c == '$') {
+            for (i++; i < length && isdigit((unsigned char)text[i]); i++) {
+            }
+        } else if (c == '[') {
+            // A tag among the moves starts the next game
+            if (in_moves) {
+                break;
+            }
+            if (!read_tag(text, length, &i, tag_name, sizeof(tag_name), tag_value)) {
+                flag(game, PGN_ILLEGAL, "a tag can't be read");
+                break;
+            }
+            if (strcmp(tag_name, "FEN") == 0 && !load_fen(pos, tag_value)) {
+                flag(game, PGN_ILLEGAL, "the FEN tag is not a position: %.60s", tag_value);
+            } else if (strcmp(tag_name, "Result") == 0) {
+                tag_result = parse_result(tag_value);
+            }
+        } else {
+            int n = 0;
+            for ( ; i < length && !isspace((unsigned char)text[i]) && !strchr("{}()[];$", text[i]); i++) {
+                if (n < MAX_TOKEN - 1) {
+                    token[n++] = text[i];
+                }
+            }
+            if (n == 0) {
+                flag(game, PGN_ILLEGAL, "a %c stands where a move should", text[i]);
+                break;
+            }
+            token[n] = '\0';
+            in_moves = true;
+
+            int result = parse_result(token);
+            if (result >= 0) {
+                game->result = result;
+                ended = true;
+                continue;
+            }
+            // A move number, which the move itself may follow without a space: 12. 12... 12.e4
+            char *san = token;
+            if (isdigit((unsigned char)*san)) {
+                int number = 0, dots = 0;
+                char *s = san;
+                for ( ; isdigit((unsigned char)*s); s++) {
+                    number = number * 10 + (*s - '0');
+                }
+                for ( ; *s == '.'; s++) {
+                    dots++;
+                }
+                // 0-0 is castling rather than a number
+                if (dots > 0) {
+                    bool is_white = pos->fen.active_color == 'w';
+                    if (number != pos->fen.fullmove_number || (dots == 1) != is_white) {
+                        flag(game, PGN_INCONSISTENT, "move number %d%s comes where %d%s is next", number,
+                             dots == 1 ? "." : "...", pos->fen.fullmove_number, is_white ? "." : "...");
+                    }
+                    san = s;
+                }
+            }
+            if (*san && strspn(san, ".") != strlen(san)) {
+                replay_move(pos, san, game);
+            }
+        }
+    }
+
+    int status = game_status(pos);
+    game->status = status;
+    if (game->verdict != PGN_ILLEGAL) {
+        bool is_white = pos->fen.active_color == 'w';
+        if (!ended) {
+            flag(game, PGN_INCONSISTENT, "the moves end without a result");
+        } else if (tag_result >= 0 && tag_result != game->result) {
+            flag(game, PGN_INCONSISTENT, "the Result tag says %s but the moves end with %s",
+                 result_text[tag_result], result_text[game->result]);
+        }
+        if (ended && game->result != PGN_UNKNOWN) {
+            if (status == CHECKMATE && game->result != (is_white ? PGN_BLACK_WINS : PGN_WHITE_WINS)) {
+                flag(game, PGN_INCONSISTENT, "the game ends in checkmate but the result is %s", result_text[game->result]);
+            } else if ((status == STALEMATE || status == INSUFFICIENT_MATERIAL) && game->result != PGN_DRAW) {
+                flag(game, PGN_INCONSISTENT, "the game ends in %s but the result is %s",
+                     status == STALEMATE ? "stalemate" : "insufficient material", result_text[game->result]);
+            }
+        }
+    }
+    return game->verdict;
+}
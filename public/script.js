@@ -58,6 +58,16 @@ function letterToNumber(c) {
     return c.charCodeAt(0) - 96;
 }
 
+// Convert a square index used by chess.c (0 is h1, 63 is a8) to algebraic notation
+function squareToAn(square) {
+    return String.fromCharCode(104 - (square % 8)) + (Math.trunc(square / 8) + 1);
+}
+
+// Convert algebraic notation to a square index used by chess.c
+function anToSquare(an) {
+    return 8 * (parseInt(an[1]) - 1) + (104 - an.charCodeAt(0));
+}
+
 // Return true if a square is light
 function isLightSquare(file, rank) {
     if ((parseInt(rank) + letterToNumber(file)) % 2 == 1) {
@@ -67,16 +77,22 @@ function isLightSquare(file, rank) {
     }
 }
 
-// cwrapped functions, implementation in chess.c
-const set_start_bitboards = Module.cwrap('set_start_bitboards', null);
-const find_moves = Module.cwrap('find_moves', 'number', ['string', 'number', 'number']);
-const make_move = Module.cwrap('make_move', 'string', ['string', 'string']);
-const detect_pawn_promotion = Module.cwrap('detect_pawn_promotion', 'string', []);
-const promote_pawn = Module.cwrap('promote_pawn', 'string', ['string', 'number']);
-const detect_checkmate = Module.cwrap('detect_checkmate', 'number', ['number']);
+// What game_status returns for each way a game can end, indexed like chess.c's Game_Status
+const GameStatusText = [
+    null,
+    'Draw by insufficient material',
+    'Checkmate',
+    'Stalemate',
+    'Draw by the fifty-move rule',
+    'Draw by threefold repetition',
+];
+
+// Moves generated by chess.c are 16 bit integers: start square, end square, and flags
+const moveFrom = (move) => move & 63;
+const moveTo = (move) => (move >> 6) & 63;
 
 // The Game class is responsible handling the game interface and transmitting messages between players
-// Game logic is handled by calls to cwrapped functions
+// Game logic is handled by the engine, which runs chess.c in a web worker (engine.js)
 class Game {
     constructor(peer, boardElement, fen = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1") {
         this.boardElement = boardElement;
@@ -84,7 +100,11 @@ class Game {
         this.perspective;
         this.selectedSquare;
         this.potentialMoves = [];
+        this.legalMoves = [];
+        // Every call to the engine returns a promise, so the page never waits on it
+        this.engine = new Engine();
         this.outgoingConnection;
+        this.gameId;
         // Every Peer object is assigned a random, unique ID when it's created.
         // When we want to connect to another peer, we'll need to know their peer id.
         peer.on('open', (id) => {
@@ -94,9 +114,11 @@ class Game {
                 available: true,
             });
             // When the client receives a peer found message from the host
-            socket.on('peer found', (data) => {
+            socket.on('peer found', async (data) => {
                 // Determine White or Black from host message
                 this.perspective = data.myPlayerColor ? PlayerColor.Black : PlayerColor.White;
+                // The server knows the game by this id
+                this.gameId = data.gameId;
                 // Listen for incoming messages from peer
                 peer.on('connection', (incomingConnection) => {
                     incomingConnection.on('data', (data) => {
@@ -109,11 +131,11 @@ class Game {
                 // Set interface and bitboards
                 this.annotateSquares();
                 this.addPiecesToPawnPromotionModal();
-                set_start_bitboards();
+                await this.engine.newGame();
                 this.fillBoardFromFen();
                 // White goes first
                 if (this.perspective == PlayerColor.White) {
-                    this.listenForMoves();
+                    await this.listenForMoves();
                 }
             });
         });
@@ -190,23 +212,25 @@ class Game {
         }
     }
 
-    // Call cwrapped pawn_promotion function once promotion is selected
+    // Promote the pawn once promotion is selected
     listenForPawnPromotion(startSquare, endSquare) {
         pawnPromotionModal.style.display = "block";
         const promotions = pawnPromotionModal.querySelectorAll('.promotion');
         // Add event listeners to each pawn promotion option
         promotions.forEach(promotion => {
-            promotion.addEventListener('click', () => {
+            promotion.addEventListener('click', async () => {
                 let promotionNumber = parseInt(promotion.getAttribute('data-num'));
                 promotionNumber = this.perspective == PlayerColor.White ? promotionNumber : promotionNumber + 6;
                 // Update the bitboards and store the resulting fen string in this.fen
-                this.fen = promote_pawn(endSquare.id, promotionNumber);
+                await this.engine.promotePawn(endSquare.id, promotionNumber);
+                this.fen = await this.engine.fen();
                 // Update interface using fen string
                 this.fillBoardFromFen();
                 // Make the pawn promotion modal invisible
                 pawnPromotionModal.style.display = "none";
+                await this.showGameOver();
                 // Transmit the move info to peer
-                this.outgoingConnection.send({
+                this.sendMove({
                     'startPos': startSquare.id,
                     'endPos': endSquare.id,
                     'pawnPromotion': promotionNumber
@@ -216,7 +240,8 @@ class Game {
     }
 
     // Add event listeners to each piece that can be selected by the user
-    listenForMoves() {
+    async listenForMoves() {
+        this.legalMoves = await this.engine.legalMoves();
         const pieces = this.boardElement.querySelectorAll('.' + this.perspective + '.piece');
         pieces.forEach(piece => {
             piece.addEventListener('click', () => {
@@ -238,10 +263,9 @@ class Game {
         }
         this.selectedSquare = square;
         square.className = 'square highlighted';
-        // cwrapped find_moves will store its result in a pointer
-        const movesPtr = find_moves(square.id, 0, 1);
-        // read the result
-        const moves = this.readMoves(movesPtr);
+        // Destinations of the legal moves starting on this square, promotions counted once
+        const startSquare = anToSquare(square.id);
+        const moves = new Set(Array.from(this.legalMoves.filter(move => moveFrom(move) == startSquare), move => squareToAn(moveTo(move))));
         const pieceColor = square.querySelector('.piece').classList[1];
         for (let an of moves) {
             const moveSquare = document.getElementById(an);
@@ -271,59 +295,59 @@ class Game {
         this.selectedSquare = null;
     }
 
-    // Read the moves generated by cwrapped find_moves() and stored in the moves pointer
-    // Return them as a JavaScript array
-    readMoves(movesPtr) {
-        const moves = [];
-        for (let i = 0; i < 21; i++) {
-            const str = Module.UTF8ToString(movesPtr + 2*i, 2);
-            if (str) {
-                moves.push(str);
-            }
-            else { break; }
-        }
-        return moves;
-    }
-
     // Handle move selected by the user
-    movePiece(startSquare, endSquare, pieceColor) {
+    async movePiece(startSquare, endSquare, pieceColor) {
         // Update the bitboards and store the resulting fen string in this.fen
-        this.fen = make_move(startSquare.id, endSquare.id);
+        await this.engine.makeMove(startSquare.id, endSquare.id);
+        this.fen = await this.engine.fen();
         // Update the interface using the fen string
         this.fillBoardFromFen();
-        if (detect_pawn_promotion()) {
+        if (await this.engine.pawnPromotion()) {
             // Prompt the user for pawn promotion selection
             this.listenForPawnPromotion(startSquare, endSquare);
         } else {
             // Transmit the move info to peer
-            this.outgoingConnection.send({
+            this.sendMove({
                 'startPos': startSquare.id,
                 'endPos': endSquare.id,
                 'pawnPromotion': null
             });
+            // The game is over once the pawn is promoted if the move promotes one
+            await this.showGameOver();
         }
-        // If checkmate has occurred
-        if (detect_checkmate(pieceColor != PlayerColor.White)) {
-            // Make visible the checkmate modal
-            checkmateModal.style.display="block";
+    }
+
+    // If the game has ended, make visible the modal saying how, and resolve to true
+    async showGameOver() {
+        const status = await this.engine.status();
+        if (!GameStatusText[status]) {
+            return false;
         }
+        checkmateModal.querySelector('.checkmate').textContent = GameStatusText[status];
+        checkmateModal.style.display = "block";
+        return true;
+    }
+
+    // Transmit a move to the peer, and report it to the server, which checks it is legal
+    sendMove(data) {
+        this.outgoingConnection.send(data);
+        socket.emit('move', Object.assign({'gameId': this.gameId}, data));
     }
 
     // Handle moves transmitted by peer
-    handleIncomingMove(data) {
-        // Update the fen representation and bitboards by calling cwrapped functions
-        this.fen = make_move(data['startPos'], data['endPos']);
+    async handleIncomingMove(data) {
+        // Update the fen representation and bitboards in the engine, which answers in the order asked
+        this.engine.makeMove(data['startPos'], data['endPos']);
         if (data['pawnPromotion']) {
-            this.fen = promote_pawn(data['endPos'], data['promotionNumber']);
+            this.engine.promotePawn(data['endPos'], data['pawnPromotion']);
         }
+        this.fen = await this.engine.fen();
         // Update the interface using the fen representation
         this.fillBoardFromFen();
-        // Determine if I've been checkmated
-        if (detect_checkmate(this.perspective == PlayerColor.White)) {
-            checkmateModal.style.display="block";
-        } else {
+        // Determine if the game has ended with this move
+        if (!await this.showGameOver()) {
             // Otherwise user is free to make a move
-            this.listenForMoves();
+            await this.listenForMoves();
         }
     }
 }
\ No newline at end of file
@@ -0,0 +1,619 @@
+// search.c
+/* Choose a move by negamax alpha-beta search. Iterative deepening searches to depth 1, 2, 3...
+until the depth, node or time limit runs out, and each iteration searches the principal variation
+of the previous one first. Captures are resolved at the leaves by a quiescence search, so the
+static evaluation is only trusted in quiet positions.
+
+Searches can run on several threads at once (Lazy SMP). Every thread searches the same root on
+its own copy of the position, at depths staggered so that they don't all search the same tree
+in step, and they help each other only through the shared transposition table. */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "chess.h"
+
+/* Threads are pthreads natively, and Web Workers sharing the wasm memory when built with
+emcc -pthread. Other wasm builds always search on one thread. */
+#if !defined(__EMSCRIPTEN__) || defined(__EMSCRIPTEN_PTHREADS__)
+#include <pthread.h>
+#define HAVE_THREADS
+#endif
+
+// Deepest ply reachable by the main search and the quiescence search below it
+#define MAX_SEARCH_PLY 128
+
+// How many nodes are searched between checks of the clock
+#define CHECK_INTERVAL 2048
+
+#define MAX_SEARCH_THREADS 256
+
+// Threads used by search_best_move
+int search_thread_count = 1;
+
+/* Set to nonzero from another thread to stop the search in progress, which then returns the
+best move of its deepest completed iteration. It is never cleared here: whoever sets it clears
+it before the next search. */
+int search_abort;
+
+// What the threads of one search share
+typedef struct {
+    Search_Limits limits;
+    int max_depth;
+    double start;
+    double deadline;
+    // Set by whichever thread ends the search, and polled by the others
+    bool stop;
+} Search_Shared;
+
+// One thread's search
+typedef struct {
+    Position *pos;
+    Search_Shared *shared;
+    // 0 for the main thread
+    int thread;
+    long long nodes;
+    long long hash_probes;
+    long long hash_hits;
+    long long hash_collisions;
+    // Beta cutoffs, and those made by the first move searched, which good ordering makes most of them
+    long long cutoffs;
+    long long first_move_cutoffs;
+    // Two quiet moves per ply that recently cut the search off, tried right after the captures
+    Move killers[MAX_SEARCH_PLY][2];
+    // How often each quiet move, by side, start and end square, has cut the search off
+    int history[2][64][64];
+    // The main thread's first iteration is never stopped, so that there is always a move to play
+    int completed_depth;
+    bool stopped;
+    // Triangular principal variation table: pv[ply] holds the best line found from ply
+    Move pv[MAX_SEARCH_PLY][MAX_SEARCH_PLY];
+    int pv_length[MAX_SEARCH_PLY];
+    // The principal variation of the last completed iteration, searched first by the next
+    Move previous_pv[MAX_SEARCH_PLY];
+    int previous_pv_length;
+    // The result of the deepest iteration this thread completed
+    Search_Info info;
+} Search;
+
+double search_clock()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Return true if the position repeats one reached earlier in the line being searched, or in the
+game before it. Only positions since the last capture or pawn move, with the same side to move,
+can repeat. The undo stack holds the line back to the root, and the game history the moves
+before that, so a negative index i into the undo stack is entry history_count + i of the
+game history. */
+bool is_repetition(Position *pos)
+{
+    int oldest = pos->undo_count - pos->fen.halfmove_clock;
+    if (oldest < -pos->history_count) {
+        oldest = -pos->history_count;
+    }
+    for (int i = pos->undo_count - 2; i >= oldest; i -= 2) {
+        U64 key = i >= 0 ? pos->undo_stack[i].zobrist_key : pos->game_history[pos->history_count + i];
+        if (key == pos->zobrist_key) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Stop the search once it runs out of time or nodes, another thread has ended it, or it is aborted
+void check_limits(Search *search)
+{
+    Search_Shared *shared = search->shared;
+    if (search->thread == 0 && search->completed_depth == 0) {
+        return;
+    }
+    if (__atomic_load_n(&shared->stop, __ATOMIC_RELAXED)
+        || __atomic_load_n(&search_abort, __ATOMIC_RELAXED)
+        || (shared->limits.nodes && search->nodes >= shared->limits.nodes)
+        || (shared->limits.time_ms && search_clock() >= shared->deadline)) {
+        search->stopped = true;
+    }
+}
+
+/* Mate scores count plies from the root, but the table may see the same position at another
+ply, so they are stored counting plies from the position itself */
+int score_to_table(int score, int ply)
+{
+    return score > MATE_SCORE - MAX_SEARCH_PLY ? score + ply : score < -MATE_SCORE + MAX_SEARCH_PLY ? score - ply : score;
+}
+
+int score_from_table(int score, int ply)
+{
+    return score > MATE_SCORE - MAX_SEARCH_PLY ? score - ply : score < -MATE_SCORE + MAX_SEARCH_PLY ? score + ply : score;
+}
+
+/* Moves are tried in stages, and each stage is only generated once the ones before it have
+failed to cut the search off: the hash move, then captures with the most valuable victim and
+least valuable attacker first (MVV-LVA), then the killer moves, then the other quiet moves in
+order of their history score. */
+enum Pick_Stage {
+    HASH_STAGE,
+    GENERATE_CAPTURES_STAGE,
+    CAPTURE_STAGE,
+    KILLER_STAGE,
+    GENERATE_QUIETS_STAGE,
+    QUIET_STAGE,
+    DONE_STAGE,
+};
+
+typedef struct {
+    int stage;
+    // Only captures are picked, for the quiescence search
+    bool captures_only;
+    Move hash_move;
+    Move killers[2];
+    int killer_index;
+    Move moves[MAX_MOVES];
+    int scores[MAX_MOVES];
+    int count;
+    int next;
+} Move_Picker;
+
+// The history score of a quiet move never goes beyond this either way
+#define HISTORY_MAX 16384
+
+// Piece worth in MVV-LVA order, indexed like the white half of the Piece_Type enum
+static const int mvv_lva_rank[6] = {6, 5, 4, 3, 2, 1};
+
+int mvv_lva(Position *pos, Move move)
+{
+    int victim = MOVE_FLAGS(move) == EN_PASSANT ? WHITE_PAWN : piece_at(pos, MOVE_TO(move)) % 6;
+    int attacker = piece_at(pos, MOVE_FROM(move)) % 6;
+    int score = 8 * mvv_lva_rank[victim] - mvv_lva_rank[attacker];
+    if (IS_PROMOTION(move)) {
+        score += 8 * mvv_lva_rank[PROMOTION_PIECE(move)];
+    }
+    return score;
+}
+
+void init_picker(Move_Picker *picker, Move hash_move, Move *killers, bool captures_only)
+{
+    picker->stage = captures_only ? GENERATE_CAPTURES_STAGE : HASH_STAGE;
+    picker->captures_only = captures_only;
+    picker->hash_move = hash_move;
+    picker->killers[0] = killers ? killers[0] : 0;
+    picker->killers[1] = killers ? killers[1] : 0;
+    picker->killer_index = 0;
+}
+
+// Swap the remaining move with the highest score to the front and return it
+Move pick_best(Move_Picker *picker)
+{
+    int best = picker->next;
+    for (int i = picker->next + 1; i < picker->count; i++) {
+        if (picker->scores[i] > picker->scores[best]) {
+            best = i;
+        }
+    }
+    Move move = picker->moves[best];
+    int score = picker->scores[best];
+    picker->moves[best] = picker->moves[picker->next];
+    picker->scores[best] = picker->scores[picker->next];
+    picker->moves[picker->next] = move;
+    picker->scores[picker->next] = score;
+    picker->next++;
+    return move;
+}
+
+// Return the next move to search, or 0 when every legal move has been picked
+Move next_move(Search *search, Move_Picker *picker)
+{
+    Position *pos = search->pos;
+    int side = pos->fen.active_color == 'w' ? 0 : 1;
+    Move move;
+
+    switch (picker->stage) {
+        case HASH_STAGE:
+            picker->stage++;
+            if (picker->hash_move && is_legal_move(pos, picker->hash_move)) {
+                return picker->hash_move;
+            }
+            picker->hash_move = 0;
+            // fall through
+        case GENERATE_CAPTURES_STAGE:
+            picker->count = generate_captures(pos, picker->moves);
+            for (int i = 0; i < picker->count; i++) {
+                picker->scores[i] = mvv_lva(pos, picker->moves[i]);
+            }
+            picker->next = 0;
+            picker->stage = CAPTURE_STAGE;
+            // fall through
+        case CAPTURE_STAGE:
+            while (picker->next < picker->count) {
+                move = pick_best(picker);
+                if (move != picker->hash_move) {
+                    return move;
+                }
+            }
+            if (picker->captures_only) {
+                picker->stage = DONE_STAGE;
+                return 0;
+            }
+            picker->stage++;
+            // fall through
+        case KILLER_STAGE:
+            while (picker->killer_index < 2) {
+                move = picker->killers[picker->killer_index++];
+                if (move && move != picker->hash_move && is_legal_move(pos, move)) {
+                    return move;
+                }
+            }
+            picker->stage++;
+            // fall through
+        case GENERATE_QUIETS_STAGE:
+            picker->count = generate_quiets(pos, picker->moves);
+            for (int i = 0; i < picker->count; i++) {
+                Move quiet = picker->moves[i];
+                picker->scores[i] = search->history[side][MOVE_FROM(quiet)][MOVE_TO(quiet)];
+                // Queen promotions before any other quiet move
+                if (IS_PROMOTION(quiet) && PROMOTION_PIECE(quiet) == WHITE_QUEEN) {
+                    picker->scores[i] += 2 * HISTORY_MAX;
+                }
+            }
+            picker->next = 0;
+            picker->stage++;
+            // fall through
+        case QUIET_STAGE:
+            while (picker->next < picker->count) {
+                move = pick_best(picker);
+                if (move != picker->hash_move && move != picker->killers[0] && move != picker->killers[1]) {
+                    return move;
+                }
+            }
+            picker->stage++;
+    }
+    return 0;
+}
+
+// Move a history score towards +HISTORY_MAX or -HISTORY_MAX, by less the closer it already is
+void update_history(int *history, int bonus)
+{
+    *history += bonus - *history * abs(bonus) / HISTORY_MAX;
+}
+
+/* Reward a quiet move that cut the search off, in the killer slots of its ply and the history
+table, and penalize the quiet moves tried before it */
+void update_quiet_stats(Search *search, int ply, int depth, Move move, Move *quiets, int quiet_count)
+{
+    int side = search->pos->fen.active_color == 'w' ? 0 : 1;
+    int bonus = depth * depth > 400 ? 400 : depth * depth;
+
+    if (search->killers[ply][0] != move) {
+        search->killers[ply][1] = search->killers[ply][0];
+        search->killers[ply][0] = move;
+    }
+    update_history(&search->history[side][MOVE_FROM(move)][MOVE_TO(move)], bonus);
+    for (int i = 0; i < quiet_count; i++) {
+        if (quiets[i] != move) {
+            update_history(&search->history[side][MOVE_FROM(quiets[i])][MOVE_TO(quiets[i])], -bonus);
+        }
+    }
+}
+
+/* Search captures until the position is quiet, so that no exchange is cut off halfway. The
+side to move may always decline them and keep the static score. */
+int quiescence(Search *search, int alpha, int beta, int ply)
+{
+    Position *pos = search->pos;
+    Move_Picker picker;
+    Move move;
+    int best;
+
+    if ((++search->nodes & (CHECK_INTERVAL - 1)) == 0) {
+        check_limits(search);
+    }
+    if (search->stopped) {
+        return 0;
+    }
+
+    best = evaluate(pos);
+    if (best >= beta || ply >= MAX_SEARCH_PLY - 1) {
+        return best;
+    }
+    if (best > alpha) {
+        alpha = best;
+    }
+
+    init_picker(&picker, 0, NULL, true);
+    while ((move = next_move(search, &picker))) {
+        do_move(pos, move);
+        int score = -quiescence(search, -beta, -alpha, ply + 1);
+        undo_move(pos);
+        if (search->stopped) {
+            return 0;
+        }
+        if (score > best) {
+            best = score;
+            if (score > alpha) {
+                alpha = score;
+                if (score >= beta) {
+                    break;
+                }
+            }
+        }
+    }
+    return best;
+}
+
+/* Return the score of a position searched to a depth, from the point of view of the side to
+move. The best line found is left in search->pv[ply]. */
+int alpha_beta(Search *search, int alpha, int beta, int depth, int ply)
+{
+    Position *pos = search->pos;
+    Move_Picker picker;
+    Move move, best_move = 0;
+    Move quiets[MAX_MOVES];
+    TT_Entry entry = {0};
+    int best = -MATE_SCORE;
+    int original_alpha = alpha;
+    int moves_tried = 0, quiet_count = 0;
+
+    search->pv_length[ply] = ply;
+    if (depth <= 0) {
+        return quiescence(search, alpha, beta, ply);
+    }
+    if ((++search->nodes & (CHECK_INTERVAL - 1)) == 0) {
+        check_limits(search);
+    }
+    if (search->stopped) {
+        return 0;
+    }
+    if (ply > 0 && (pos->fen.halfmove_clock >= 100 || is_repetition(pos))) {
+        return 0;
+    }
+    if (ply >= MAX_SEARCH_PLY - 1) {
+        return evaluate(pos);
+    }
+
+    // A result stored from a search at least as deep can answer for this one, except at the root
+    search->hash_probes++;
+    if (tt_probe(pos->zobrist_key, &entry)) {
+        search->hash_hits++;
+        int score = score_from_table(entry.score, ply);
+        if (ply > 0 && entry.depth >= depth && (entry.bound == EXACT_BOUND
+            || (entry.bound == LOWER_BOUND && score >= beta) || (entry.bound == UPPER_BOUND && score <= alpha))) {
+            return score;
+        }
+    }
+
+    // Without a stored move, the principal variation of the last iteration is the best guess
+    if (!entry.move && ply < search->previous_pv_length) {
+        entry.move = search->previous_pv[ply];
+    }
+    init_picker(&picker, entry.move, search->killers[ply], false);
+    while ((move = next_move(search, &picker))) {
+        moves_tried++;
+        do_move(pos, move);
+        int score = -alpha_beta(search, -beta, -alpha, depth - 1, ply + 1);
+        undo_move(pos);
+        if (search->stopped) {
+            return 0;
+        }
+        if (score > best) {
+            best = score;
+            best_move = move;
+            if (score > alpha) {
+                alpha = score;
+                // Extend the principal variation with this move
+                search->pv[ply][ply] = move;
+                memcpy(&search->pv[ply][ply + 1], &search->pv[ply + 1][ply + 1], (search->pv_length[ply + 1] - ply - 1) * sizeof(Move));
+                search->pv_length[ply] = search->pv_length[ply + 1];
+                if (score >= beta) {
+                    search->cutoffs++;
+                    if (moves_tried == 1) {
+                        search->first_move_cutoffs++;
+                    }
+                    if (!IS_CAPTURE(move)) {
+                        update_quiet_stats(search, ply, depth, move, quiets, quiet_count);
+                    }
+                    break;
+                }
+            }
+        }
+        if (!IS_CAPTURE(move)) {
+            quiets[quiet_count++] = move;
+        }
+    }
+    if (moves_tried == 0) {
+        // Checkmate, preferring the quickest, or stalemate
+        return am_i_checked(pos->bitboards, pos->fen.active_color == 'w') ? -MATE_SCORE + ply : 0;
+    }
+
+    int bound = best >= beta ? LOWER_BOUND : best > original_alpha ? EXACT_BOUND : UPPER_BOUND;
+    if (tt_store(pos->zobrist_key, depth, bound, score_to_table(best, ply), bound == UPPER_BOUND ? 0 : best_move)) {
+        search->hash_collisions++;
+    }
+    return best;
+}
+
+/* Helper threads skip some depths, each in its own pattern, so that at any moment the threads
+are spread over several depths */
+static const int skip_size[20] = {1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4};
+static const int skip_phase[20] = {0, 1, 0, 1, 2, 3, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 6, 7};
+
+// Search by iterative deepening until the search is stopped or reaches its depth limit
+void iterative_deepening(Search *search)
+{
+    Search_Shared *shared = search->shared;
+    Search_Info *info = &search->info;
+    bool finished = search->thread == 0;
+
+    for (int depth = 1; depth <= shared->max_depth; depth++) {
+        if (search->thread > 0) {
+            int pattern = (search->thread - 1) % 20;
+            if (((depth + skip_phase[pattern]) / skip_size[pattern]) % 2) {
+                continue;
+            }
+        }
+        int score = alpha_beta(search, -MATE_SCORE, MATE_SCORE, depth, 0);
+        if (search->stopped) {
+            break;
+        }
+        search->completed_depth = depth;
+        info->depth = depth;
+        info->score = score;
+        info->pv_length = search->pv_length[0];
+        memcpy(info->pv, search->pv[0], info->pv_length * sizeof(Move));
+        info->best_move = info->pv_length ? info->pv[0] : 0;
+        memcpy(search->previous_pv, info->pv, info->pv_length * sizeof(Move));
+        search->previous_pv_length = info->pv_length;
+
+        // Another iteration takes longer than all before it, so don't start one past half the time
+        if (depth == shared->max_depth || score > MATE_SCORE - MAX_SEARCH_PLY || score < -MATE_SCORE + MAX_SEARCH_PLY) {
+            finished = true;
+            break;
+        }
+        if (search->thread == 0 && shared->limits.time_ms && search_clock() - shared->start > shared->limits.time_ms / 2000.0) {
+            break;
+        }
+    }
+    /* The main thread, or the first helper to complete the last depth or find a mate, ends the
+    search for all of them. A helper that skipped the last depth leaves the others to finish. */
+    if (finished) {
+        __atomic_store_n(&shared->stop, true, __ATOMIC_RELAXED);
+    }
+}
+
+#ifdef HAVE_THREADS
+void *search_thread(void *search)
+{
+    iterative_deepening(search);
+    return NULL;
+}
+#endif
+
+/* Search a position by iterative deepening within the limits, on limits->threads threads, and
+fill in info with the result of the deepest iteration any thread completed. The main thread's
+first iteration always completes, so there is a best move whenever the side to move has one. */
+void search_position(Position *pos, Search_Limits *limits, Search_Info *info)
+{
+    Search_Shared shared = {*limits, MAX_SEARCH_DEPTH, search_clock(), 0, false};
+    int threads = limits->threads > 1 ? limits->threads : 1;
+    Search *searches, *best;
+    Position *positions;
+    bool *attached;
+
+    if (limits->depth > 0 && limits->depth < MAX_SEARCH_DEPTH) {
+        shared.max_depth = limits->depth;
+    }
+    shared.deadline = shared.start + limits->time_ms / 1000.0;
+#ifndef HAVE_THREADS
+    threads = 1;
+#endif
+    if (threads > MAX_SEARCH_THREADS) {
+        threads = MAX_SEARCH_THREADS;
+    }
+    tt_new_search();
+
+    // Every helper thread searches its own copy of the position
+    searches = calloc(threads, sizeof(Search));
+    positions = malloc(threads * sizeof(Position));
+    attached = calloc(threads, sizeof(bool));
+    for (int i = 0; i < threads; i++) {
+        searches[i].pos = i == 0 ? pos : &positions[i];
+        searches[i].shared = &shared;
+        searches[i].thread = i;
+        if (i > 0) {
+            positions[i] = *pos;
+            positions[i].nnue = NULL;
+        }
+        // With a network loaded, every thread evaluates on its own accumulator stack
+        if (nnue_loaded() && !searches[i].pos->nnue) {
+            attached[i] = nnue_attach(searches[i].pos);
+        }
+    }
+
+#ifdef HAVE_THREADS
+    pthread_t *handles = malloc(threads * sizeof(pthread_t));
+    int started = 1;
+    for ( ; started < threads; started++) {
+        if (pthread_create(&handles[started], NULL, search_thread, &searches[started]) != 0) {
+            break;
+        }
+    }
+    iterative_deepening(&searches[0]);
+    for (int i = 1; i < started; i++) {
+        pthread_join(handles[i], NULL);
+    }
+    free(handles);
+#else
+    iterative_deepening(&searches[0]);
+#endif
+
+    best = &searches[0];
+    memset(info, 0, sizeof(*info));
+    for (int i = 0; i < threads; i++) {
+        if (searches[i].info.depth > best->info.depth && searches[i].info.pv_length) {
+            best = &searches[i];
+        }
+        info->nodes += searches[i].nodes;
+        info->hash_probes += searches[i].hash_probes;
+        info->hash_hits += searches[i].hash_hits;
+        info->hash_collisions += searches[i].hash_collisions;
+        info->cutoffs += searches[i].cutoffs;
+        info->first_move_cutoffs += searches[i].first_move_cutoffs;
+    }
+    info->best_move = best->info.best_move;
+    info->score = best->info.score;
+    info->depth = best->info.depth;
+    info->pv_length = best->info.pv_length;
+    memcpy(info->pv, best->info.pv, best->info.pv_length * sizeof(Move));
+    info->hash_fill_permille = tt_fill_permille();
+    info->seconds = search_clock() - shared.start;
+    for (int i = 0; i < threads; i++) {
+        if (attached[i]) {
+            nnue_detach(searches[i].pos);
+        }
+    }
+    free(attached);
+    free(positions);
+    free(searches);
+}
+
+/* Return the best move for the side to move found within a depth and a time in milliseconds,
+one of which may be 0 for no limit, and store its score in centipawns in *score. Returns 0 if
+the side to move has no legal move. Called from JavaScript. */
+Move search_best_move(Position *pos, int depth, int time_ms, int *score)
+{
+    Search_Limits limits = {depth, time_ms, 0, search_thread_count};
+    Search_Info info;
+
+    if (!pos) {
+        pos = &default_position;
+    }
+    // Positions in the book are answered from it without searching
+    if (book_loaded()) {
+        Move move = book_move(pos);
+        if (move) {
+            if (score) {
+                *score = 0;
+            }
+            return move;
+        }
+    }
+    search_position(pos, &limits, &info);
+    if (score) {
+        *score = info.score;
+    }
+    return info.best_move;
+}
+
+/* Return the address of search_abort, so that a web worker running searches can be told to stop
+one through wasm memory shared with the page. Called from JavaScript. */
+int *search_abort_flag()
+{
+    return &search_abort;
+}
+
+// Set how many threads search_best_move searches on. Called from JavaScript.
+void set_search_threads(int threads)
+{
+    search_thread_count = threads > 1 ? threads : 1;
+}
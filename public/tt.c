@@ -0,0 +1,199 @@
+// tt.c
+/* The transposition table remembers what searches have learned about positions, by Zobrist key,
+so a position reached again by another move order, another iteration or another thread is not
+searched from scratch. One table is shared by every search in the process.
+
+Entries are grouped four to a 64 byte bucket, so a probe touches one cache line. Threads read
+and write entries without locks: an entry is two words, its data and its key XOR its data, and
+a reader only accepts it if the two words XOR back to the key it is looking for. An entry torn
+by two threads writing at once then just looks like a miss. */
+#include <stdlib.h>
+#include <string.h>
+#include "chess.h"
+
+#ifdef __EMSCRIPTEN__
+#define DEFAULT_HASH_MB 4
+#else
+#define DEFAULT_HASH_MB 16
+#endif
+
+#define BUCKET_SIZE 4
+
+typedef struct {
+    U64 check;
+    U64 data;
+} Hash_Entry;
+
+typedef struct {
+    Hash_Entry entries[BUCKET_SIZE];
+} Hash_Bucket;
+
+/* The data word of an entry packs the move into bits 0-15, the score into bits 16-31, the
+depth into bits 32-39, the bound into bits 40-41 and the generation into bits 42-49. */
+#define DATA(move, score, depth, bound, generation) ((U64)(move) | (U64)(uint16_t)(score) << 16 \
+    | (U64)(depth) << 32 | (U64)(bound) << 40 | (U64)(generation) << 42)
+#define DATA_MOVE(data) ((Move)(data))
+#define DATA_SCORE(data) ((int)(int16_t)((data) >> 16))
+#define DATA_DEPTH(data) ((int)(((data) >> 32) & 255))
+#define DATA_BOUND(data) ((int)(((data) >> 40) & 3))
+#define DATA_GENERATION(data) ((int)(((data) >> 42) & 255))
+
+Hash_Bucket *hash_buckets;
+U64 hash_bucket_mask;
+// Counts searches, so entries left by earlier searches are replaced first
+int hash_generation;
+
+/* Allocate a table of at most the given size in megabytes, rounded down to a power of two
+buckets, and return its size in megabytes. Smaller sizes are tried if memory is short.
+Must not be called while a search is running. */
+int tt_init(int megabytes)
+{
+    U64 buckets = 1;
+
+    free(hash_buckets);
+    hash_buckets = NULL;
+    hash_bucket_mask = 0;
+    if (megabytes < 1) {
+        megabytes = 1;
+    }
+    while (buckets * 2 * sizeof(Hash_Bucket) <= (U64)megabytes << 20) {
+        buckets *= 2;
+    }
+    for ( ; buckets > 1; buckets /= 2) {
+        hash_buckets = aligned_alloc(sizeof(Hash_Bucket), buckets * sizeof(Hash_Bucket));
+        if (hash_buckets) {
+            break;
+        }
+    }
+    if (!hash_buckets) {
+        return 0;
+    }
+    hash_bucket_mask = buckets - 1;
+    tt_clear();
+    return (int)((buckets * sizeof(Hash_Bucket)) >> 20);
+}
+
+// Forget everything in the table
+void tt_clear()
+{
+    if (hash_buckets) {
+        memset(hash_buckets, 0, (hash_bucket_mask + 1) * sizeof(Hash_Bucket));
+    }
+    hash_generation = 0;
+}
+
+// Called once at the start of every search, allocating the default table if there is none
+void tt_new_search()
+{
+    if (!hash_buckets) {
+        tt_init(DEFAULT_HASH_MB);
+    }
+    hash_generation = (hash_generation + 1) & 255;
+}
+
+/* Entry words are read and written with relaxed atomics. They compile to plain loads and
+stores, but tell the compiler that other threads may change them at any time. */
+static inline U64 load_word(U64 *word)
+{
+    return __atomic_load_n(word, __ATOMIC_RELAXED);
+}
+
+static inline void store_word(U64 *word, U64 value)
+{
+    __atomic_store_n(word, value, __ATOMIC_RELAXED);
+}
+
+static inline Hash_Bucket *bucket_of(U64 key)
+{
+    return &hash_buckets[key & hash_bucket_mask];
+}
+
+// Look up a position, filling in *entry and returning true if the table has an entry for it
+bool tt_probe(U64 key, TT_Entry *entry)
+{
+    Hash_Bucket *bucket;
+    if (!hash_buckets) {
+        return false;
+    }
+    bucket = bucket_of(key);
+    for (int i = 0; i < BUCKET_SIZE; i++) {
+        U64 data = load_word(&bucket->entries[i].data);
+        U64 check = load_word(&bucket->entries[i].check);
+        if ((check ^ data) == key && DATA_BOUND(data) != NO_BOUND) {
+            entry->move = DATA_MOVE(data);
+            entry->score = DATA_SCORE(data);
+            entry->depth = DATA_DEPTH(data);
+            entry->bound = DATA_BOUND(data);
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Store what a search found about a position. An entry for the same position is updated, and
+otherwise the entry replaced is the one with the least depth, counting entries left by earlier
+searches as shallower the older they are. Return true if that replaced an entry for another
+position stored by the current search, which counts as a collision. */
+bool tt_store(U64 key, int depth, int bound, int score, Move move)
+{
+    Hash_Bucket *bucket;
+    Hash_Entry *replace = NULL;
+    U64 replace_data = 0;
+    int replace_worth = 1 << 30;
+
+    if (!hash_buckets) {
+        return false;
+    }
+    bucket = bucket_of(key);
+    for (int i = 0; i < BUCKET_SIZE; i++) {
+        Hash_Entry *entry = &bucket->entries[i];
+        U64 data = load_word(&entry->data);
+        U64 check = load_word(&entry->check);
+
+        if ((check ^ data) == key && DATA_BOUND(data) != NO_BOUND) {
+            // Keep a deeper result unless this one is exact, and keep a move if this has none
+            if (bound != EXACT_BOUND && depth < DATA_DEPTH(data) - 3) {
+                return false;
+            }
+            if (!move) {
+                move = DATA_MOVE(data);
+            }
+            replace = entry;
+            replace_data = 0;
+            break;
+        }
+        int age = (hash_generation - DATA_GENERATION(data)) & 255;
+        int worth = DATA_BOUND(data) == NO_BOUND ? -(1 << 20) : DATA_DEPTH(data) - 8 * age;
+        if (worth < replace_worth) {
+            replace = entry;
+            replace_data = data;
+            replace_worth = worth;
+        }
+    }
+
+    U64 data = DATA(move, score, depth, bound, hash_generation);
+    store_word(&replace->data, data);
+    store_word(&replace->check, key ^ data);
+    return DATA_BOUND(replace_data) != NO_BOUND && DATA_GENERATION(replace_data) == hash_generation;
+}
+
+/* Return how full the table is in entries per thousand, counting only entries stored by the
+current search, from a sample of the first buckets */
+int tt_fill_permille()
+{
+    int filled = 0;
+    int sampled = 0;
+
+    if (!hash_buckets) {
+        return 0;
+    }
+    for (U64 b = 0; b <= hash_bucket_mask && sampled < 1000; b++) {
+        for (int i = 0; i < BUCKET_SIZE; i++, sampled++) {
+            U64 data = load_word(&hash_buckets[b].entries[i].data);
+            if (DATA_BOUND(data) != NO_BOUND && DATA_GENERATION(data) == hash_generation) {
+                filled++;
+            }
+        }
+    }
+    return filled * 1000 / sampled;
+}
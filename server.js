@@ -5,12 +5,46 @@ const io = require('socket.io')(server)
 
 const port = 3000
 
+// The native engine checks every move the players make, when it has been built with `make addon`
+let engine = null;
+try {
+    engine = require('./build/chess.node');
+} catch (err) {
+    console.log('native engine not built, moves will not be checked');
+}
+
 app.use(express.static('public'));
 
 app.get('/', (req, res) => {
     res.sendFile(__dirname, '/index.html');
 });
 
+// Matched games by id, with the colour each player's socket plays, 'w' or 'b'
+var games = {};
+
+// Put the socket of a matched player in a game, taking it out of any it was in
+function joinGame(socketId, gameId, side) {
+    var socket = io.sockets.sockets.get(socketId);
+    if (socket) {
+        leaveGame(socket);
+        socket.data.gameId = gameId;
+    }
+    games[gameId].sides[socketId] = side;
+}
+
+// A game ends when either of its players leaves it
+function leaveGame(socket) {
+    var gameId = socket.data.gameId;
+    var game = games[gameId];
+    delete socket.data.gameId;
+    if (game && socket.id in game.sides) {
+        delete games[gameId];
+        if (engine) {
+            engine.deleteGame(gameId);
+        }
+    }
+}
+
 function SearchPool() {
     this.pool = {};
     this.timeouts = {};
@@ -27,13 +61,24 @@ SearchPool.prototype = {
                     // randomBoolean has a 50/50 chance of being true or false
                     // this is used to determine which player is white and which is black
                     var randomBoolean = Math.random() < 0.5;
+                    // Both players report their moves to the server under this id
+                    var gameId = user.peerId + ':' + key;
+                    if (engine) {
+                        engine.createGame(gameId);
+                    }
+                    // Moves are only taken from these sockets, each for its own colour
+                    games[gameId] = { sides: {} };
+                    joinGame(user.socketId, gameId, randomBoolean ? 'b' : 'w');
+                    joinGame(this.pool[key].socketId, gameId, randomBoolean ? 'w' : 'b');
                     io.to(user.socketId).emit("peer found", {
                         opponentPeerId: this.pool[key].peerId, 
-                        myPlayerColor: randomBoolean
+                        myPlayerColor: randomBoolean,
+                        gameId: gameId
                     });
 					io.to(this.pool[key].socketId).emit("peer found", {
                         opponentPeerId: user.peerId,
-                        myPlayerColor: !randomBoolean
+                        myPlayerColor: !randomBoolean,
+                        gameId: gameId
                     });
                     delete this.pool[key];
                     clearTimeout(this.timeouts[key]);
@@ -62,12 +107,101 @@ SearchPool.prototype = {
 
 var globalPool = new SearchPool();
 
+/* Whether a move payload holds two squares and, for a promotion, the number of a queen, rook,
+bishop or knight of either colour as used by chess.c */
+function isMovePayload(data) {
+    var square = /^[a-h][1-8]$/;
+    if (typeof data !== 'object' || data === null
+        || typeof data.startPos !== 'string' || !square.test(data.startPos)
+        || typeof data.endPos !== 'string' || !square.test(data.endPos)) {
+        return false;
+    }
+    var promotion = data.pawnPromotion;
+    return promotion == null || (Number.isInteger(promotion) && promotion % 6 >= 1 && promotion % 6 <= 4 && promotion < 12);
+}
+
+/* Moves reported during one turn of the event loop are checked together as one batch. Only one
+batch is checked at a time, as the thread pool could otherwise check a game's moves from two
+batches out of order, so moves reported meanwhile wait for the next. */
+function MoveQueue() {
+    this.checking = false;
+    this.gameIds = [];
+    this.moves = [];
+    this.sides = [];
+    this.sockets = [];
+}
+
+MoveQueue.prototype = {
+    constructor: MoveQueue,
+
+    /* Queue a move in the format players send each other, with the promotion piece number used by
+    chess.c, and the side of the player who sent it, which the engine checks is the side to move */
+    push: function(socket, gameId, side, data) {
+        var move = data.startPos + data.endPos;
+        if (data.pawnPromotion) {
+            move += 'qrbn'[(data.pawnPromotion % 6) - 1];
+        }
+        if (this.moves.length == 0 && !this.checking) {
+            setImmediate(() => this.flush());
+        }
+        this.gameIds.push(gameId);
+        this.moves.push(move);
+        this.sides.push(side);
+        this.sockets.push(socket);
+    },
+
+    flush: function() {
+        var gameIds = this.gameIds, moves = this.moves, sides = this.sides, sockets = this.sockets;
+        this.gameIds = [];
+        this.moves = [];
+        this.sides = [];
+        this.sockets = [];
+        this.checking = true;
+        engine.applyMoves(gameIds, moves, sides).then((results) => {
+            results.forEach((result, i) => {
+                if (result != engine.results.OK) {
+                    console.log('Rejected move', gameIds[i], moves[i], result);
+                    sockets[i].emit('illegal move', { gameId: gameIds[i], move: moves[i] });
+                }
+            });
+            this.checking = false;
+            if (this.moves.length) {
+                this.flush();
+            }
+        });
+    },
+}
+
+var moveQueue = new MoveQueue();
+
 io.on('connection', (socket) => {
     console.log('client connected');
     socket.join(socket.id);
 
     socket.on('disconnect', () => {
         console.log('client disconnected');
+        leaveGame(socket);
+    });
+
+    /* A move is only taken in a well-formed payload, and from a player of the game the server
+    matched the socket into */
+    socket.on('move', function(data) {
+        if (!engine) {
+            return;
+        }
+        if (!isMovePayload(data)) {
+            console.log('Rejected malformed move', data);
+            socket.emit('illegal move', { gameId: socket.data.gameId, move: null });
+            return;
+        }
+        var gameId = socket.data.gameId;
+        var game = games[gameId];
+        if (!game || !(socket.id in game.sides) || data.gameId != gameId) {
+            console.log('Rejected move from a socket not playing', data.gameId);
+            socket.emit('illegal move', { gameId: data.gameId, move: data.startPos + data.endPos });
+            return;
+        }
+        moveQueue.push(socket, gameId, game.sides[socket.id], data);
     });
 
     socket.on('offer connection', function(user){